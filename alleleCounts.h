@@ -0,0 +1,218 @@
+/****************************************************************************
+ * alleleCounts.h                                                           *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Per-site allele count files, written by calculateDxy -o for a shard of   *
+ *  the samples, and added back together by calculateDxy -M, so cohorts    *
+ *  too large to open at once can be counted across processes or nodes.     *
+ * Each site holds the A, C, G, and T allele counts of each population.     *
+ *  Every sample adds ploidy alleles to a site, either as bases or as Ns,   *
+ *  so the N and non-N counts follow from the bases and the number of       *
+ *  alleles per population, which the header stores once.  Counts are       *
+ *  stored in the fewest bytes (1, 2, or 4) that can hold that number.      *
+ *                                                                          *
+ * Layout (all integers are 64-bit little-endian unless noted):             *
+ *  magic "PSALCNT\1", number of populations, bytes per count, ploidy       *
+ *  for each population: number of alleles per site                         *
+ *  blocks of contiguous sites, each: scaffold name length, scaffold name,  *
+ *   first site (0-based), number of sites, then for each site, for each    *
+ *   population, its A, C, G, and T counts in bytes per count each          *
+ ****************************************************************************/
+
+#ifndef ALLELE_COUNTS_H
+#define ALLELE_COUNTS_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#define ALLELE_COUNTS_MAGIC "PSALCNT\1"
+#define ALLELE_COUNTS_MAGIC_LENGTH 8
+
+//Maximum number of sites per block of an allele count file:
+#define ALLELE_COUNTS_BLOCK_SITES 65536
+
+class AlleleCountWriter {
+   public:
+      AlleleCountWriter() : count_bytes(4), block_site(0), block_sites(0) {}
+
+      //Create a count file for populations with the given numbers of
+      // alleles per site (samples times ploidy), returning 0 on failure:
+      bool open(const std::string &count_path, const std::vector<uint64_t> &allele_totals, uint64_t ploidy) {
+         output.open(count_path, std::ios::out | std::ios::binary);
+         if (!output) {
+            return 0;
+         }
+         num_populations = allele_totals.size();
+         uint64_t max_total = 0;
+         for (auto total_iterator = allele_totals.begin(); total_iterator != allele_totals.end(); ++total_iterator) {
+            max_total = std::max(max_total, *total_iterator);
+         }
+         count_bytes = max_total <= UINT8_MAX ? 1 : (max_total <= UINT16_MAX ? 2 : 4);
+         output.write(ALLELE_COUNTS_MAGIC, ALLELE_COUNTS_MAGIC_LENGTH);
+         writeUint64(num_populations);
+         writeUint64(count_bytes);
+         writeUint64(ploidy);
+         for (auto total_iterator = allele_totals.begin(); total_iterator != allele_totals.end(); ++total_iterator) {
+            writeUint64(*total_iterator);
+         }
+         return (bool)output;
+      }
+
+      //Append the counts of one site, given as calculateDxy's A, C, G, T,
+      // N, non-N counts of each population:
+      void addSite(const std::string &scaffold, uint64_t site, const std::vector<std::array<unsigned long, 6>> &population_counts) {
+         if (block_sites > 0 && (scaffold != block_scaffold || site != block_site + block_sites || block_sites == ALLELE_COUNTS_BLOCK_SITES)) {
+            flushBlock();
+         }
+         if (block_sites == 0) {
+            block_scaffold = scaffold;
+            block_site = site;
+         }
+         for (unsigned long p = 0; p < num_populations; p++) {
+            for (unsigned int base = 0; base < 4; base++) {
+               uint32_t count = population_counts[p][base];
+               //Counts are little-endian, so the low bytes come first:
+               block.insert(block.end(), (const char *)&count, (const char *)&count + count_bytes);
+            }
+         }
+         block_sites++;
+      }
+
+      //Write out any remaining sites and close the file, returning 0 if
+      // anything failed to write:
+      bool close() {
+         flushBlock();
+         output.close();
+         return (bool)output;
+      }
+
+   private:
+      std::ofstream output;
+      uint64_t num_populations;
+      uint64_t count_bytes;
+      std::string block_scaffold;
+      uint64_t block_site;
+      uint64_t block_sites;
+      std::vector<char> block;
+
+      void writeUint64(uint64_t value) {
+         output.write((const char *)&value, 8);
+      }
+
+      void flushBlock() {
+         if (block_sites == 0) {
+            return;
+         }
+         writeUint64(block_scaffold.length());
+         output.write(block_scaffold.data(), block_scaffold.length());
+         writeUint64(block_site);
+         writeUint64(block_sites);
+         output.write(block.data(), block.size());
+         block.clear();
+         block_sites = 0;
+      }
+};
+
+class AlleleCountReader {
+   public:
+      AlleleCountReader() : first_site(0), num_sites(0) {}
+
+      //Open a count file and read its header, returning 0 on failure:
+      bool open(const std::string &count_path) {
+         path = count_path;
+         input.open(count_path, std::ios::in | std::ios::binary);
+         char magic[ALLELE_COUNTS_MAGIC_LENGTH];
+         if (!input.read(magic, ALLELE_COUNTS_MAGIC_LENGTH) || memcmp(magic, ALLELE_COUNTS_MAGIC, ALLELE_COUNTS_MAGIC_LENGTH) != 0) {
+            return 0;
+         }
+         uint64_t num_populations;
+         if (!readUint64(num_populations) || !readUint64(count_bytes) || !readUint64(file_ploidy) || (count_bytes != 1 && count_bytes != 2 && count_bytes != 4)) {
+            return 0;
+         }
+         allele_totals.resize(num_populations);
+         for (unsigned long p = 0; p < num_populations; p++) {
+            if (!readUint64(allele_totals[p])) {
+               return 0;
+            }
+         }
+         return 1;
+      }
+
+      const std::string &countPath() const {
+         return path;
+      }
+      unsigned long numPopulations() const {
+         return allele_totals.size();
+      }
+      uint64_t ploidy() const {
+         return file_ploidy;
+      }
+      //Number of alleles of a population at each site:
+      uint64_t alleleTotal(unsigned long population) const {
+         return allele_totals[population];
+      }
+
+      //Read the next block of sites, returning 1 on success, 0 at the end
+      // of the file, and -1 if the file is truncated or malformed:
+      int nextBlock() {
+         uint64_t name_length;
+         if (!readUint64(name_length)) {
+            return input.eof() && input.gcount() == 0 ? 0 : -1;
+         }
+         scaffold_name.resize(name_length);
+         if ((name_length > 0 && !input.read(&scaffold_name[0], name_length)) || !readUint64(first_site) || !readUint64(num_sites) || num_sites > ALLELE_COUNTS_BLOCK_SITES) {
+            return -1;
+         }
+         unsigned long num_counts = num_sites * allele_totals.size() * 4;
+         raw_counts.resize(num_counts * count_bytes);
+         if (num_counts > 0 && !input.read(raw_counts.data(), raw_counts.size())) {
+            return -1;
+         }
+         counts.assign(num_counts, 0);
+         for (unsigned long c = 0; c < num_counts; c++) {
+            memcpy(&counts[c], &raw_counts[c*count_bytes], count_bytes);
+         }
+         return 1;
+      }
+
+      //The current block:
+      const std::string &scaffold() const {
+         return scaffold_name;
+      }
+      uint64_t firstSite() const {
+         return first_site;
+      }
+      uint64_t numSites() const {
+         return num_sites;
+      }
+      //Count of a base (0-3 for A, C, G, T) of a population at a site of
+      // the block:
+      uint32_t count(uint64_t site, unsigned long population, unsigned int base) const {
+         return counts[(site * allele_totals.size() + population) * 4 + base];
+      }
+
+   private:
+      std::string path;
+      std::ifstream input;
+      uint64_t count_bytes;
+      uint64_t file_ploidy;
+      std::vector<uint64_t> allele_totals;
+      std::string scaffold_name;
+      uint64_t first_site;
+      uint64_t num_sites;
+      std::vector<char> raw_counts;
+      std::vector<uint32_t> counts;
+
+      bool readUint64(uint64_t &value) {
+         return (bool)input.read((char *)&value, 8);
+      }
+};
+
+#endif
@@ -0,0 +1,55 @@
+#!/bin/bash
+
+#Times calculateDxy and calculatePolymorphism under each combination of the
+# options their per-site loops are compiled for (-i, -u, and -s, which is
+# shared polymorphisms for calculateDxy and segregating sites for
+# calculatePolymorphism), and reports the throughput of each in millions of
+# sites per second (-d is left out, as it logs every site)
+#Uses the programs in the same directory as this script
+#Uses the samples of a popfile if one is given, and otherwise random
+# pseudoreferences (mostly invariant, with some SNPs, hets, and Ns)
+#Usage: benchConfigurations.sh [popfile] [number of samples] [number of sites]
+
+POPFILE=$1
+NUMSAMPLES=${2:-32}
+NUMSITES=${3:-1000000}
+BINDIR=$(dirname "$0")
+
+TMPDIR=$(mktemp -d)
+trap "rm -rf ${TMPDIR}" EXIT
+
+if [[ -z "${POPFILE}" ]]; then
+   #Make random pseudoreferences from one random reference, two populations:
+   POPFILE="${TMPDIR}/pop.tsv"
+   awk -v sites=${NUMSITES} 'BEGIN{srand(42); split("A C G T", bases, " "); for (i = 0; i < sites; i++) {printf "%s", bases[int(rand()*4)+1]}; print ""}' > ${TMPDIR}/ref.txt
+   for ((j = 0; j < NUMSAMPLES; j++)); do
+      awk -v seed=${j} 'BEGIN{srand(seed+1); split("A C G T R Y S W K M N", codes, " ")}{print ">bench"; n = length($0); for (i = 1; i <= n; i += 60) {line = substr($0, i, 60); if (rand() < 0.6) {k = int(rand()*length(line))+1; line = substr(line, 1, k-1) codes[int(rand()*11)+1] substr(line, k+1)}; print line}}' ${TMPDIR}/ref.txt > ${TMPDIR}/sample${j}.fa
+      printf "%s\t%d\n" "${TMPDIR}/sample${j}.fa" $((j % 2 + 1)) >> ${POPFILE}
+   done
+fi
+read -r -a FASTAS <<< "$(cut -f1 ${POPFILE} | tr '\n' ' ')"
+
+#Time one run, outputting its throughput:
+benchRun() {
+   PROGRAM=$1
+   OPTIONS=$2
+   shift 2
+   TIMEFORMAT=%R
+   SECONDS_TAKEN=$( { time "${BINDIR}/${PROGRAM}" ${OPTIONS} "$@" > ${TMPDIR}/output.tsv 2> /dev/null; } 2>&1 )
+   NUMLINES=$(wc -l < ${TMPDIR}/output.tsv)
+   if [[ "${PROGRAM}" == "calculateDxy" ]]; then
+      NUMLINES=$((NUMLINES - 1)) #Header line
+   fi
+   awk -v program=${PROGRAM} -v options="${OPTIONS:-none}" -v sites=${NUMLINES} -v seconds="${SECONDS_TAKEN}" 'BEGIN{printf "%s\t%s\t%d\t%s\t%.3f\n", program, options, sites, seconds, (seconds > 0 ? sites/seconds/1e6 : 0)}'
+}
+
+printf "Program\tOptions\tSites\tSeconds\tMsites_per_s\n"
+for INBRED in "" "-i"; do
+   for USABLE in "" "-u"; do
+      for EXTRA in "" "-s"; do
+         OPTIONS=$(echo ${INBRED} ${USABLE} ${EXTRA})
+         benchRun calculateDxy "${OPTIONS}" -p ${POPFILE}
+         benchRun calculatePolymorphism "${OPTIONS}" "${FASTAS[@]}"
+      done
+   done
+done
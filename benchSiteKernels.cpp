@@ -0,0 +1,423 @@
+/****************************************************************************
+ * benchSiteKernels.cpp                                                     *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Benchmarks the per-site kernels shared by calculateDxy,                  *
+ *  calculatePolymorphism, and sitePatterns on random pseudoreference rows. *
+ * For each sample count, reports the per-site throughput (in millions of   *
+ *  sites per second) of allele counting that reads each row directly       *
+ *  (strided) versus through transposeTile() (tiled).                       *
+ * Also reports the per-site throughput and heap allocations of memoizing   *
+ *  calculateDxy's pi and D_xy for two populations, with the old string     *
+ *  keys versus EstimateMemo's packed integer keys, once the memo is warm.  *
+ * Also reports the throughput of allele counting with countBlockAlleles()  *
+ *  at each instruction set the CPU supports, after checking that each one  *
+ *  matches the scalar kernels.                                             *
+ *                                                                          *
+ * Syntax: benchSiteKernels [options]                                       *
+ ****************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <getopt.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <array>
+#include <unordered_map>
+#include <atomic>
+#include <new>
+#include "pseudorefReader.h"
+#include "siteKernels.h"
+#include "simdKernels.h"
+
+//Define constants for getopt:
+#define no_argument 0
+#define required_argument 1
+#define optional_argument 2
+
+//Version:
+#define VERSION "1.2"
+
+//Usage/help:
+#define USAGE "benchSiteKernels\nUsage:\n benchSiteKernels [options]\n Options:\n  --help,-h:\t\tOutput this documentation\n  --version,-v:\t\tOutput the version number\n  --total_bases,-b:\tBases (sites times samples) per sample count\n\t\t\t(default: 134217728)\n  --memo_sites,-m:\tMost sites per sample count for the memo benchmark\n\t\t\t(default: 1048576)\n  --prng_seed,-p:\tSeed for the random sequences (default: 42)\n"
+
+using namespace std;
+
+//Count heap allocations, to check the per-site loops don't make any:
+atomic<unsigned long> num_allocations(0);
+void *operator new(size_t size) {
+   num_allocations++;
+   void *memory = malloc(size == 0 ? 1 : size);
+   if (memory == NULL) {
+      throw bad_alloc();
+   }
+   return memory;
+}
+void operator delete(void *memory) noexcept {
+   free(memory);
+}
+
+//Count A, C, G, T, N alleles for one sample at a site, as in calculatePolymorphism:
+inline void countBase(char base, unsigned long *base_frequency) {
+   switch (base) {
+      case 'A':
+         base_frequency[0] += 2;
+         break;
+      case 'C':
+         base_frequency[1] += 2;
+         break;
+      case 'G':
+         base_frequency[2] += 2;
+         break;
+      case 'T':
+         base_frequency[3] += 2;
+         break;
+      case 'R': //A/G het site
+         base_frequency[0]++;
+         base_frequency[2]++;
+         break;
+      case 'Y': //C/T het site
+         base_frequency[1]++;
+         base_frequency[3]++;
+         break;
+      default:
+         base_frequency[4] += 2;
+         break;
+   }
+}
+
+//Per-site loop reading one byte from each sample's row:
+unsigned long countStrided(vector<SequenceView> &rows) {
+   unsigned long checksum = 0;
+   unsigned long num_samples = rows.size();
+   for (unsigned long i = 0; i < rows[0].length; i++) {
+      unsigned long base_frequency[5] = {0, 0, 0, 0, 0};
+      for (unsigned long j = 0; j < num_samples; j++) {
+         countBase(rows[j].bases[i], base_frequency);
+      }
+      checksum += base_frequency[0] * 3 + base_frequency[4];
+   }
+   return checksum;
+}
+
+//Per-site loop reading sample-contiguous tiles:
+unsigned long countTiled(vector<SequenceView> &rows) {
+   unsigned long checksum = 0;
+   unsigned long num_samples = rows.size();
+   unsigned long num_sites = rows[0].length;
+   vector<char> site_tile;
+   for (unsigned long i = 0; i < num_sites; i++) {
+      if (i % TILE_SITES == 0) {
+         transposeTile(rows, i, min((unsigned long)TILE_SITES, num_sites-i), site_tile);
+      }
+      unsigned long base_frequency[5] = {0, 0, 0, 0, 0};
+      const char *site_bases = site_tile.data() + (i % TILE_SITES)*num_samples;
+      for (unsigned long j = 0; j < num_samples; j++) {
+         countBase(site_bases[j], base_frequency);
+      }
+      checksum += base_frequency[0] * 3 + base_frequency[4];
+   }
+   return checksum;
+}
+
+//Per-site loop over block counts from countBlockAlleles(), at whichever
+// instruction set setSimdLevel() chose:
+unsigned long countBlocks(vector<SequenceView> &rows) {
+   unsigned long checksum = 0;
+   unsigned long num_samples = rows.size();
+   unsigned long num_sites = rows[0].length;
+   vector<unsigned long> samples(num_samples);
+   for (unsigned long j = 0; j < num_samples; j++) {
+      samples[j] = j;
+   }
+   BlockAlleleCounts block_counts;
+   for (unsigned long i = 0; i < num_sites; i++) {
+      if (i % TILE_SITES == 0) {
+         countBlockAlleles(rows, samples, i, min((unsigned long)TILE_SITES, num_sites-i), block_counts);
+      }
+      unsigned long base_frequency[6];
+      blockSiteAlleles(block_counts, num_samples, i % TILE_SITES, 0, base_frequency);
+      checksum += base_frequency[0] * 3 + base_frequency[4];
+   }
+   return checksum;
+}
+
+//Check that every instruction set the CPU supports gives the same block
+// counts, site classes, and softmasking as the scalar code, on random bytes
+// (not just bases), returning the first level that differs, or SIMD_SCALAR:
+simd_level checkSimdLevels() {
+   simd_level detected = detectSimdLevel();
+   unsigned long num_samples = 300;
+   unsigned long num_sites = 1000;
+   vector<string> sequences(num_samples);
+   vector<SequenceView> rows(num_samples);
+   vector<unsigned long> samples(num_samples);
+   for (unsigned long j = 0; j < num_samples; j++) {
+      sequences[j].resize(num_sites);
+      for (unsigned long i = 0; i < num_sites; i++) {
+         sequences[j][i] = (char)(rand() % 256);
+      }
+      rows[j].bases = sequences[j].data();
+      rows[j].length = num_sites;
+      samples[j] = j;
+   }
+   vector<BlockAlleleCounts> level_counts(2);
+   vector<vector<unsigned char>> level_classes(2, vector<unsigned char>(num_sites));
+   vector<string> level_softmasked(2, string(num_sites, ' '));
+   for (int level = SIMD_SSE42; level <= detected; level++) {
+      //Odd block and run lengths exercise the scalar tails and masked loads:
+      for (unsigned long first_site = 0; first_site < num_sites; first_site += 61) {
+         unsigned long num_block_sites = min((unsigned long)TILE_SITES-3, num_sites-first_site);
+         for (unsigned int v = 0; v < 2; v++) {
+            setSimdLevel(v == 0 ? SIMD_SCALAR : (simd_level)level);
+            countBlockAlleles(rows, samples, first_site, num_block_sites, level_counts[v]);
+         }
+         if (memcmp(&level_counts[0], &level_counts[1], sizeof(BlockAlleleCounts)) != 0) {
+            return (simd_level)level;
+         }
+      }
+      for (int mode = POLYDIV_ALL; mode <= POLYDIV_DIVERGENCES; mode++) {
+         for (unsigned int v = 0; v < 2; v++) {
+            setSimdLevel(v == 0 ? SIMD_SCALAR : (simd_level)level);
+            classifyPolyDivSites(rows[0].bases, rows[1].bases, num_sites-1, mode, level_classes[v].data());
+         }
+         if (level_classes[0] != level_classes[1]) {
+            return (simd_level)level;
+         }
+      }
+      for (unsigned int v = 0; v < 2; v++) {
+         setSimdLevel(v == 0 ? SIMD_SCALAR : (simd_level)level);
+         softmaskRun(rows[0].bases, rows[1].bases, num_sites-1, &level_softmasked[v][0]);
+      }
+      if (level_softmasked[0] != level_softmasked[1]) {
+         return (simd_level)level;
+      }
+   }
+   setSimdLevel(detected);
+   return SIMD_SCALAR;
+}
+
+//Allele counts (A, C, G, T, N, non-N) of two populations at each site:
+typedef vector<array<array<unsigned long, 6>, 2>> PopulationCounts;
+
+//pi of one population, as in calculateDxy:
+double populationPi(const array<unsigned long, 6> &counts) {
+   double pi = 0.0;
+   for (unsigned long j = 0; j < 3; j++) {
+      for (unsigned long k = j+1; k < 4; k++) {
+         pi += 2*((double)counts[j]/(double)counts[5])*((double)counts[k]/(double)counts[5]);
+      }
+   }
+   return counts[5] >= 2 ? pi*(double)counts[5]/(double)(counts[5]-1) : pi;
+}
+
+//D_xy of two populations, as in calculateDxy:
+double populationDxy(const array<unsigned long, 6> &counts1, const array<unsigned long, 6> &counts2) {
+   double d_xy = 0.0;
+   for (unsigned long j = 0; j < 4; j++) {
+      for (unsigned long k = 0; k < 4; k++) {
+         if (j != k) {
+            d_xy += ((double)counts1[j]/(double)counts1[5])*((double)counts2[k]/(double)counts2[5]);
+         }
+      }
+   }
+   return d_xy;
+}
+
+//Memo keys as calculateDxy built them before EstimateMemo:
+string stringKey(const array<unsigned long, 6> &counts) {
+   string key = "";
+   for (auto count_iterator = counts.begin(); count_iterator != counts.end(); ++count_iterator) {
+      key += to_string(*count_iterator) + ",";
+   }
+   return key;
+}
+
+//Memoized pi and D_xy with string keys, returning a checksum:
+double memoString(const PopulationCounts &site_counts, unordered_map<string, double> &memoized_pi, unordered_map<string, double> &memoized_dxy) {
+   double checksum = 0.0;
+   for (auto site_iterator = site_counts.begin(); site_iterator != site_counts.end(); ++site_iterator) {
+      for (unsigned int p = 0; p < 2; p++) {
+         string pi_key = stringKey((*site_iterator)[p]);
+         if (memoized_pi.find(pi_key) == memoized_pi.end()) {
+            memoized_pi[pi_key] = populationPi((*site_iterator)[p]);
+         }
+         checksum += memoized_pi[pi_key];
+      }
+      string dxy_key = stringKey((*site_iterator)[0]) + stringKey((*site_iterator)[1]);
+      if (memoized_dxy.find(dxy_key) == memoized_dxy.end()) {
+         memoized_dxy[dxy_key] = populationDxy((*site_iterator)[0], (*site_iterator)[1]);
+      }
+      checksum += memoized_dxy[dxy_key];
+   }
+   return checksum;
+}
+
+//Memoized pi and D_xy with EstimateMemo, returning a checksum:
+double memoPacked(const PopulationCounts &site_counts, EstimateMemo &memo) {
+   double checksum = 0.0;
+   for (auto site_iterator = site_counts.begin(); site_iterator != site_counts.end(); ++site_iterator) {
+      uint32_t ids[2];
+      for (unsigned int p = 0; p < 2; p++) {
+         double pi;
+         if (!memo.findSingle((*site_iterator)[p].data(), ids[p], pi)) {
+            pi = populationPi((*site_iterator)[p]);
+            memo.storeSingle(ids[p], pi);
+         }
+         checksum += pi;
+      }
+      double d_xy;
+      if (!memo.findPair(ids[0], ids[1], d_xy)) {
+         d_xy = populationDxy((*site_iterator)[0], (*site_iterator)[1]);
+         memo.storePair(ids[0], ids[1], d_xy);
+      }
+      checksum += d_xy;
+   }
+   return checksum;
+}
+
+//Time a memo kernel over warm memos, returning millions of sites per
+// second, and the heap allocations per site:
+template <typename MemoKernel>
+double memoThroughput(MemoKernel kernel, unsigned long num_sites, double &checksum, double &allocations_per_site) {
+   kernel(); //Warm up the memo
+   unsigned long start_allocations = num_allocations;
+   auto start = chrono::steady_clock::now();
+   checksum = kernel();
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+   allocations_per_site = (double)(num_allocations - start_allocations) / (double)num_sites;
+   return (double)num_sites / elapsed.count() / 1e6;
+}
+
+//Time a kernel, returning millions of sites per second:
+double siteThroughput(unsigned long (*kernel)(vector<SequenceView> &), vector<SequenceView> &rows, unsigned long &checksum) {
+   auto start = chrono::steady_clock::now();
+   checksum = kernel(rows);
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+   return (double)rows[0].length / elapsed.count() / 1e6;
+}
+
+int main(int argc, char **argv) {
+   unsigned long total_bases = 134217728;
+   unsigned int prng_seed = 42;
+   unsigned long memo_sites = 1048576;
+
+   //Variables for getopt_long:
+   int optchar;
+   int structindex = 0;
+   //Create the struct used for getopt:
+   const struct option longoptions[] {
+      {"total_bases", required_argument, 0, 'b'},
+      {"prng_seed", required_argument, 0, 'p'},
+      {"memo_sites", required_argument, 0, 'm'},
+      {"version", no_argument, 0, 'v'},
+      {"help", no_argument, 0, 'h'}
+   };
+   //Read in the options:
+   while ((optchar = getopt_long(argc, argv, "b:p:m:vh", longoptions, &structindex)) > -1) {
+      switch(optchar) {
+         case 'b':
+            total_bases = strtoul(optarg, NULL, 10);
+            break;
+         case 'p':
+            prng_seed = atoi(optarg);
+            break;
+         case 'm':
+            memo_sites = strtoul(optarg, NULL, 10);
+            break;
+         case 'v':
+            cerr << "benchSiteKernels version " << VERSION << endl;
+            return 0;
+            break;
+         case 'h':
+            cerr << USAGE;
+            return 0;
+            break;
+         default:
+            cerr << "Unknown option " << (unsigned char)optchar << " supplied." << endl;
+            cerr << USAGE;
+            return 1;
+            break;
+      }
+   }
+   srand(prng_seed);
+
+   simd_level mismatched_level = checkSimdLevels();
+   if (mismatched_level != SIMD_SCALAR) {
+      cerr << "The " << simdLevelName(mismatched_level) << " kernels differ from the scalar kernels." << endl;
+      return 2;
+   }
+   const char bases[] = "ACGTACGTACGTACGTRYN";
+   unsigned long sample_counts[] = {4, 16, 64, 150, 250, 500};
+   cout << "Kernel" << '\t' << "Samples" << '\t' << "Sites" << '\t' << "Msites_per_s" << '\t' << "Allocations_per_site" << endl;
+   for (unsigned long num_samples : sample_counts) {
+      unsigned long num_sites = total_bases / num_samples;
+      vector<string> sequences(num_samples);
+      vector<SequenceView> rows(num_samples);
+      for (unsigned long j = 0; j < num_samples; j++) {
+         sequences[j].resize(num_sites);
+         for (unsigned long i = 0; i < num_sites; i++) {
+            sequences[j][i] = bases[rand() % (sizeof(bases)-1)];
+         }
+         rows[j].bases = sequences[j].data();
+         rows[j].length = num_sites;
+      }
+      unsigned long strided_checksum, tiled_checksum;
+      double strided = siteThroughput(countStrided, rows, strided_checksum);
+      double tiled = siteThroughput(countTiled, rows, tiled_checksum);
+      if (strided_checksum != tiled_checksum) {
+         cerr << "Strided and tiled counts differ for " << num_samples << " samples." << endl;
+         return 2;
+      }
+      cout << "strided" << '\t' << num_samples << '\t' << num_sites << '\t' << strided << '\t' << "NA" << endl;
+      cout << "tiled" << '\t' << num_samples << '\t' << num_sites << '\t' << tiled << '\t' << "NA" << endl;
+      //Block counts at each instruction set the CPU supports:
+      const char *block_kernels[] = {"blocks_scalar", "blocks_sse42", "blocks_avx2", "blocks_avx512"};
+      for (int level = SIMD_SCALAR; level <= detectSimdLevel(); level++) {
+         setSimdLevel((simd_level)level);
+         unsigned long blocks_checksum;
+         double blocks = siteThroughput(countBlocks, rows, blocks_checksum);
+         if (blocks_checksum != strided_checksum) {
+            cerr << "Strided and " << simdLevelName((simd_level)level) << " block counts differ for " << num_samples << " samples." << endl;
+            return 2;
+         }
+         cout << block_kernels[level] << '\t' << num_samples << '\t' << num_sites << '\t' << blocks << '\t' << "NA" << endl;
+      }
+      setSimdLevel(detectSimdLevel());
+
+      //Count the alleles of two populations (each half of the samples) at
+      // each site for the memo benchmark, keeping the sites calculateDxy
+      // would use (at least 2 non-N alleles in each population):
+      PopulationCounts site_counts;
+      array<array<unsigned long, 6>, 2> counts;
+      for (unsigned long i = 0; i < num_sites && site_counts.size() < memo_sites; i++) {
+         for (unsigned int p = 0; p < 2; p++) {
+            unsigned long base_frequency[5] = {0, 0, 0, 0, 0};
+            for (unsigned long j = p*num_samples/2; j < (p+1)*num_samples/2; j++) {
+               countBase(rows[j].bases[i], base_frequency);
+            }
+            counts[p] = { {base_frequency[0], base_frequency[1], base_frequency[2], base_frequency[3], base_frequency[4], base_frequency[0]+base_frequency[1]+base_frequency[2]+base_frequency[3]} };
+         }
+         if (counts[0][5] >= 2 && counts[1][5] >= 2) {
+            site_counts.push_back(counts);
+         }
+      }
+      unsigned long num_memo_sites = site_counts.size();
+      unordered_map<string, double> memoized_pi, memoized_dxy;
+      EstimateMemo memo;
+      double string_checksum, packed_checksum, string_allocations, packed_allocations;
+      double string_memo = memoThroughput([&]() { return memoString(site_counts, memoized_pi, memoized_dxy); }, num_memo_sites, string_checksum, string_allocations);
+      double packed_memo = memoThroughput([&]() { return memoPacked(site_counts, memo); }, num_memo_sites, packed_checksum, packed_allocations);
+      if (string_checksum != packed_checksum) {
+         cerr << "String and packed memos differ for " << num_samples << " samples." << endl;
+         return 2;
+      }
+      cout << "memo_string" << '\t' << num_samples << '\t' << num_memo_sites << '\t' << string_memo << '\t' << string_allocations << endl;
+      cout << "memo_packed" << '\t' << num_samples << '\t' << num_memo_sites << '\t' << packed_memo << '\t' << packed_allocations << endl;
+   }
+   return 0;
+}
@@ -0,0 +1,297 @@
+/****************************************************************************
+ * buildCohortStore.cpp                                                     *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Builds a reference-delta cohort store (see cohortStore.h) from a         *
+ *  reference FASTA and the pseudoreference FASTAs of a cohort, holding the *
+ *  reference once and each sample as its runs of differences from it.      *
+ * calculateDxy, calculatePolymorphism, sitePatterns, and listPolyDivSites  *
+ *  read the store natively, either as every sample, or one sample at a     *
+ *  time as store:sample.                                                   *
+ * The FASTAs may be wrapped at any length, and may be gzipped.             *
+ *                                                                          *
+ * Syntax: buildCohortStore [options] <reference FASTA> <output store>      *
+ *          [list of pseudoreference FASTAs]                                *
+ ****************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <getopt.h>
+#include <vector>
+#include <set>
+#include <cstring>
+#include <cerrno>
+#include "pseudorefReader.h"
+#include "cohortStore.h"
+
+//Define constants for getopt:
+#define no_argument 0
+#define required_argument 1
+#define optional_argument 2
+
+//Version:
+#define VERSION "1.0"
+
+//Usage/help:
+#define USAGE "buildCohortStore\nUsage:\n buildCohortStore [options] <reference FASTA> <output store> [list of pseudoreference FASTAs]\n Options:\n  --help,-h:\t\tOutput this documentation\n  --version,-v:\t\tOutput the version number\n  --fofn,-f:\t\tPass a file of filenames, rather than listing filenames\n  --decompression_threads,-z:\tThreads for inflating BGZF FASTAs (default: 1)\n  --debug,-d:\t\tOutput extra debugging info\n\n Description:\n  Stores the reference once, and each pseudoreference as its runs of\n  differences from the reference.  Samples are named after their FASTAs,\n  without the directory or FASTA and gzip extensions.\n"
+
+using namespace std;
+
+void writeUint64(ofstream &output, uint64_t value) {
+   output.write((const char *)&value, 8);
+}
+
+//Name a sample after its FASTA, without the directory or extensions:
+string sampleName(const string &FASTA_path) {
+   string name = FASTA_path.substr(FASTA_path.rfind('/') == string::npos ? 0 : FASTA_path.rfind('/')+1);
+   const char *extensions[] = {".gz", ".fa", ".fasta", ".fna", ".fas"};
+   for (unsigned int e = 0; e < 5; e++) {
+      string extension = extensions[e];
+      if (name.length() > extension.length() && name.compare(name.length()-extension.length(), extension.length(), extension) == 0) {
+         name.erase(name.length()-extension.length());
+      }
+   }
+   return name;
+}
+
+//Write the runs and bucket table of every sample for the finished scaffold:
+void writeScaffoldDeltas(ofstream &output, uint64_t &offset, CohortScaffold &scaffold, vector<vector<CohortDelta>> &sample_deltas) {
+   uint64_t num_buckets = (scaffold.length + COHORT_BUCKET_SITES - 1) / COHORT_BUCKET_SITES;
+   for (unsigned long j = 0; j < sample_deltas.size(); j++) {
+      vector<CohortDelta> &deltas = sample_deltas[j];
+      scaffold.samples[j].deltas_offset = offset;
+      scaffold.samples[j].num_deltas = deltas.size();
+      output.write((const char *)deltas.data(), deltas.size()*sizeof(CohortDelta));
+      offset += deltas.size()*sizeof(CohortDelta);
+      scaffold.samples[j].buckets_offset = offset;
+      uint64_t delta_index = 0;
+      for (uint64_t bucket = 0; bucket <= num_buckets; bucket++) {
+         while (delta_index < deltas.size() && deltas[delta_index].start + deltas[delta_index].length <= bucket*COHORT_BUCKET_SITES) {
+            delta_index++;
+         }
+         writeUint64(output, delta_index);
+      }
+      offset += (num_buckets+1)*8;
+      deltas.clear();
+   }
+}
+
+int main(int argc, char **argv) {
+   //Variables for processing the FASTAs:
+   vector<string> input_FASTA_paths;
+   string reference_path = "", output_path = "";
+   //Option for debugging:
+   bool debug = 0;
+   //Option for input of FASTA file paths:
+   string input_fofn = "";
+   //Number of threads to inflate BGZF-compressed FASTAs with:
+   unsigned int decompression_threads = 1;
+
+   //Variables for getopt_long:
+   int optchar;
+   int structindex = 0;
+   extern int optind;
+   //Create the struct used for getopt:
+   const struct option longoptions[] {
+      {"fofn", required_argument, 0, 'f'},
+      {"decompression_threads", required_argument, 0, 'z'},
+      {"debug", no_argument, 0, 'd'},
+      {"version", no_argument, 0, 'v'},
+      {"help", no_argument, 0, 'h'}
+   };
+   //Read in the options:
+   while ((optchar = getopt_long(argc, argv, "f:z:dvh", longoptions, &structindex)) > -1) {
+      switch(optchar) {
+         case 'f':
+            cerr << "Taking input from FOFN " << optarg << endl;
+            input_fofn = optarg;
+            break;
+         case 'z':
+            decompression_threads = atoi(optarg);
+            if (decompression_threads < 1) {
+               decompression_threads = 1;
+            }
+            break;
+         case 'd':
+            cerr << "Debugging mode enabled." << endl;
+            debug = 1;
+            break;
+         case 'v':
+            cerr << "buildCohortStore version " << VERSION << endl;
+            return 0;
+            break;
+         case 'h':
+            cerr << USAGE;
+            return 0;
+            break;
+         default:
+            cerr << "Unknown option " << (unsigned char)optchar << " supplied." << endl;
+            cerr << USAGE;
+            return 1;
+            break;
+      }
+   }
+   //Read in the positional arguments:
+   if (optind < argc) {
+      reference_path = argv[optind++];
+   }
+   if (optind < argc) {
+      output_path = argv[optind++];
+   }
+   if (reference_path == "" || output_path == "") {
+      cerr << "Both a reference FASTA and an output path are required." << endl;
+      cerr << USAGE;
+      return 1;
+   }
+   if (input_fofn != "") {
+      ifstream fofn(input_fofn);
+      if (!fofn) {
+         cerr << "Error opening file of input FASTA filenames " << input_fofn << endl;
+         return 2;
+      }
+      string fofn_line;
+      while (getline(fofn, fofn_line)) {
+         if (!fofn_line.empty()) {
+            input_FASTA_paths.push_back(fofn_line);
+         }
+      }
+   }
+   while (optind < argc) {
+      input_FASTA_paths.push_back(argv[optind++]);
+   }
+   if (input_FASTA_paths.empty()) {
+      cerr << "No pseudoreference FASTAs provided." << endl;
+      return 1;
+   }
+   //Sample names have to be unique to be selected as store:sample:
+   vector<string> sample_names;
+   set<string> unique_names;
+   for (auto path_iterator = input_FASTA_paths.begin(); path_iterator != input_FASTA_paths.end(); ++path_iterator) {
+      sample_names.push_back(sampleName(*path_iterator));
+      if (!unique_names.insert(sample_names.back()).second) {
+         cerr << "Sample name " << sample_names.back() << " of " << *path_iterator << " is not unique." << endl;
+         return 1;
+      }
+   }
+
+   //Open the reference followed by the samples:
+   vector<string> reader_paths(1, reference_path);
+   reader_paths.insert(reader_paths.end(), input_FASTA_paths.begin(), input_FASTA_paths.end());
+   PseudorefReader FASTA_reader;
+   if (!FASTA_reader.open(reader_paths, 0, decompression_threads)) {
+      return 2;
+   }
+   unsigned long num_samples = input_FASTA_paths.size();
+   ofstream output(output_path, ios::out | ios::binary);
+   if (!output) {
+      cerr << "Error opening output cohort store " << output_path << endl;
+      return 2;
+   }
+   //Index offset is filled in once all of the scaffolds are written:
+   output.write(COHORT_MAGIC, COHORT_MAGIC_LENGTH);
+   writeUint64(output, 0);
+
+   //Write each scaffold's reference sites as they are read, collecting
+   // each sample's runs of differences until the end of the scaffold:
+   vector<CohortScaffold> index;
+   vector<vector<CohortDelta>> sample_deltas(num_samples);
+   uint64_t offset = COHORT_HEADER_LENGTH;
+   unsigned long total_deltas = 0;
+   vector<SequenceView> FASTA_lines;
+   reader_status row_status;
+   while ((row_status = FASTA_reader.readRow(FASTA_lines)) == READER_HEADER || row_status == READER_SEQUENCE) {
+      if (row_status == READER_HEADER) {
+         if (!index.empty()) {
+            writeScaffoldDeltas(output, offset, index.back(), sample_deltas);
+         }
+         CohortScaffold scaffold;
+         scaffold.header = FASTA_reader.scaffold();
+         scaffold.length = 0;
+         scaffold.reference_offset = offset;
+         scaffold.samples.resize(num_samples);
+         index.push_back(scaffold);
+         if (debug) {
+            cerr << "Storing scaffold " << scaffold.header << endl;
+         }
+      } else if (!index.empty()) {
+         CohortScaffold &scaffold = index.back();
+         const char *reference = FASTA_lines[0].bases;
+         unsigned long row_length = FASTA_lines[0].length;
+         for (unsigned long j = 0; j < num_samples; j++) {
+            const char *sample = FASTA_lines[j+1].bases;
+            if (memcmp(sample, reference, row_length) == 0) {
+               continue;
+            }
+            vector<CohortDelta> &deltas = sample_deltas[j];
+            for (unsigned long i = 0; i < row_length; i++) {
+               if (sample[i] == reference[i]) {
+                  continue;
+               }
+               uint64_t site = scaffold.length + i;
+               //Extend the last run if this site continues it:
+               if (!deltas.empty() && deltas.back().base == sample[i] && deltas.back().start + deltas.back().length == site && deltas.back().length < UINT32_MAX) {
+                  deltas.back().length++;
+               } else {
+                  CohortDelta delta;
+                  memset(&delta, 0, sizeof(delta));
+                  delta.start = site;
+                  delta.length = 1;
+                  delta.base = sample[i];
+                  deltas.push_back(delta);
+                  total_deltas++;
+               }
+            }
+         }
+         output.write(reference, row_length);
+         offset += row_length;
+         scaffold.length += row_length;
+      }
+   }
+   if (row_status == READER_HEADERS_DIFFER) {
+      cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
+      cerr << string(FASTA_lines[0].bases, FASTA_lines[0].length) << endl;
+      cerr << string(FASTA_lines[FASTA_reader.failedInput()].bases, FASTA_lines[FASTA_reader.failedInput()].length) << endl;
+      return 3;
+   } else if (row_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Error: FASTAs are not synchronized, scaffold " << FASTA_reader.scaffold() << " has a different length in " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      return 4;
+   } else if (row_status == READER_IO_ERROR) {
+      cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      cerr << strerror(errno) << endl;
+      return 5;
+   }
+   if (!index.empty()) {
+      writeScaffoldDeltas(output, offset, index.back(), sample_deltas);
+   }
+   FASTA_reader.close();
+
+   //Write the index, then point the header at it:
+   writeUint64(output, COHORT_BUCKET_SITES);
+   writeUint64(output, num_samples);
+   for (auto name_iterator = sample_names.begin(); name_iterator != sample_names.end(); ++name_iterator) {
+      writeUint64(output, name_iterator->length());
+      output.write(name_iterator->data(), name_iterator->length());
+   }
+   writeUint64(output, index.size());
+   for (auto scaffold_iterator = index.begin(); scaffold_iterator != index.end(); ++scaffold_iterator) {
+      writeUint64(output, scaffold_iterator->header.length());
+      output.write(scaffold_iterator->header.data(), scaffold_iterator->header.length());
+      writeUint64(output, scaffold_iterator->length);
+      writeUint64(output, scaffold_iterator->reference_offset);
+      output.write((const char *)scaffold_iterator->samples.data(), num_samples*sizeof(CohortSampleScaffold));
+   }
+   output.seekp(COHORT_MAGIC_LENGTH);
+   writeUint64(output, offset);
+   output.close();
+   if (!output) {
+      cerr << "Error writing output cohort store " << output_path << endl;
+      return 6;
+   }
+   cerr << "Stored " << num_samples << " samples of " << index.size() << " scaffolds as " << total_deltas << " runs of differences in " << output_path << endl;
+
+   return 0;
+}
@@ -5,6 +5,26 @@
  * Version 2.1 written 2017/05/30 (added shared polymorphism and inbred)    *
  * Version 2.2 written 2017/11/13 (no need for list of pseudorefs)          *
  * Version 2.3 written 2018/11/08 (Omit position may output weight instead) *
+ * Version 2.4 written 2026/10/17 (Option to memory-map input FASTAs)       *
+ * Version 2.5 written 2026/10/17 (Parallel scaffolds using .fai indexes)   *
+ * Version 2.6 written 2026/10/17 (Read gzip and BGZF-compressed FASTAs)    *
+ * Version 2.7 written 2026/10/17 (FASTAs may be wrapped at any length)     *
+ * Version 2.8 written 2026/10/17 (Pipelined reading, compute, and output)  *
+ * Version 2.9 written 2026/10/17 (Restrict to regions with --region/--bed) *
+ * Version 2.10 written 2026/10/17 (Reference-delta cohort store input)     *
+ * Version 2.11 written 2026/10/17 (Read samples directly from a VCF)       *
+ * Version 2.12 written 2026/10/17 (Mergeable allele counts of shards)      *
+ * Version 2.13 written 2026/10/17 (Preflight check of input scaffolds)     *
+ * Version 2.14 written 2026/10/17 (Integer-keyed memos of pi and Dxy)      *
+ * Version 2.15 written 2026/10/17 (Table-driven base decoding)             *
+ * Version 2.16 written 2026/10/17 (SIMD allele counting)                   *
+ * Version 2.17 written 2026/10/17 (Threads split scaffolds into chunks)    *
+ * Version 2.18 written 2026/10/17 (Counter-based inbred allele draws)      *
+ * Version 2.19 written 2026/10/17 (Windowed estimators with --window_size) *
+ * Version 2.20 written 2026/10/17 (Select population pairs and statistics) *
+ * Version 2.21 written 2026/10/17 (Reuse estimates of uniform sites)       *
+ * Version 2.22 written 2026/10/17 (Site loops compiled for each option set)*
+ * Version 2.23 written 2026/10/17 (Samples read grouped by population)     *
  *                                                                          *
  * Description:                                                             *
  * This script takes in pseudoreference FASTAs and a TSV describing which   *
@@ -26,11 +46,22 @@
 #include <getopt.h>
 #include <cctype>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
 #include <map>
 #include <sstream>
 #include <array>
 #include <set>
-#include <unordered_map>
+#include "pseudorefReader.h"
+#include "siteKernels.h"
+#include "simdKernels.h"
+#include "parallelScaffolds.h"
+#include "sitePipeline.h"
+#include "genomicRegions.h"
+#include "alleleCounts.h"
+#include "windowSums.h"
 
 //Define constants for getopt:
 #define no_argument 0
@@ -38,13 +69,20 @@
 #define optional_argument 2
 
 //Version:
-#define VERSION "2.3"
+#define VERSION "2.23"
 
 //Define number of bases:
 #define NUM_BASES 4
 
+//Sites per chunk of a scaffold processed as one task with --threads:
+#define PARALLEL_CHUNK_SITES 1048576
+
+//Index of the omit_position (or site_weight) column among the estimators,
+// which filters or weights sites in windows:
+#define OMIT_COLUMN 1
+
 //Usage/help:
-#define USAGE "calculateDxy\nUsage:\n calculateDxy [options]\nOptions:\n -h,--help\tPrint this help\n -v,--version\tPrint the version of this program\n -p,--popfile\tTSV file of FASTA name, and population number\n -s,--shared_poly\tIdentify shared polymorphisms between populations\n -i,--inbred\tTreat pseudoreferences as inbred haploids\n -r,--prng_seed\tSet PRNG seed for random allele selection in inbred lines\n\t\tDefault: 42\n --usable_fraction,-u:\tFourth column represents fraction of unmasked bases\n"
+#define USAGE "calculateDxy\nUsage:\n calculateDxy [options]\nOptions:\n -h,--help\tPrint this help\n -v,--version\tPrint the version of this program\n -p,--popfile\tTSV file of FASTA name, and population number\n -s,--shared_poly\tIdentify shared polymorphisms between populations\n -i,--inbred\tTreat pseudoreferences as inbred haploids\n -r,--prng_seed\tSet PRNG seed for random allele selection in inbred lines\n\t\tDefault: 42\n -L,--legacy_prng\tDraw inbred alleles from rand() in site order, as\n\t\tbefore version 2.18, instead of hashing the seed, scaffold,\n\t\tposition, and sample\n --usable_fraction,-u:\tFourth column represents fraction of unmasked bases\n --mmap,-m:\tMemory-map input FASTAs instead of reading them in blocks\n --threads,-t:\tProcess chunks of each scaffold on this many threads\n\t\t(default: 1), with output identical to a single thread\n\t\tRequires a .fai index (samtools faidx) for each FASTA\n --decompression_threads,-z:\tThreads for inflating BGZF FASTAs (default: 1)\n --compute_threads,-c:\tRead, compute, and write on separate threads, with\n\t\tthis many compute threads (default: 0, no pipeline)\n --queue_depth,-q:\tBlocks queued between pipeline stages (default: 4)\n --region,-R:\tOnly process this region (scaffold:start-end, 1-based),\n\t\tmay be given more than once\n --bed,-b:\tOnly process the regions in this BED file\n\t\tRegions require a .fai index for each FASTA\n --vcf_reference,-V:\tReference FASTA (with a .fai) of any VCF inputs,\n\t\twhose samples are listed as VCF:sample in the popfile\n --counts_out,-o:\tWrite per-site allele counts of each population to this\n\t\tfile instead of estimators, e.g. for a shard of the samples\n --merge_counts,-M:\tAdd up these allele count files (given once per shard)\n\t\tand output the estimators, without a popfile\n --preflight,-P:\tOnly check that every input has the same scaffolds\n\t\tin the same order with the same lengths, using .fai\n\t\tfiles where possible, then exit\n --window_size,-w:\tOutput the mean of every estimator over non-overlapping\n\t\twindows of this many sites, rather than each site\n --omit_n,-n:\tOmit sites from windows where omit_position is 1\n --infimum_nonN,-f:\tOnly average sites in windows with a usable fraction\n\t\tabove this value (implies -u)\n --weighted_average,-a:\tWeight each site in windows by its usable fraction\n\t\t(implies -u)\n --pair,-x:\tOnly output estimators for this pair of populations (e.g. 1,2),\n\t\tmay be given more than once\n --outgroup,-g:\tOnly output estimators for pairs of this population with\n\t\teach other population, may be combined with -x\n --statistics,-S:\tOnly output these statistics, as a comma-separated list\n\t\tof pi, dxy, and da (default: pi,dxy,da)\n"
 
 using namespace std;
 
@@ -58,351 +96,863 @@ vector<string> splitString(string line_to_split, char delimiter) {
    return line_vector;
 }
 
-bool openFASTAs(vector<ifstream*> &input_FASTAs, vector<string> input_FASTA_paths) {
-   for (auto path_iterator = input_FASTA_paths.begin(); path_iterator != input_FASTA_paths.end(); ++path_iterator) {
-      ifstream *input_FASTA = new ifstream(path_iterator->c_str(), ios::in);
-      if (!input_FASTA->is_open()) { //Check to make sure the input file was validly opened
-         cerr << "Error opening input FASTA: " << *path_iterator << "." << endl;
-         return 0;
+bool is_shared_poly(array<unsigned long, 6> &pop1_allele_counts, array<unsigned long, 6> &pop2_allele_counts) {
+   unsigned int shared_poly = 0;
+   //If any two alleles have non-zero product of frequencies across the two populations, the site is a shared polymorphism
+   for (unsigned int i = 0; i < NUM_BASES; i++) {
+      shared_poly += ((pop1_allele_counts[i] * pop2_allele_counts[i] > 0) ? 1 : 0);
+   }
+   return shared_poly > 1;
+}
+
+//Per-site estimates, kept between sites so they aren't reallocated:
+struct SiteEstimates {
+   vector<array<double, 4>> population_p_hats; //Store population-specific estimated allele frequencies
+   vector<double> population_pi_hats; //Store population-specific un-corrected polymorphism estimates
+   vector<uint32_t> population_ids; //Memo ids of each population's allele counts
+   vector<double> site_values; //Value of each output column after the position
+};
+
+//Samples are read in population order, so each population's samples are a
+// contiguous range of rows, and counting a population's alleles is a loop
+// over its range, without looking up each sample's population:
+struct PopulationLayout {
+   vector<unsigned long> population_starts; //First row of each population, then the number of rows
+   vector<vector<unsigned long>> population_rows; //Rows of each population, for countBlockAlleles()
+   vector<unsigned long> sample_rows; //Row of each sample, in popfile order
+   vector<unsigned long> sample_populations; //0-based population of each sample, in popfile order
+
+   //Group the samples by population (given 1-based, in popfile order),
+   // keeping the popfile order of the samples within each population:
+   void group(const vector<unsigned long> &populations, unsigned long num_populations) {
+      population_starts.assign(num_populations+1, 0);
+      for (auto population_iterator = populations.begin(); population_iterator != populations.end(); ++population_iterator) {
+         population_starts[*population_iterator]++;
+      }
+      for (unsigned long p = 0; p < num_populations; p++) {
+         population_starts[p+1] += population_starts[p];
+      }
+      vector<unsigned long> next_rows(population_starts.begin(), population_starts.end()-1);
+      population_rows.assign(num_populations, vector<unsigned long>());
+      sample_rows.resize(populations.size());
+      sample_populations.resize(populations.size());
+      for (unsigned long j = 0; j < populations.size(); j++) {
+         sample_populations[j] = populations[j]-1;
+         sample_rows[j] = next_rows[sample_populations[j]]++;
+      }
+      for (unsigned long p = 0; p < num_populations; p++) {
+         for (unsigned long k = population_starts[p]; k < population_starts[p+1]; k++) {
+            population_rows[p].push_back(k);
+         }
+      }
+   }
+   unsigned long numSamples(unsigned long population) const {
+      return population_starts[population+1] - population_starts[population];
+   }
+};
+
+//Count the alleles of each population at one site (at a 0-based position of
+// the scaffold), as A, C, G, T, N, and non-N counts, from the site's base in
+// each row:
+template <bool inbred>
+void countSiteAlleles(const char *site_bases, const PopulationLayout &layout, unsigned long num_populations, AlleleDraws &allele_draws, uint64_t position, vector<array<unsigned long, 6>> &population_site_frequencies) {
+   population_site_frequencies.resize(num_populations);
+   const BaseDecode *decode = baseDecodeTable();
+   for (unsigned long p = 0; p < num_populations; p++) {
+      array<unsigned long, 6> &base_frequency = population_site_frequencies[p]; //Store the count of A, C, G, T, N, nonN for each site
+      base_frequency.fill(0);
+      for (unsigned long k = layout.population_starts[p]; k < layout.population_starts[p+1]; k++) {
+         const BaseDecode &base_decode = decode[(unsigned char)site_bases[k]];
+         for (unsigned int b = 0; b < 6; b++) {
+            base_frequency[b] += base_decode.counts[inbred][b];
+         }
+      }
+   }
+   //Randomly choose one of the alleles of each het, drawing for the samples
+   // in popfile order, as always:
+   if (inbred) {
+      for (unsigned long j = 0; j < layout.sample_rows.size(); j++) {
+         const BaseDecode &base_decode = decode[(unsigned char)site_bases[layout.sample_rows[j]]];
+         if (base_decode.het) {
+            population_site_frequencies[layout.sample_populations[j]][base_decode.het_alleles[allele_draws.next(position, j)]]++;
+         }
       }
-      input_FASTAs.push_back(input_FASTA);
    }
-   return 1;
 }
 
-void closeFASTAs(vector<ifstream*> &input_FASTAs) {
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      (*FASTA_iterator)->close();
-      delete *FASTA_iterator;
+//Count the alleles of each population at a block of up to TILE_SITES sites:
+void countBlockPopulations(vector<SequenceView> &FASTA_sequences, const PopulationLayout &layout, unsigned long first_site, unsigned long num_sites, vector<BlockAlleleCounts> &block_counts) {
+   block_counts.resize(layout.population_rows.size());
+   for (unsigned long p = 0; p < layout.population_rows.size(); p++) {
+      countBlockAlleles(FASTA_sequences, layout.population_rows[p], first_site, num_sites, block_counts[p]);
    }
 }
 
-bool readFASTAs(vector<ifstream*> &input_FASTAs, vector<string> &FASTA_lines) {
-   unsigned long which_input_FASTA = 0;
-   bool ifstream_notfail;
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      if ((*FASTA_iterator)->fail()) {
-         cerr << "Ifstream " << which_input_FASTA+1 << " failed." << endl;
-         return 0;
-      }
-      string FASTA_line;
-      ifstream_notfail = (bool)getline(**FASTA_iterator, FASTA_line);
-      if (!ifstream_notfail) {
-         return ifstream_notfail;
-      }
-      if (FASTA_lines.size() < input_FASTAs.size()) {
-         FASTA_lines.push_back(FASTA_line);
-      } else {
-         FASTA_lines[which_input_FASTA++] = FASTA_line;
+//Count the alleles of each population at site i from the counts of its
+// block, as countSiteAlleles() would
+//Inbred sites with hets go through countSiteAlleles(), so their alleles are
+// drawn in the same order as always:
+template <bool inbred>
+void countBlockSiteAlleles(vector<SequenceView> &FASTA_sequences, vector<BlockAlleleCounts> &block_counts, const PopulationLayout &layout, unsigned long i, unsigned long position_offset, unsigned long num_populations, AlleleDraws &allele_draws, vector<char> &site_bases, vector<array<unsigned long, 6>> &population_site_frequencies) {
+   population_site_frequencies.resize(num_populations);
+   for (unsigned long p = 0; p < num_populations; p++) {
+      if (!blockSiteAlleles(block_counts[p], layout.numSamples(p), i % TILE_SITES, inbred, population_site_frequencies[p].data())) {
+         gatherSite(FASTA_sequences, i, site_bases);
+         countSiteAlleles<inbred>(site_bases.data(), layout, num_populations, allele_draws, position_offset+i, population_site_frequencies);
+         return;
       }
    }
-   return ifstream_notfail;
 }
 
-string piKey(array<unsigned long, 6> &allele_counts) {
-   string pikey = "";
-   for (auto array_iterator = allele_counts.begin(); array_iterator != allele_counts.end(); ++array_iterator) {
-      pikey += to_string(*array_iterator) + ",";
+//Which estimators to compute and output: pi of some populations, and D_xy,
+// D_a, and shared polymorphism for some pairs of populations, by default
+// every population and every pair
+//Pairs and outgroups are requested with 1-based population numbers, and
+// resolve() turns them into 0-based pairs (in the order of the full output)
+struct EstimatorSelection {
+   bool pi;
+   bool D_xy;
+   bool D_a;
+   bool shared_poly;
+   vector<pair<unsigned long, unsigned long>> requested_pairs; //From --pair
+   vector<unsigned long> outgroups; //From --outgroup, paired with every other population
+   //Resolved for the number of populations:
+   vector<pair<unsigned long, unsigned long>> pairs;
+   vector<unsigned long> pi_populations; //Populations whose pi is output
+   vector<unsigned long> populations; //Populations whose allele frequencies and pi are needed
+
+   EstimatorSelection() : pi(1), D_xy(1), D_a(1), shared_poly(0) {}
+
+   //Parse a comma-separated list of the statistics to output (pi, dxy, da),
+   // returning 0 if any is unknown:
+   bool parseStatistics(const string &statistics) {
+      pi = 0;
+      D_xy = 0;
+      D_a = 0;
+      vector<string> statistic_names = splitString(statistics, ',');
+      for (auto name_iterator = statistic_names.begin(); name_iterator != statistic_names.end(); ++name_iterator) {
+         if (*name_iterator == "pi") {
+            pi = 1;
+         } else if (*name_iterator == "dxy") {
+            D_xy = 1;
+         } else if (*name_iterator == "da") {
+            D_a = 1;
+         } else {
+            return 0;
+         }
+      }
+      return 1;
    }
-   return pikey; //We don't really care about the extra comma
-}
 
-string dxyKey(array<unsigned long, 6> &pop1_allele_counts, array<unsigned long, 6> &pop2_allele_counts) {
-   string dxykey = "";
-   for (auto pop1_iterator = pop1_allele_counts.begin(); pop1_iterator != pop1_allele_counts.end(); ++pop1_iterator) {
-      dxykey += to_string(*pop1_iterator) + ",";
+   //Resolve the requested pairs into pairs of populations, with pi output
+   // for every population in them (every population if no pairs were
+   // requested), returning 0 if a requested population doesn't exist:
+   bool resolve(unsigned long num_populations) {
+      pairs.clear();
+      pi_populations.clear();
+      populations.clear();
+      if (requested_pairs.empty() && outgroups.empty()) {
+         for (unsigned long i = 0; i < num_populations; i++) {
+            pi_populations.push_back(i);
+            for (unsigned long j = i+1; j < num_populations; j++) {
+               pairs.push_back(make_pair(i, j));
+            }
+         }
+      } else {
+         for (auto pair_iterator = requested_pairs.begin(); pair_iterator != requested_pairs.end(); ++pair_iterator) {
+            if (pair_iterator->first < 1 || pair_iterator->first > num_populations || pair_iterator->second < 1 || pair_iterator->second > num_populations || pair_iterator->first == pair_iterator->second) {
+               cerr << "Invalid pair of populations " << pair_iterator->first << "," << pair_iterator->second << " for " << num_populations << " populations" << endl;
+               return 0;
+            }
+            pairs.push_back(make_pair(min(pair_iterator->first, pair_iterator->second)-1, max(pair_iterator->first, pair_iterator->second)-1));
+         }
+         for (auto outgroup_iterator = outgroups.begin(); outgroup_iterator != outgroups.end(); ++outgroup_iterator) {
+            if (*outgroup_iterator < 1 || *outgroup_iterator > num_populations) {
+               cerr << "Invalid outgroup population " << *outgroup_iterator << " for " << num_populations << " populations" << endl;
+               return 0;
+            }
+            for (unsigned long i = 0; i < num_populations; i++) {
+               if (i != *outgroup_iterator-1) {
+                  pairs.push_back(make_pair(min(i, *outgroup_iterator-1), max(i, *outgroup_iterator-1)));
+               }
+            }
+         }
+         sort(pairs.begin(), pairs.end());
+         pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+         for (auto pair_iterator = pairs.begin(); pair_iterator != pairs.end(); ++pair_iterator) {
+            pi_populations.push_back(pair_iterator->first);
+            pi_populations.push_back(pair_iterator->second);
+         }
+         sort(pi_populations.begin(), pi_populations.end());
+         pi_populations.erase(unique(pi_populations.begin(), pi_populations.end()), pi_populations.end());
+      }
+      //Pairs need the allele frequencies (and pi, for D_a) of both
+      // populations, which are also the populations whose pi is output:
+      populations = pi_populations;
+      return 1;
+   }
+
+   //Number of columns of estimators after the position: D of the first
+   // pair, omit_position (or site_weight), then the selected estimators:
+   unsigned long numColumns() const {
+      return 2 + (pi ? pi_populations.size() : 0) + pairs.size()*((D_xy ? 1 : 0) + (D_a ? 1 : 0) + (shared_poly ? 1 : 0));
    }
-   for (auto pop2_iterator = pop2_allele_counts.begin(); pop2_iterator != pop2_allele_counts.end(); ++pop2_iterator) {
-      dxykey += to_string(*pop2_iterator) + ",";
+};
+
+//Compute the selected estimators for one site from its population allele
+// counts, storing the value of each column after the position in
+// site_values:
+//Sites where any population has fewer than 2 alleles output 0s, so none of
+// their estimators are computed
+template <bool debug, bool usable, bool shared_poly>
+void siteStatisticValues(vector<array<unsigned long, 6>> &population_site_frequencies, unsigned long num_populations, EstimateMemo &memo, SiteEstimates &estimates, const EstimatorSelection &selection, unsigned long position, vector<double> &site_values) {
+   //Use site if all populations have at least 2 alleles:
+   bool use_site = 1;
+   //Only the selected populations' estimates are set, and only they are
+   // read, so the buffers are reused from site to site without clearing:
+   vector<array<double, 4>> &population_p_hats = estimates.population_p_hats; //Store the estimated allele frequencies for each site
+   vector<double> &population_pi_hats = estimates.population_pi_hats;
+   vector<uint32_t> &population_ids = estimates.population_ids;
+   population_ids.resize(num_populations);
+   population_p_hats.resize(num_populations);
+   population_pi_hats.resize(num_populations);
+   
+   unsigned long nonN_bases = 0;
+   unsigned long total_bases = 0;
+   for (unsigned long population_index = 0; population_index < num_populations; population_index++) {
+      use_site = use_site && population_site_frequencies[population_index][5] >= 2;
+      nonN_bases += population_site_frequencies[population_index][5];
+      total_bases += population_site_frequencies[population_index][4] + population_site_frequencies[population_index][5];
+   }
+   double usable_fraction = (double)nonN_bases/(double)total_bases;
+   
+   site_values.clear();
+   if (!use_site) { //Do not output any estimators for n < 2
+      site_values.push_back(0.0);
+      site_values.push_back(usable ? usable_fraction : 1.0); //If we don't want to output the usable fraction, just output 1
+      //Output 0 (NA)s for \pi_{i}, D_{XY}, D_{a}, and shared polymorphisms:
+      site_values.resize(selection.numColumns(), 0.0);
+      return;
+   }
+   
+   //Calculate the population-specific allele frequencies of the selected
+   // populations:
+   if (debug) {
+      cerr << "Estimating allele frequencies for site " << position << "." << endl;
+   }
+   for (auto population_iterator = selection.populations.begin(); population_iterator != selection.populations.end(); ++population_iterator) {
+      unsigned long population_index = *population_iterator;
+      for (unsigned long j = 0; j < NUM_BASES; j++) {
+         population_p_hats[population_index][j] = (double)population_site_frequencies[population_index][j]/(double)population_site_frequencies[population_index][5];
+      }
+      //pi only depends on the A, C, G, T counts:
+      if (!memo.findSingle(population_site_frequencies[population_index].data(), population_ids[population_index], population_pi_hats[population_index])) {
+         //Calculate \pi_{i} for each population:
+         if (debug) {
+            cerr << "Estimating pi for each population at site " << position << "." << endl;
+         }
+         population_pi_hats[population_index] = 0.0;
+         for (unsigned long j = 0; j < NUM_BASES-1; j++) {
+            for (unsigned long k = j+1; k < NUM_BASES; k++) {
+               population_pi_hats[population_index] += 2*population_p_hats[population_index][j]*population_p_hats[population_index][k];
+            }
+         }
+         //Do the \frac{n}{n-1} correction, which now makes this Nei (1987) Eqn. 10.5
+         population_pi_hats[population_index] *= (double)population_site_frequencies[population_index][5]/(double)(population_site_frequencies[population_index][5]-1);
+         memo.storeSingle(population_ids[population_index], population_pi_hats[population_index]);
+      }
+   }
+   
+   //Output elements: D_{12}, omit site, pi_{i}, D_{ij}, D_{a} values
+   //D_{12} is filled in once the first pair's D_{xy} is known:
+   site_values.push_back(0.0);
+   site_values.push_back(usable ? usable_fraction : 0.0); //If we don't want to output the usable fraction, just output 0
+   if (selection.pi) {
+      for (auto population_iterator = selection.pi_populations.begin(); population_iterator != selection.pi_populations.end(); ++population_iterator) {
+         site_values.push_back(population_pi_hats[*population_iterator]);
+      }
+   }
+   
+   //Calculate D_{xy} and D_{a} for each selected pair of populations:
+   if (debug) {
+      cerr << "Estimating D_xy and D_a for site " << position << "." << endl;
+   }
+   bool need_D_xy = selection.D_xy || selection.D_a;
+   for (unsigned long pair_index = 0; pair_index < selection.pairs.size(); pair_index++) {
+      unsigned long population_index = selection.pairs[pair_index].first;
+      unsigned long population2_index = selection.pairs[pair_index].second;
+      if (!need_D_xy && pair_index > 0) {
+         break;
+      }
+      double d_xy = 0.0;
+      if (!memo.findPair(population_ids[population_index], population_ids[population2_index], d_xy)) {
+         for (unsigned long j = 0; j < NUM_BASES; j++) {
+            for (unsigned long k = 0; k < NUM_BASES; k++) {
+               if (j != k) { //d_{ij} = 1 for i != j, see Nei (1987) Eqn. 10.20
+                  d_xy += population_p_hats[population_index][j]*population_p_hats[population2_index][k]; //\hat{x}_{i}\hat{y}_{j} in Nei (1987) Eqn. 10.20
+               }
+            }
+         }
+         memo.storePair(population_ids[population_index], population_ids[population2_index], d_xy);
+      }
+      if (pair_index == 0) {
+         site_values[0] = d_xy;
+      }
+      if (selection.D_xy) {
+         site_values.push_back(d_xy);
+      }
+      if (selection.D_a) {
+         double d_net = d_xy - ((population_pi_hats[population_index] + population_pi_hats[population2_index]) / (double)2.0);
+         site_values.push_back(d_net);
+      }
+   }
+   //Identify shared polymorphisms:
+   if (shared_poly) {
+      for (auto pair_iterator = selection.pairs.begin(); pair_iterator != selection.pairs.end(); ++pair_iterator) {
+         site_values.push_back(is_shared_poly(population_site_frequencies[pair_iterator->first], population_site_frequencies[pair_iterator->second]));
+      }
    }
-   return dxykey;
 }
 
-bool is_shared_poly(array<unsigned long, 6> &pop1_allele_counts, array<unsigned long, 6> &pop2_allele_counts) {
-   unsigned int shared_poly = 0;
-   //If any two alleles have non-zero product of frequencies across the two populations, the site is a shared polymorphism
-   for (unsigned int i = 0; i < NUM_BASES; i++) {
-      shared_poly += ((pop1_allele_counts[i] * pop2_allele_counts[i] > 0) ? 1 : 0);
+//Output the estimators for one site (everything after the position) from
+// its population allele counts:
+template <bool debug, bool usable, bool shared_poly>
+void outputSiteStatistics(vector<array<unsigned long, 6>> &population_site_frequencies, unsigned long num_populations, EstimateMemo &memo, SiteEstimates &estimates, const EstimatorSelection &selection, unsigned long position, ostream &site_output) {
+   siteStatisticValues<debug, usable, shared_poly>(population_site_frequencies, num_populations, memo, estimates, selection, position, estimates.site_values);
+   for (auto value_iterator = estimates.site_values.begin(); value_iterator != estimates.site_values.end(); ++value_iterator) {
+      site_output << '\t' << *value_iterator;
    }
-   return shared_poly > 1;
+   site_output << endl;
 }
 
-void processScaffold(vector<string> &FASTA_headers, vector<string> &FASTA_sequences, map<unsigned long, unsigned long> &population_map, unsigned long num_populations, unordered_map<string, double> &memoized_pi, unordered_map<string, double> &memoized_dxy, bool shared_poly, bool inbred, bool debug, bool usable) {
-   cerr << "Processing scaffold " << FASTA_headers[0].substr(1) << " of length " << FASTA_sequences[0].length() << endl;
-   //Do all the processing for this scaffold:
+//If windows isn't NULL, each site's estimators are added to its window
+// instead of being output:
+template <bool inbred, bool debug, bool usable, bool shared_poly>
+void processScaffold(const string &scaffold_name, vector<SequenceView> &FASTA_sequences, unsigned long position_offset, const PopulationLayout &layout, unsigned long num_populations, EstimateMemo &memo, const EstimatorSelection &selection, AlleleDraws &allele_draws, ostream &output, StatisticWindows *windows) {
+   //Do all the processing for this row of the scaffold:
    //Polymorphism estimator: Given base frequencies at site:
    //\hat{\pi} = \(\frac{n}{n-1}\)\sum_{i=1}^{3}\sum_{j=i+1}^{4} 2\hat{p_{i}}\hat{p_{j}}
    //For biallelic sites, this reduces to the standard estimator: \(\frac{n}{n-1}\)2\hat{p}\hat{q}, since
    //p_{3} = p_{4} = 0
    //Dxy estimator is from Nei (1987) Eqn. 10.20 (\hat{d}_{XY} = \Sum_{i,j} \hat{x}_{i} \hat{y}_{j} d_{i,j}
    unsigned long num_sequences = FASTA_sequences.size();
-   unsigned long scaffold_length = FASTA_sequences[0].length();
+   unsigned long scaffold_length = FASTA_sequences[0].length;
    
    //Containers for various site statistics:
-   array<unsigned long, 6> init_base_frequency = { {0, 0, 0, 0, 0, 0} }; //Store the count of A, C, G, T, N, nonN for each site
    vector<array<unsigned long, 6>> population_site_frequencies; //Store population-specific allele counts
-   array<double, 4> init_p_hats = { {0.0, 0.0, 0.0, 0.0} }; //Store the estimated allele frequencies for each site
-   vector<array<double, 4>> population_p_hats; //Store population-specific estimated allele frequencies
-   vector<double> population_pi_hats; //Store population-specific un-corrected polymorphism estimates
-   vector<double> D_xys; //Store population pair-specific D_{xy} estimates (absolute, not net divergence)
-   vector<double> D_as; //Store population pair-specific D_{a} estimates (net divergence, not absolute)
-   vector<bool> SP; //Store population pair-specific indicator of shared polymorphism
+   SiteEstimates estimates;
+   if (inbred) {
+      allele_draws.setScaffold(scaffold_name);
+   }
    
+   vector<BlockAlleleCounts> block_counts; //Allele counts of each population at the current block of sites
+   vector<char> gathered_site_bases;
+   //At a site where every sample has the same byte (e.g. an invariant site,
+   // a site masked in every sample, or any site of a run of a cohort store
+   // where every sample matches the reference), the output only depends on
+   // that byte, so it is computed once per byte and reused:
+   bool shared_row = !debug && rowsShareBases(FASTA_sequences);
+   uint64_t uniform_sites = 0; //Mask of such sites in the current block
+   vector<char> uniform_site_bases;
+   map<char, string> uniform_site_outputs;
+   map<char, vector<double>> uniform_site_values;
+   ostringstream uniform_site_output;
    for (unsigned long i = 0; i < scaffold_length; i++) {
-      //Use site if all populations have at least 2 alleles:
-      bool use_site = 1;
-   
-      //Initialize some of these containers:
-      population_site_frequencies.clear();
-      population_p_hats.clear();
-      population_pi_hats.clear();
-      D_xys.clear();
-      for (unsigned long i = 0; i < num_populations; i++) {
-         population_site_frequencies.push_back(init_base_frequency);
-         population_p_hats.push_back(init_p_hats);
-         population_pi_hats.push_back(0.0);
-      }
-      if (debug) {
-         cerr << "Counting alleles for site " << i+1 << "." << endl;
-      }
-      for (unsigned long j = 0; j < num_sequences; j++) {
-         switch (FASTA_sequences[j][i]) {
-            case 'A':
-            case 'a':
-               population_site_frequencies[population_map[j]-1][0] += inbred ? 1 : 2; //Add 2 A alleles
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'C':
-            case 'c':
-               population_site_frequencies[population_map[j]-1][1] += inbred ? 1 : 2; //Add 2 C alleles
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'G':
-            case 'g':
-               population_site_frequencies[population_map[j]-1][2] += inbred ? 1 : 2; //Add 2 G alleles
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'K': //G/T het site
-            case 'k':
-               if (inbred) { //Randomly choose one of the alleles
-                  population_site_frequencies[population_map[j]-1][rand() <= (RAND_MAX-1)/2 ? 2 : 3]++;
-               } else {
-                  population_site_frequencies[population_map[j]-1][2]++; //Add 1 G allele
-                  population_site_frequencies[population_map[j]-1][3]++; //Add 1 T allele
-               }
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'M': //A/C het site
-            case 'm':
-               if (inbred) { //Randomly choose one of the alleles
-                  population_site_frequencies[population_map[j]-1][rand() <= (RAND_MAX-1)/2 ? 0 : 1]++;
-               } else {
-                  population_site_frequencies[population_map[j]-1][0]++; //Add 1 A allele
-                  population_site_frequencies[population_map[j]-1][1]++; //Add 1 C allele
-               }
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'R': //A/G het site
-            case 'r':
-               if (inbred) { //Randomly choose one of the alleles
-                  population_site_frequencies[population_map[j]-1][rand() <= (RAND_MAX-1)/2 ? 0 : 2]++;
-               } else {
-                  population_site_frequencies[population_map[j]-1][0]++; //Add 1 A allele
-                  population_site_frequencies[population_map[j]-1][2]++; //Add 1 G allele
-               }
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'S': //C/G het site
-            case 's':
-               if (inbred) { //Randomly choose one of the alleles
-                  population_site_frequencies[population_map[j]-1][rand() <= (RAND_MAX-1)/2 ? 1 : 2]++;
-               } else {
-                  population_site_frequencies[population_map[j]-1][1]++; //Add 1 C allele
-                  population_site_frequencies[population_map[j]-1][2]++; //Add 1 G allele
-               }
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'T':
-            case 't':
-               population_site_frequencies[population_map[j]-1][3] += inbred ? 1 : 2; //Add 2 T alleles
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'W': //A/T het site
-            case 'w':
-               if (inbred) { //Randomly choose one of the alleles
-                  population_site_frequencies[population_map[j]-1][rand() <= (RAND_MAX-1)/2 ? 0 : 3]++;
-               } else {
-                  population_site_frequencies[population_map[j]-1][0]++; //Add 1 A allele
-                  population_site_frequencies[population_map[j]-1][3]++; //Add 1 T allele
-               }
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'Y': //C/T het site
-            case 'y':
-               if (inbred) { //Randomly choose one of the alleles
-                  population_site_frequencies[population_map[j]-1][rand() <= (RAND_MAX-1)/2 ? 1 : 3]++;
-               } else {
-                  population_site_frequencies[population_map[j]-1][1]++; //Add 1 C allele
-                  population_site_frequencies[population_map[j]-1][3]++; //Add 1 T allele
-               }
-               population_site_frequencies[population_map[j]-1][5] += inbred ? 1 : 2; //Add 2 non-N alleles
-               break;
-            case 'N':
-               population_site_frequencies[population_map[j]-1][4] += inbred ? 1 : 2; //Add 2 N alleles
-               break;
-            case '-':
-               population_site_frequencies[population_map[j]-1][4] += inbred ? 1 : 2; //Add 2 N alleles
-               break;
-            default: //Assume that any case not handled here is an N
-               population_site_frequencies[population_map[j]-1][4] += inbred ? 1 : 2; //Add 2 N alleles
-               break;
+      if (i % TILE_SITES == 0) {
+         //Find the uniform sites of the next block whenever we reach its
+         // start, and count the rest of the block:
+         unsigned long num_sites = min((unsigned long)TILE_SITES, scaffold_length-i);
+         uniform_sites = debug ? 0 : shared_row ? blockSiteMask(num_sites) : uniformSites(FASTA_sequences, i, num_sites);
+         if (uniform_sites != blockSiteMask(num_sites)) {
+            countBlockPopulations(FASTA_sequences, layout, i, num_sites, block_counts);
          }
       }
-      
-      //Calculate the total and population-specific allele frequencies:
-      if (debug) {
-         cerr << "Estimating allele frequencies for site " << i+1 << "." << endl;
-      }
-      unsigned long population_index = 0;
-      unsigned long nonN_bases = 0;
-      unsigned long total_bases = 0;
-      for (population_index = 0; population_index < num_populations; population_index++) {
-         use_site = use_site && population_site_frequencies[population_index][5] >= 2;
-         nonN_bases += population_site_frequencies[population_index][5];
-         total_bases += population_site_frequencies[population_index][4] + population_site_frequencies[population_index][5];
-         string pi_key = piKey(population_site_frequencies[population_index]);
-         for (unsigned long j = 0; j < NUM_BASES; j++) {
-            population_p_hats[population_index][j] = (double)population_site_frequencies[population_index][j]/(double)population_site_frequencies[population_index][5];
-         }
-         if (memoized_pi.find(pi_key) != memoized_pi.end()) {
-            population_pi_hats[population_index] = memoized_pi[pi_key];
-         } else {
-            //Calculate \pi_{i} for each population:
-            if (debug) {
-               cerr << "Estimating pi for each population at site " << i+1 << "." << endl;
-            }
-            for (unsigned long j = 0; j < NUM_BASES-1; j++) {
-               for (unsigned long k = j+1; k < NUM_BASES; k++) {
-                  population_pi_hats[population_index] += 2*population_p_hats[population_index][j]*population_p_hats[population_index][k];
+      const char *site_bases = NULL;
+      bool cache_site = 0;
+      bool uniform_site = (uniform_sites >> (i % TILE_SITES)) & 1;
+      if (uniform_site) {
+         char uniform_base = FASTA_sequences[0].bases[i];
+         if (windows != NULL) {
+            auto cached_values = uniform_site_values.find(uniform_base);
+            if (cached_values != uniform_site_values.end()) {
+               //Add the whole run of the block with this byte at once:
+               unsigned long run_end = i+1;
+               while (run_end % TILE_SITES != 0 && ((uniform_sites >> (run_end % TILE_SITES)) & 1) && FASTA_sequences[0].bases[run_end] == uniform_base) {
+                  run_end++;
                }
+               windows->addSites(scaffold_name, position_offset+i+1, run_end-i, cached_values->second);
+               i = run_end-1;
+               continue;
             }
-            //Do the \frac{n}{n-1} correction, which now makes this Nei (1987) Eqn. 10.5
-            if (population_site_frequencies[population_index][5] >= 2) { //Avoid divide-by-zero
-               population_pi_hats[population_index] *= (double)population_site_frequencies[population_index][5]/(double)(population_site_frequencies[population_index][5]-1);
+         } else {
+            auto cached_output = uniform_site_outputs.find(uniform_base);
+            if (cached_output != uniform_site_outputs.end()) {
+               output << scaffold_name << '\t' << position_offset+i+1 << cached_output->second;
+               continue;
             }
-            memoized_pi[pi_key] = population_pi_hats[population_index];
          }
+         //Alleles drawn at het sites in inbred mode differ between sites:
+         cache_site = !inbred || !isHetBase(uniform_base);
+         uniform_site_bases.assign(num_sequences, uniform_base);
+         site_bases = uniform_site_bases.data();
       }
-      
-      //Calculate D_{xy} and D_{a} for each pair of populations, and identify shared polymorphisms:
+      if (cache_site) {
+         uniform_site_output.str("");
+      }
+      ostream &site_output = cache_site ? uniform_site_output : output;
       if (debug) {
-         cerr << "Estimating D_xy and D_a for site " << i+1 << "." << endl;
-      }
-      for (population_index = 0; population_index < num_populations; population_index++) {
-         for (unsigned long population2_index = population_index+1; population2_index < num_populations; population2_index++) {
-            string dxy_key = dxyKey(population_site_frequencies[population_index], population_site_frequencies[population2_index]);
-            if (memoized_dxy.find(dxy_key) != memoized_dxy.end()) {
-               D_xys.push_back(memoized_dxy[dxy_key]);
-               double d_net = memoized_dxy[dxy_key] - ((population_pi_hats[population_index] + population_pi_hats[population2_index]) / (double)2.0);
-               D_as.push_back(d_net);
-            } else {
-               double d_xy = 0.0;
-               for (unsigned long j = 0; j < NUM_BASES; j++) {
-                  for (unsigned long k = 0; k < NUM_BASES; k++) {
-                     if (j != k) { //d_{ij} = 1 for i != j, see Nei (1987) Eqn. 10.20
-                        d_xy += population_p_hats[population_index][j]*population_p_hats[population2_index][k]; //\hat{x}_{i}\hat{y}_{j} in Nei (1987) Eqn. 10.20
-                     }
-                  }
+         cerr << "Counting alleles for site " << position_offset+i+1 << "." << endl;
+      }
+      if (uniform_site) {
+         countSiteAlleles<inbred>(site_bases, layout, num_populations, allele_draws, position_offset+i, population_site_frequencies);
+      } else {
+         countBlockSiteAlleles<inbred>(FASTA_sequences, block_counts, layout, i, position_offset, num_populations, allele_draws, gathered_site_bases, population_site_frequencies);
+      }
+      
+      if (windows != NULL) {
+         siteStatisticValues<debug, usable, shared_poly>(population_site_frequencies, num_populations, memo, estimates, selection, position_offset+i+1, estimates.site_values);
+         windows->addSite(scaffold_name, position_offset+i+1, estimates.site_values);
+         if (cache_site) {
+            uniform_site_values[site_bases[0]] = estimates.site_values;
+         }
+         continue;
+      }
+      //Output elements: Scaffold, position, then the estimators for the site:
+      output << scaffold_name << '\t' << position_offset+i+1;
+      outputSiteStatistics<debug, usable, shared_poly>(population_site_frequencies, num_populations, memo, estimates, selection, position_offset+i+1, site_output);
+      if (cache_site) {
+         string &cached_output = uniform_site_outputs[site_bases[0]];
+         cached_output = uniform_site_output.str();
+         output << cached_output;
+      }
+   }
+}
+
+//Count the alleles of each site of a row without computing any estimators,
+// adding them to an allele count file, for merging with calculateDxy -M:
+template <bool inbred>
+void countScaffold(const string &scaffold_name, vector<SequenceView> &FASTA_sequences, unsigned long position_offset, const PopulationLayout &layout, unsigned long num_populations, AlleleDraws &allele_draws, AlleleCountWriter &count_writer) {
+   unsigned long scaffold_length = FASTA_sequences[0].length;
+   vector<array<unsigned long, 6>> population_site_frequencies;
+   vector<BlockAlleleCounts> block_counts;
+   vector<char> gathered_site_bases;
+   if (inbred) {
+      allele_draws.setScaffold(scaffold_name);
+   }
+   for (unsigned long i = 0; i < scaffold_length; i++) {
+      if (i % TILE_SITES == 0) {
+         countBlockPopulations(FASTA_sequences, layout, i, min((unsigned long)TILE_SITES, scaffold_length-i), block_counts);
+      }
+      countBlockSiteAlleles<inbred>(FASTA_sequences, block_counts, layout, i, position_offset, num_populations, allele_draws, gathered_site_bases, population_site_frequencies);
+      count_writer.addSite(scaffold_name, position_offset+i, population_site_frequencies);
+   }
+}
+
+//The per-site loops instantiated for one combination of options, which are
+// chosen once by selectScaffoldKernels(), so the loops never test the
+// options at each site or sample:
+struct ScaffoldKernels {
+   void (*process_scaffold)(const string &scaffold_name, vector<SequenceView> &FASTA_sequences, unsigned long position_offset, const PopulationLayout &layout, unsigned long num_populations, EstimateMemo &memo, const EstimatorSelection &selection, AlleleDraws &allele_draws, ostream &output, StatisticWindows *windows);
+   void (*count_scaffold)(const string &scaffold_name, vector<SequenceView> &FASTA_sequences, unsigned long position_offset, const PopulationLayout &layout, unsigned long num_populations, AlleleDraws &allele_draws, AlleleCountWriter &count_writer);
+   void (*site_statistic_values)(vector<array<unsigned long, 6>> &population_site_frequencies, unsigned long num_populations, EstimateMemo &memo, SiteEstimates &estimates, const EstimatorSelection &selection, unsigned long position, vector<double> &site_values);
+   void (*output_site_statistics)(vector<array<unsigned long, 6>> &population_site_frequencies, unsigned long num_populations, EstimateMemo &memo, SiteEstimates &estimates, const EstimatorSelection &selection, unsigned long position, ostream &site_output);
+};
+
+template <bool inbred, bool debug, bool usable, bool shared_poly>
+ScaffoldKernels scaffoldKernels() {
+   ScaffoldKernels kernels = {processScaffold<inbred, debug, usable, shared_poly>, countScaffold<inbred>, siteStatisticValues<debug, usable, shared_poly>, outputSiteStatistics<debug, usable, shared_poly>};
+   return kernels;
+}
+
+//Choose the kernels for the given options:
+ScaffoldKernels selectScaffoldKernels(bool inbred, bool debug, bool usable, bool shared_poly) {
+   //Indexed by inbred + 2*debug + 4*usable + 8*shared_poly:
+   static ScaffoldKernels (*const instantiations[16])() = {
+      scaffoldKernels<0, 0, 0, 0>, scaffoldKernels<1, 0, 0, 0>, scaffoldKernels<0, 1, 0, 0>, scaffoldKernels<1, 1, 0, 0>,
+      scaffoldKernels<0, 0, 1, 0>, scaffoldKernels<1, 0, 1, 0>, scaffoldKernels<0, 1, 1, 0>, scaffoldKernels<1, 1, 1, 0>,
+      scaffoldKernels<0, 0, 0, 1>, scaffoldKernels<1, 0, 0, 1>, scaffoldKernels<0, 1, 0, 1>, scaffoldKernels<1, 1, 0, 1>,
+      scaffoldKernels<0, 0, 1, 1>, scaffoldKernels<1, 0, 1, 1>, scaffoldKernels<0, 1, 1, 1>, scaffoldKernels<1, 1, 1, 1>
+   };
+   return instantiations[inbred + 2*debug + 4*usable + 8*shared_poly]();
+}
+
+//Load the scaffold indexes of the input FASTAs, returning an exit code:
+int loadFASTAIndex(PseudorefReader &FASTA_reader) {
+   reader_status index_status = FASTA_reader.loadIndex();
+   if (index_status == READER_HEADERS_DIFFER) {
+      cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
+      cerr << FASTA_reader.scaffoldHeader(FASTA_reader.failedScaffold()) << endl;
+      cerr << FASTA_reader.scaffoldHeader(FASTA_reader.failedScaffold(), FASTA_reader.failedInput()) << endl;
+      return 3;
+   } else if (index_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Error: FASTAs are not synchronized, scaffolds differ in " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      return 4;
+   } else if (index_status == READER_IO_ERROR) {
+      return 5;
+   }
+   return 0;
+}
+
+//A chunk of the sites of one scaffold, processed as one task by --threads:
+struct ScaffoldChunk {
+   unsigned long scaffold_number;
+   uint64_t start;
+   uint64_t end;
+};
+
+//Split each scaffold into chunks of at most chunk_sites sites, in genome
+// order (with one empty chunk for an empty scaffold):
+vector<ScaffoldChunk> splitScaffolds(PseudorefReader &FASTA_reader, uint64_t chunk_sites) {
+   vector<ScaffoldChunk> chunks;
+   for (unsigned long scaffold_number = 0; scaffold_number < FASTA_reader.numScaffolds(); scaffold_number++) {
+      uint64_t scaffold_length = FASTA_reader.scaffoldLength(scaffold_number);
+      uint64_t start = 0;
+      do {
+         ScaffoldChunk chunk = {scaffold_number, start, min(start + chunk_sites, scaffold_length)};
+         chunks.push_back(chunk);
+         start = chunk.end;
+      } while (start < scaffold_length);
+   }
+   return chunks;
+}
+
+//Count the coin flips inbred mode draws in each chunk (one per het base of
+// any sample), in parallel, storing the number drawn before each chunk
+// (and in total at the end), returning an exit code:
+int countChunkDraws(PseudorefReader &FASTA_reader, vector<ScaffoldChunk> &chunks, unsigned int num_threads, vector<uint64_t> &first_draws) {
+   first_draws.assign(chunks.size()+1, 0);
+   vector<unsigned long> all_samples(FASTA_reader.size());
+   for (unsigned long j = 0; j < all_samples.size(); j++) {
+      all_samples[j] = j;
+   }
+   int exit_code = runParallelTasks(chunks.size(), num_threads, [&](unsigned long chunk_number, unsigned int thread_index) {
+      ScaffoldChunk &chunk = chunks[chunk_number];
+      BlockAlleleCounts block_counts;
+      uint64_t het_alleles = 0;
+      if (FASTA_reader.readRange(chunk.scaffold_number, chunk.start, chunk.end, [&](vector<SequenceView> &FASTA_sites, uint64_t scaffold_position) {
+         for (unsigned long i = 0; i < FASTA_sites[0].length; i += TILE_SITES) {
+            unsigned long num_sites = min((unsigned long)TILE_SITES, FASTA_sites[0].length-i);
+            countBlockAlleles(FASTA_sites, all_samples, i, num_sites, block_counts);
+            for (unsigned int b = 0; b < 4; b++) {
+               for (unsigned long k = 0; k < num_sites; k++) {
+                  het_alleles += block_counts.het_alleles[b][k];
                }
-               D_xys.push_back(d_xy);
-               memoized_dxy[dxy_key] = d_xy;
-               double d_net = d_xy - ((population_pi_hats[population_index] + population_pi_hats[population2_index]) / (double)2.0);
-               D_as.push_back(d_net);
-            }
-            //Identify shared polymorphisms:
-            if (shared_poly) {
-               bool site_is_shared_poly = is_shared_poly(population_site_frequencies[population_index], population_site_frequencies[population2_index]);
-               SP.push_back(site_is_shared_poly);
             }
          }
+      }) != READER_SEQUENCE) {
+         return 5;
+      }
+      //Each het has two alleles:
+      first_draws[chunk_number+1] = het_alleles/2;
+      return 0;
+   });
+   for (unsigned long chunk_number = 0; chunk_number < chunks.size(); chunk_number++) {
+      first_draws[chunk_number+1] += first_draws[chunk_number];
+   }
+   return exit_code;
+}
+
+//Process chunks of every scaffold on separate threads, seeking with the
+// index of each input, and outputting the chunks in genome order:
+//Counter-based allele draws for inbred lines are the same in any chunk,
+// and with --legacy_prng, the alleles of hets are drawn up front in site
+// order, so either way the output is exactly that of a serial run
+//With windows, chunks are whole numbers of windows, so each chunk outputs
+// its own windows, and window sums are exact, so they match a serial run too
+int processScaffoldsInParallel(PseudorefReader &FASTA_reader, unsigned int num_threads, const PopulationLayout &layout, unsigned long num_populations, const EstimatorSelection &selection, const ScaffoldKernels &kernels, bool inbred, AlleleDraws &allele_draws, bool debug, StatisticWindows *windows, unsigned long window_size) {
+   int index_exit_code = loadFASTAIndex(FASTA_reader);
+   if (index_exit_code != 0) {
+      return index_exit_code;
+   }
+   uint64_t chunk_sites = PARALLEL_CHUNK_SITES;
+   if (windows != NULL) {
+      chunk_sites = max((uint64_t)1, chunk_sites/window_size)*window_size;
+   }
+   vector<ScaffoldChunk> chunks = splitScaffolds(FASTA_reader, chunk_sites);
+   vector<uint64_t> first_draws;
+   vector<bool> drawn_flips;
+   if (inbred && !allele_draws.isCounterBased()) {
+      if (countChunkDraws(FASTA_reader, chunks, num_threads, first_draws) != 0) {
+         cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+         cerr << strerror(errno) << endl;
+         return 5;
+      }
+      if (debug) {
+         cerr << "Drawing " << first_draws.back() << " alleles of hets in inbred lines." << endl;
+      }
+      AlleleDraws::drawAhead(first_draws.back(), drawn_flips);
+   }
+   //Each thread memoizes separately, so the memos need no locking:
+   vector<EstimateMemo> memos(num_threads);
+   OrderedOutput ordered_output(cout, chunks.size());
+   return runParallelTasks(chunks.size(), num_threads, [&](unsigned long chunk_number, unsigned int thread_index) {
+      ScaffoldChunk &chunk = chunks[chunk_number];
+      const string &scaffold_name = FASTA_reader.scaffoldHeader(chunk.scaffold_number);
+      if (chunk.start == 0) {
+         lock_guard<mutex> message_lock(ordered_output.lock());
+         cerr << "Processing scaffold " << scaffold_name << endl;
+      }
+      AlleleDraws chunk_draws = allele_draws.isCounterBased() ? allele_draws : AlleleDraws(&drawn_flips, first_draws.empty() ? 0 : first_draws[chunk_number]);
+      StatisticWindows chunk_windows = windows != NULL ? *windows : StatisticWindows();
+      ostringstream region_output;
+      string region_text;
+      if (FASTA_reader.readRange(chunk.scaffold_number, chunk.start, chunk.end, [&](vector<SequenceView> &FASTA_sites, uint64_t scaffold_position) {
+         kernels.process_scaffold(scaffold_name, FASTA_sites, scaffold_position, layout, num_populations, memos[thread_index], selection, chunk_draws, region_output, windows != NULL ? &chunk_windows : NULL);
+         chunk_windows.outputFinished(region_output);
+         region_text = region_output.str();
+         region_output.str("");
+         ordered_output.write(chunk_number, region_text);
+      }) != READER_SEQUENCE) {
+         lock_guard<mutex> message_lock(ordered_output.lock());
+         cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+         cerr << strerror(errno) << endl;
+         return 5;
       }
+      chunk_windows.outputAll(region_output);
+      region_text = region_output.str();
+      ordered_output.write(chunk_number, region_text);
+      ordered_output.finish(chunk_number);
+      return 0;
+   });
+}
 
-      double usable_fraction = (double)nonN_bases/(double)total_bases;
-      
-      if (use_site) {
-         //Output elements: Scaffold, position, D_{12}, omit site, pi_{i}, D_{ij}, D_{a} values
-         cout << FASTA_headers[0].substr(1) << '\t' << i+1;
-         population_index = 0;
-         //Output D_{12} and omit_site:
-         if (!usable) { //If we don't want to output the usable fraction, just output 0
-            cout << '\t' << D_xys[0] << '\t' << "0";
+//Process only the given regions, seeking to each with the .fai indexes:
+//If count_writer isn't NULL, the allele counts are written to it instead,
+// and if windows isn't NULL, the sites are summarized in windows
+int processRegions(PseudorefReader &FASTA_reader, vector<GenomicRegion> &regions, const PopulationLayout &layout, unsigned long num_populations, const EstimatorSelection &selection, const ScaffoldKernels &kernels, AlleleDraws &allele_draws, AlleleCountWriter *count_writer, StatisticWindows *windows) {
+   int index_exit_code = loadFASTAIndex(FASTA_reader);
+   if (index_exit_code != 0) {
+      return index_exit_code;
+   }
+   EstimateMemo memo;
+   for (auto region_iterator = regions.begin(); region_iterator != regions.end(); ++region_iterator) {
+      unsigned long scaffold_number;
+      if (!FASTA_reader.findScaffold(region_iterator->scaffold, scaffold_number)) {
+         cerr << "Error: Scaffold " << region_iterator->scaffold << " of region not found in the FASTAs" << endl;
+         return 6;
+      }
+      const string &scaffold_name = FASTA_reader.scaffoldHeader(scaffold_number);
+      uint64_t region_end = min(region_iterator->end, FASTA_reader.scaffoldLength(scaffold_number));
+      if (region_iterator->start >= region_end) {
+         cerr << "Skipping region beyond the end of scaffold " << scaffold_name << endl;
+         continue;
+      }
+      cerr << "Processing region " << scaffold_name << ":" << region_iterator->start+1 << "-" << region_end << endl;
+      if (FASTA_reader.readRange(scaffold_number, region_iterator->start, region_end, [&](vector<SequenceView> &FASTA_sites, uint64_t scaffold_position) {
+         if (count_writer != NULL) {
+            kernels.count_scaffold(scaffold_name, FASTA_sites, scaffold_position, layout, num_populations, allele_draws, *count_writer);
          } else {
-            cout << '\t' << D_xys[0] << '\t' << usable_fraction;
-         }
-         //Output \pi_{i} values:
-         for (auto population_iterator = population_pi_hats.begin(); population_iterator != population_pi_hats.end(); ++population_iterator) {
-            cout << '\t' << *population_iterator;
-            population_index++;
-         }
-         //Output D_{XY}, and D_{a} values:
-         unsigned long num_pairs = D_xys.size();
-         for (unsigned long pair_index = 0; pair_index < num_pairs; pair_index++) {
-            cout << '\t' << D_xys[pair_index];
-            cout << '\t' << D_as[pair_index];
-         }
-         if (shared_poly) {
-            for (unsigned long pair_index = 0; pair_index < num_pairs; pair_index++) {
-               cout << '\t' << SP[pair_index];
+            kernels.process_scaffold(scaffold_name, FASTA_sites, scaffold_position, layout, num_populations, memo, selection, allele_draws, cout, windows);
+            if (windows != NULL) {
+               windows->outputFinished(cout);
             }
          }
-         cout << endl;
-      } else { //Do not output any estimators for n < 2
-         if (!usable) { //If we don't want to output the usable fraction, just output 1
-            cout << FASTA_headers[0].substr(1) << '\t' << i+1 << '\t' << "0" << '\t' << 1;
-         } else {
-            cout << FASTA_headers[0].substr(1) << '\t' << i+1 << '\t' << "0" << '\t' << usable_fraction;
-         }
-         for (unsigned long j = 1; j <= num_populations; j++) {
-            cout << '\t' << "0"; //Output 0 (NA)s for \pi_{i} values as well
-         }
-         for (unsigned long j = 1; j <= num_populations; j++) {
-            for (unsigned long k = j+1; k <= num_populations; k++) {
-               cout << '\t' << "0"; //Output 0 (NA)s for D_{XY}
-               cout << '\t' << "0"; //Output 0 (NA)s for D_{a}
+      }) != READER_SEQUENCE) {
+         cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+         cerr << strerror(errno) << endl;
+         return 5;
+      }
+   }
+   if (windows != NULL) {
+      windows->outputAll(cout);
+   }
+   return 0;
+}
+
+//Column 3 is D of the first selected pair (D_1,2 unless pairs are
+// selected), and windowed output has the fraction of usable sites in each
+// window in place of omit_position:
+void outputHeaderLine(const EstimatorSelection &selection, bool usable, bool windowed) {
+   cout << "Scaffold" << '\t' << "Position";
+   if (selection.pairs.empty()) {
+      cout << '\t' << "D_1,2";
+   } else {
+      cout << '\t' << "D_" << selection.pairs[0].first+1 << ',' << selection.pairs[0].second+1;
+   }
+   if (windowed) {
+      cout << '\t' << "usable_fraction";
+   } else if (!usable) {
+      cout << '\t' << "omit_position";
+   } else {
+      cout << '\t' << "site_weight";
+   }
+   if (selection.pi) {
+      for (auto population_iterator = selection.pi_populations.begin(); population_iterator != selection.pi_populations.end(); ++population_iterator) {
+         cout << '\t' << "pi_" << *population_iterator+1;
+      }
+   }
+   for (auto pair_iterator = selection.pairs.begin(); pair_iterator != selection.pairs.end(); ++pair_iterator) {
+      if (selection.D_xy) {
+         cout << '\t' << "D_" << pair_iterator->first+1 << ',' << pair_iterator->second+1;
+      }
+      if (selection.D_a) {
+         cout << '\t' << "Da_" << pair_iterator->first+1 << ',' << pair_iterator->second+1;
+      }
+   }
+   if (selection.shared_poly) {
+      for (auto pair_iterator = selection.pairs.begin(); pair_iterator != selection.pairs.end(); ++pair_iterator) {
+         cout << '\t' << "Shared_Poly_" << pair_iterator->first+1 << ',' << pair_iterator->second+1;
+      }
+   }
+   cout << endl;
+}
+
+//Add up the allele count files of each shard of samples site by site, and
+// output the estimators from the summed counts:
+//Shards must cover the same sites in the same order, but may have
+// different numbers of populations, as a shard without any samples of a
+// population just counts none of its alleles
+//If window_size isn't 0, the estimators are summarized in windows
+int mergeAlleleCounts(vector<string> &count_paths, EstimatorSelection &selection, const ScaffoldKernels &kernels, bool usable, unsigned long window_size, const WindowFilter &window_filter) {
+   vector<AlleleCountReader> shards(count_paths.size());
+   unsigned long num_populations = 0;
+   for (unsigned long s = 0; s < shards.size(); s++) {
+      if (!shards[s].open(count_paths[s])) {
+         cerr << "Error reading allele count file " << count_paths[s] << endl;
+         return 2;
+      }
+      if (shards[s].ploidy() != shards[0].ploidy()) {
+         cerr << "Error: Allele count file " << count_paths[s] << " was counted with" << (shards[s].ploidy() == 1 ? "" : "out") << " -i, unlike " << count_paths[0] << endl;
+         return 9;
+      }
+      num_populations = max(num_populations, shards[s].numPopulations());
+   }
+   //Each sample adds the same number of alleles to every site, as bases
+   // or as Ns, so the N counts follow from the totals:
+   vector<unsigned long> allele_totals(num_populations, 0);
+   for (auto shard_iterator = shards.begin(); shard_iterator != shards.end(); ++shard_iterator) {
+      for (unsigned long p = 0; p < shard_iterator->numPopulations(); p++) {
+         allele_totals[p] += shard_iterator->alleleTotal(p);
+      }
+   }
+   if (!selection.resolve(num_populations)) {
+      return 9;
+   }
+   outputHeaderLine(selection, usable, window_size > 0);
+   StatisticWindows windows(max(window_size, 1UL), window_filter, selection.numColumns(), OMIT_COLUMN);
+
+   EstimateMemo memo;
+   SiteEstimates estimates;
+   array<unsigned long, 6> init_base_frequency = { {0, 0, 0, 0, 0, 0} };
+   vector<array<unsigned long, 6>> population_site_frequencies;
+   //Shards may split their sites into blocks differently, so walk them in
+   // runs of sites that every shard has left in its current block:
+   vector<uint64_t> block_offsets(shards.size(), 0);
+   string scaffold_name = "";
+   while (true) {
+      unsigned long shards_ended = 0;
+      for (unsigned long s = 0; s < shards.size(); s++) {
+         if (block_offsets[s] == shards[s].numSites()) {
+            int block_status = shards[s].nextBlock();
+            if (block_status < 0) {
+               cerr << "Error reading allele count file " << count_paths[s] << ", it may be truncated" << endl;
+               return 5;
             }
+            block_offsets[s] = 0;
+            shards_ended += block_status == 0;
          }
-         if (shared_poly) {
-            for (unsigned long j = 1; j <= num_populations; j++) {
-               for (unsigned long k = j+1; k <= num_populations; k++) {
-                  cout << '\t' << "0"; //Output 0 (NA) for shared polymorphism between i and j
+      }
+      if (shards_ended == shards.size()) {
+         break;
+      }
+      if (shards_ended > 0) {
+         cerr << "Error: Allele count files are not synchronized, some end before others" << endl;
+         return 4;
+      }
+      unsigned long run_length = ALLELE_COUNTS_BLOCK_SITES;
+      for (unsigned long s = 0; s < shards.size(); s++) {
+         if (shards[s].scaffold() != shards[0].scaffold() || shards[s].firstSite() + block_offsets[s] != shards[0].firstSite() + block_offsets[0]) {
+            cerr << "Error: Allele count files are not synchronized, " << count_paths[s] << " differs from " << count_paths[0] << " at " << shards[0].scaffold() << ":" << shards[0].firstSite() + block_offsets[0] + 1 << endl;
+            return 4;
+         }
+         run_length = min(run_length, (unsigned long)(shards[s].numSites() - block_offsets[s]));
+      }
+      if (shards[0].scaffold() != scaffold_name) {
+         scaffold_name = shards[0].scaffold();
+         cerr << "Processing scaffold " << scaffold_name << endl;
+      }
+      for (unsigned long i = 0; i < run_length; i++) {
+         population_site_frequencies.assign(num_populations, init_base_frequency);
+         for (unsigned long s = 0; s < shards.size(); s++) {
+            for (unsigned long p = 0; p < shards[s].numPopulations(); p++) {
+               for (unsigned int base = 0; base < NUM_BASES; base++) {
+                  population_site_frequencies[p][base] += shards[s].count(block_offsets[s]+i, p, base);
                }
             }
          }
-         cout << endl;
+         for (unsigned long p = 0; p < num_populations; p++) {
+            population_site_frequencies[p][5] = population_site_frequencies[p][0] + population_site_frequencies[p][1] + population_site_frequencies[p][2] + population_site_frequencies[p][3];
+            population_site_frequencies[p][4] = allele_totals[p] - population_site_frequencies[p][5];
+         }
+         unsigned long position = shards[0].firstSite() + block_offsets[0] + i + 1;
+         if (window_size > 0) {
+            kernels.site_statistic_values(population_site_frequencies, num_populations, memo, estimates, selection, position, estimates.site_values);
+            windows.addSite(scaffold_name, position, estimates.site_values);
+            continue;
+         }
+         cout << scaffold_name << '\t' << position;
+         kernels.output_site_statistics(population_site_frequencies, num_populations, memo, estimates, selection, position, cout);
+      }
+      windows.outputFinished(cout);
+      for (unsigned long s = 0; s < shards.size(); s++) {
+         block_offsets[s] += run_length;
       }
    }
+   windows.outputAll(cout);
+   return 0;
 }
 
 int main(int argc, char **argv) {
    //Variables for processing the FASTAs:
    vector<string> input_FASTA_paths;
-   vector<ifstream*> input_FASTAs;
    
    //Path to file describing which indivs are in which populations:
    string popfile_path;
    
-   //Option to identify polymorphisms shared between populations:
-   bool shared_poly = 0;
+   //Which estimators to compute, for which pairs of populations, and
+   // whether to identify polymorphisms shared between populations:
+   EstimatorSelection selection;
+   unsigned long outgroup;
+   pair<unsigned long, unsigned long> requested_pair;
    
    //Handle inbred pseudoreferences as haploids:
    bool inbred = 0;
    unsigned int prng_seed = 42;
+   //Draw alleles from rand() in site order, as before version 2.18:
+   bool legacy_prng = 0;
 
    //Option to output debugging info on STDERR
    bool debug = 0;
 
    //Option to output fraction of usable sites:
    bool usable = 0;
+   //Option to memory-map the input FASTAs:
+   bool use_mmap = 0;
+   //Number of threads to process scaffolds on:
+   unsigned int num_threads = 1;
+   //Number of threads to inflate BGZF-compressed FASTAs with:
+   unsigned int decompression_threads = 1;
+   //Number of compute workers for the reader/compute/writer pipeline (0 for no pipeline):
+   unsigned int compute_threads = 0;
+   //Number of blocks queued between pipeline stages:
+   unsigned long queue_depth = PIPELINE_QUEUE_DEPTH;
+   //Regions to restrict processing to (empty for the whole genome):
+   vector<GenomicRegion> regions;
+   GenomicRegion region;
+   //Reference FASTA that any VCF inputs were called against:
+   string VCF_reference_path = "";
+   //Allele count file to write instead of the estimators, for a shard of
+   // the samples:
+   string counts_path = "";
+   //Allele count files of each shard to add up and compute estimators from:
+   vector<string> merge_count_paths;
+   //Option to only check the inputs against each other:
+   bool preflight = 0;
+   //Size of windows to summarize the estimators in (0 for per-site output),
+   // and how sites are filtered or weighted in them, as in
+   // nonOverlappingWindows:
+   unsigned long window_size = 0;
+   WindowFilter window_filter;
    
    //Variables for getopt_long:
    int optchar;
@@ -414,13 +964,32 @@ int main(int argc, char **argv) {
       {"shared_poly", no_argument, 0, 's'},
       {"inbred", no_argument, 0, 'i'},
       {"prng_seed", required_argument, 0, 'r'},
+      {"legacy_prng", no_argument, 0, 'L'},
       {"usable_fraction", no_argument, 0, 'u'},
+      {"mmap", no_argument, 0, 'm'},
+      {"threads", required_argument, 0, 't'},
+      {"decompression_threads", required_argument, 0, 'z'},
+      {"compute_threads", required_argument, 0, 'c'},
+      {"queue_depth", required_argument, 0, 'q'},
+      {"region", required_argument, 0, 'R'},
+      {"bed", required_argument, 0, 'b'},
+      {"vcf_reference", required_argument, 0, 'V'},
+      {"counts_out", required_argument, 0, 'o'},
+      {"merge_counts", required_argument, 0, 'M'},
+      {"preflight", no_argument, 0, 'P'},
+      {"pair", required_argument, 0, 'x'},
+      {"outgroup", required_argument, 0, 'g'},
+      {"statistics", required_argument, 0, 'S'},
+      {"window_size", required_argument, 0, 'w'},
+      {"omit_n", no_argument, 0, 'n'},
+      {"infimum_nonN", required_argument, 0, 'f'},
+      {"weighted_average", no_argument, 0, 'a'},
       {"debug", no_argument, 0, 'd'},
       {"version", no_argument, 0, 'v'},
       {"help", no_argument, 0, 'h'}
    };
    //Read in the options:
-   while ((optchar = getopt_long(argc, argv, "p:sir:udvh", longoptions, &structindex)) > -1) {
+   while ((optchar = getopt_long(argc, argv, "p:sir:Lumt:z:c:q:R:b:V:o:M:Px:g:S:w:nf:advh", longoptions, &structindex)) > -1) {
       switch(optchar) {
          case 'p':
             cerr << "Using population TSV file " << optarg << endl;
@@ -428,7 +997,7 @@ int main(int argc, char **argv) {
             break;
          case 's':
             cerr << "Identifying shared polymorphic sites." << endl;
-            shared_poly = 1;
+            selection.shared_poly = 1;
             break;
          case 'i':
             cerr << "Assuming all pseudoreferences are haploid." << endl;
@@ -438,10 +1007,103 @@ int main(int argc, char **argv) {
             cerr << "Setting PRNG seed to " << optarg << endl;
             prng_seed = atoi(optarg);
             break;
+         case 'L':
+            cerr << "Drawing alleles in inbred lines from rand() in site order." << endl;
+            legacy_prng = 1;
+            break;
          case 'u':
             cerr << "Outputting fraction of usable sites rather than omit column" << endl;
             usable = 1;
             break;
+         case 'm':
+            cerr << "Memory-mapping input FASTAs." << endl;
+            use_mmap = 1;
+            break;
+         case 't':
+            num_threads = atoi(optarg);
+            if (num_threads < 1) {
+               num_threads = 1;
+            }
+            break;
+         case 'z':
+            decompression_threads = atoi(optarg);
+            if (decompression_threads < 1) {
+               decompression_threads = 1;
+            }
+            break;
+         case 'c':
+            compute_threads = atoi(optarg);
+            break;
+         case 'q':
+            queue_depth = strtoul(optarg, NULL, 10);
+            break;
+         case 'R':
+            if (!parseRegion(optarg, region)) {
+               cerr << "Invalid region " << optarg << ", expected scaffold:start-end" << endl;
+               return 6;
+            }
+            regions.push_back(region);
+            break;
+         case 'b':
+            if (!readBEDRegions(optarg, regions)) {
+               cerr << "Error reading regions from BED file " << optarg << endl;
+               return 6;
+            }
+            break;
+         case 'V':
+            cerr << "Using reference FASTA " << optarg << " for VCF inputs" << endl;
+            VCF_reference_path = optarg;
+            break;
+         case 'o':
+            cerr << "Writing allele counts to " << optarg << " instead of estimators" << endl;
+            counts_path = optarg;
+            break;
+         case 'M':
+            merge_count_paths.push_back(optarg);
+            break;
+         case 'P':
+            preflight = 1;
+            break;
+         case 'x':
+            if (sscanf(optarg, "%lu,%lu", &requested_pair.first, &requested_pair.second) != 2) {
+               cerr << "Invalid pair of populations " << optarg << ", expected two population numbers, e.g. 1,2" << endl;
+               return 1;
+            }
+            selection.requested_pairs.push_back(requested_pair);
+            break;
+         case 'g':
+            outgroup = strtoul(optarg, NULL, 10);
+            cerr << "Pairing population " << outgroup << " with every other population." << endl;
+            selection.outgroups.push_back(outgroup);
+            break;
+         case 'S':
+            if (!selection.parseStatistics(optarg)) {
+               cerr << "Invalid statistics " << optarg << ", expected a comma-separated list of pi, dxy, and da" << endl;
+               return 1;
+            }
+            break;
+         case 'w':
+            window_size = strtoul(optarg, NULL, 10);
+            if (window_size == 0) {
+               cerr << "Window size must be at least 1." << endl;
+               cerr << USAGE;
+               return 1;
+            }
+            break;
+         case 'n':
+            window_filter.omit_Ns = 1;
+            break;
+         case 'f':
+            window_filter.infimum_nonN = atof(optarg);
+            if (window_filter.infimum_nonN < 0.0 || window_filter.infimum_nonN >= 1.0) {
+               cerr << "Infimum of non-N sites is too small (< 0.0) or too large (>= 1.0), cannot continue." << endl;
+               return 8;
+            }
+            window_filter.nonN_weight = 1;
+            break;
+         case 'a':
+            window_filter.nonN_weight = 2;
+            break;
          case 'd':
             cerr << "Outputting debug information." << endl;
             debug = 1;
@@ -462,8 +1124,45 @@ int main(int argc, char **argv) {
       }
    }
    
+   //Allele counts are per site, so windows only apply to the estimators:
+   if (!counts_path.empty() && window_size > 0) {
+      cerr << "Writing per-site allele counts, so ignoring the window size, which can be given when merging them with -M." << endl;
+      window_size = 0;
+   }
+   //Filtering and weighting windows by the non-N fraction uses the usable
+   // fraction of each site:
+   if (window_size > 0 && window_filter.nonN_weight > 0 && !usable) {
+      cerr << "Filtering or weighting windows by the fraction of usable sites, so outputting it per site." << endl;
+      usable = 1;
+   }
+   if (window_size > 0) {
+      if (window_filter.nonN_weight == 2) {
+         cerr << "Averaging each window weighted by the fraction of usable bases at each site." << endl;
+      } else if (window_filter.nonN_weight == 1) {
+         cerr << "Averaging each window over sites with a fraction of usable bases above " << window_filter.infimum_nonN << "." << endl;
+      } else if (window_filter.omit_Ns) {
+         cerr << "Averaging each window over sites that aren't omitted." << endl;
+      }
+      cerr << "Outputting the mean of each estimator over windows of " << window_size << " sites." << endl;
+   } else if (window_filter.filtered()) {
+      cerr << "Ignoring -n, -f, and -a without a window size (-w)." << endl;
+   }
+   
+   //Pick the per-site loops for these options once, rather than testing
+   // them at every site:
+   ScaffoldKernels kernels = selectScaffoldKernels(inbred, debug, usable, selection.shared_poly);
+   
+   //Only add up the allele counts of the shards:
+   if (!merge_count_paths.empty()) {
+      cerr << "Merging allele counts of " << merge_count_paths.size() << " shards." << endl;
+      return mergeAlleleCounts(merge_count_paths, selection, kernels, usable, window_size, window_filter);
+   }
+   
    //Set the seed of the PRNG:
    srand(prng_seed);
+   //Alleles of hets in inbred lines are drawn by hashing the seed, scaffold,
+   // position, and sample, or from rand() in site order with -L:
+   AlleleDraws allele_draws = legacy_prng ? AlleleDraws() : AlleleDraws::counterBased(prng_seed);
    
    //Open the population TSV file:
    ifstream pop_file;
@@ -473,19 +1172,18 @@ int main(int argc, char **argv) {
       return 9;
    }
    
-   //Read the population members into a map from FASTA to population:
-   map<unsigned long, unsigned long> population_map;
+   //Read the population of each FASTA:
+   vector<unsigned long> sample_populations;
    set<unsigned long> populations;
    string popline;
    if (debug) {
       cerr << "Reading population TSV file." << endl;
    }
-   unsigned long fasta_index = 0;
    while (getline(pop_file, popline)) {
       vector<string> line_vector;
       line_vector = splitString(popline, '\t');
       try {
-         population_map[fasta_index++] = stoul(line_vector[1]);
+         sample_populations.push_back(stoul(line_vector[1]));
       } catch (const invalid_argument& e) {
          cerr << "Invalid population ID in second column of population TSV." << endl;
          cerr << "Must be a positive integer." << endl;
@@ -497,110 +1195,211 @@ int main(int argc, char **argv) {
    }
    pop_file.close();
    unsigned long num_populations = populations.size();
+   //A shard of the samples may not have every population, so its counts
+   // go up to the highest population number instead:
+   if (!counts_path.empty() && !populations.empty()) {
+      num_populations = *populations.rbegin();
+   }
+   //Populations are numbered from 1, and index the estimators:
+   if (!populations.empty() && (*populations.begin() < 1 || *populations.rbegin() > num_populations)) {
+      cerr << "Population IDs must be numbered from 1 to the number of populations (" << num_populations << ")." << endl;
+      return 9;
+   }
+   //Open the samples grouped by population:
+   PopulationLayout layout;
+   layout.group(sample_populations, num_populations);
+   vector<string> row_FASTA_paths(input_FASTA_paths.size());
+   for (unsigned long j = 0; j < input_FASTA_paths.size(); j++) {
+      row_FASTA_paths[layout.sample_rows[j]] = input_FASTA_paths[j];
+   }
    if (debug) {
       cerr << "Read in " << num_populations << " populations." << endl;
+      cerr << "Counting alleles with the " << simdLevelName(simdLevel()) << " kernels." << endl;
    }
-   //Output the header line:
-   if (!usable) {
-      cout << "Scaffold" << '\t' << "Position" << '\t' << "D_1,2" << '\t' << "omit_position";
-   } else {
-      cout << "Scaffold" << '\t' << "Position" << '\t' << "D_1,2" << '\t' << "site_weight";
-   }
-   for (unsigned long i = 1; i <= num_populations; i++) {
-      cout << '\t' << "pi_" << i;
+   if (!selection.resolve(num_populations)) {
+      return 9;
    }
-   for (unsigned long i = 1; i <= num_populations; i++) {
-      for (unsigned long j = i+1; j <= num_populations; j++) {
-         cout << '\t' << "D_" << i << ',' << j;
-         cout << '\t' << "Da_" << i << ',' << j;
-      }
+   if (debug) {
+      cerr << "Computing estimators for " << selection.pairs.size() << " pairs of populations." << endl;
    }
-   if (shared_poly) {
-      for (unsigned long i = 1; i <= num_populations; i++) {
-         for (unsigned long j = i+1; j <= num_populations; j++) {
-            cout << '\t' << "Shared_Poly_" << i << ',' << j;
-         }
-      }
+   //Output the header line, unless only counting alleles or checking inputs:
+   if (counts_path.empty() && !preflight) {
+      outputHeaderLine(selection, usable, window_size > 0);
    }
-   cout << endl;
+   //Sums of the estimators over each window:
+   StatisticWindows statistic_windows(max(window_size, 1UL), window_filter, selection.numColumns(), OMIT_COLUMN);
+   StatisticWindows *windows = window_size > 0 ? &statistic_windows : NULL;
    
    //Open the input FASTAs:
-   bool successfully_opened = openFASTAs(input_FASTAs, input_FASTA_paths);
+   PseudorefReader FASTA_reader;
+   FASTA_reader.useVCFReference(VCF_reference_path);
+   bool successfully_opened = FASTA_reader.open(row_FASTA_paths, use_mmap, decompression_threads);
    if (!successfully_opened) {
-      closeFASTAs(input_FASTAs);
+      FASTA_reader.close();
       cerr << "Unable to open at least one of the FASTAs provided." << endl;
       return 2;
    }
-   cerr << "Opened " << input_FASTAs.size() << " input FASTA files out of " << input_FASTA_paths.size() << " paths provided." << endl;
+   cerr << "Opened " << FASTA_reader.size() << " input FASTA files out of " << input_FASTA_paths.size() << " paths provided." << endl;
+   //Populations are assigned per line of the TSV, so each line has to be one sample:
+   if (FASTA_reader.size() != input_FASTA_paths.size()) {
+      FASTA_reader.close();
+      cerr << "Each line of the population TSV must be a single sample, so list the samples of a VCF or cohort store as VCF:sample or store:sample" << endl;
+      return 9;
+   }
+   //Only check that the inputs have the same scaffolds, then stop:
+   if (preflight) {
+      reader_status preflight_status = FASTA_reader.preflight(max(num_threads, thread::hardware_concurrency()), debug);
+      unsigned long num_inputs = FASTA_reader.size();
+      FASTA_reader.close();
+      if (preflight_status == READER_HEADERS_DIFFER) {
+         cerr << "Preflight failed: FASTAs are not synchronized, headers differ." << endl;
+         return 3;
+      } else if (preflight_status == READER_NOT_SYNCHRONIZED) {
+         cerr << "Preflight failed: FASTAs are not synchronized, scaffolds or lengths differ." << endl;
+         return 4;
+      } else if (preflight_status != READER_SEQUENCE) {
+         cerr << "Preflight failed: unable to read the scaffolds of every input." << endl;
+         return 5;
+      }
+      cerr << "Preflight passed: all " << num_inputs << " inputs have the same scaffolds in the same order with the same lengths." << endl;
+      return 0;
+   }
+
+   //Count alleles for a shard of the samples, where each sample adds 1
+   // allele per site if inbred, and 2 otherwise:
+   AlleleCountWriter allele_count_writer;
+   AlleleCountWriter *count_writer = NULL;
+   if (!counts_path.empty()) {
+      vector<uint64_t> allele_totals(num_populations, 0);
+      for (unsigned long p = 0; p < num_populations; p++) {
+         allele_totals[p] = layout.numSamples(p) * (inbred ? 1 : 2);
+      }
+      if (!allele_count_writer.open(counts_path, allele_totals, inbred ? 1 : 2)) {
+         FASTA_reader.close();
+         cerr << "Error opening allele count file " << counts_path << endl;
+         return 2;
+      }
+      count_writer = &allele_count_writer;
+      if (num_threads > 1 || compute_threads > 0) {
+         cerr << "Counting alleles reads the inputs in order on a single thread." << endl;
+         num_threads = 1;
+         compute_threads = 0;
+      }
+   }
+
+   //Only process the requested regions, in the order given:
+   if (!regions.empty()) {
+      int region_exit_code = processRegions(FASTA_reader, regions, layout, num_populations, selection, kernels, allele_draws, count_writer, windows);
+      FASTA_reader.close();
+      if (count_writer != NULL && !count_writer->close() && region_exit_code == 0) {
+         cerr << "Error writing allele count file " << counts_path << endl;
+         return 2;
+      }
+      return region_exit_code;
+   }
+
+   //With -L, alleles at het sites in inbred lines are drawn from one PRNG in
+   // site order:
+   if (compute_threads > 1 && inbred && legacy_prng) {
+      cerr << "Inbred mode draws alleles in site order, so using a single compute thread." << endl;
+      compute_threads = 1;
+   }
+   if (num_threads > 1) {
+      cerr << "Processing chunks of " << PARALLEL_CHUNK_SITES << " sites on " << num_threads << " threads." << endl;
+      int parallel_exit_code = processScaffoldsInParallel(FASTA_reader, num_threads, layout, num_populations, selection, kernels, inbred, allele_draws, debug, windows, window_size);
+      FASTA_reader.close();
+      return parallel_exit_code;
+   }
    
-   //Set up the vector to contain each line from the n FASTA files:
-   vector<string> FASTA_lines;
+   //Set up the memo of pi and Dxy:
+   EstimateMemo memo;
+
+   //Set up the vector to contain views of each line from the n FASTA files:
+   vector<SequenceView> FASTA_lines;
    FASTA_lines.reserve(input_FASTA_paths.size());
    
-   //Set up maps to memoize pi and Dxy:
-   unordered_map<string, double> memoized_pi;
-   unordered_map<string, double> memoized_dxy;
-
-   //Iterate over all of the FASTAs synchronously:
-   vector<string> FASTA_headers;
-   FASTA_headers.reserve(input_FASTA_paths.size());
-   vector<string> FASTA_sequences;
-   FASTA_sequences.reserve(input_FASTA_paths.size());
-   while (readFASTAs(input_FASTAs, FASTA_lines)) {
-      //Check if we're on a header line:
-      bool all_header_lines = 1;
-      bool any_header_lines = 0;
-      for (auto line_iterator = FASTA_lines.begin(); line_iterator != FASTA_lines.end(); ++line_iterator) {
-         all_header_lines = all_header_lines && ((*line_iterator)[0] == '>');
-         any_header_lines = any_header_lines || ((*line_iterator)[0] == '>');
-      }
-      if (all_header_lines) {
-         if (!FASTA_sequences.empty()) {
-            processScaffold(FASTA_headers, FASTA_sequences, population_map, num_populations, memoized_pi, memoized_dxy, shared_poly, inbred, debug, usable);
-            FASTA_sequences.clear();
+   reader_status row_status;
+   if (compute_threads > 0) {
+      //Read, compute, and write blocks of sites on separate threads, with a memo per compute thread:
+      vector<EstimateMemo> memos(compute_threads);
+      vector<AlleleDraws> worker_draws(compute_threads, allele_draws);
+      //Windows may span blocks, so each block's windows are kept until the
+      // writer appends them in order (each block starting from a copy of the
+      // empty windows, as the writer adds to statistic_windows meanwhile):
+      const StatisticWindows empty_windows = statistic_windows;
+      map<unsigned long, StatisticWindows> block_windows;
+      mutex block_windows_mutex;
+      row_status = runSitePipeline(FASTA_reader, FASTA_lines, compute_threads, queue_depth, [&](SiteBlock &block, unsigned int worker_index) {
+         ostringstream block_output;
+         StatisticWindows computed_windows = empty_windows;
+         kernels.process_scaffold(block.scaffold, block.rows, block.position_offset, layout, num_populations, memos[worker_index], selection, worker_draws[worker_index], block_output, windows != NULL ? &computed_windows : NULL);
+         block.output = block_output.str();
+         if (windows != NULL) {
+            lock_guard<mutex> block_windows_lock(block_windows_mutex);
+            block_windows[block.sequence] = move(computed_windows);
          }
-         FASTA_headers = FASTA_lines;
-         for (auto header_iterator = FASTA_headers.begin()+1; header_iterator != FASTA_headers.end(); ++header_iterator) {
-            if (*header_iterator != FASTA_headers[0]) {
-               cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
-               cerr << FASTA_headers[0] << endl;
-               cerr << *header_iterator << endl;
-               closeFASTAs(input_FASTAs);
-               return 3;
-            }
+      }, &cout, [](const string &scaffold_name) {
+         cerr << "Processing scaffold " << scaffold_name << endl;
+      }, 0, "", [&](SiteBlock &block) {
+         if (windows != NULL) {
+            unique_lock<mutex> block_windows_lock(block_windows_mutex);
+            auto block_iterator = block_windows.find(block.sequence);
+            StatisticWindows written_windows = move(block_iterator->second);
+            block_windows.erase(block_iterator);
+            block_windows_lock.unlock();
+            windows->append(written_windows);
+            windows->outputFinished(cout);
          }
-      } else if (any_header_lines) {
-         cerr << "Error: FASTAs are not synchronized, or not wrapped at the same length." << endl;
-         closeFASTAs(input_FASTAs);
-         return 4;
-      } else {
-         unsigned long sequence_index = 0;
-         for (auto line_iterator = FASTA_lines.begin(); line_iterator != FASTA_lines.end(); ++line_iterator) {
-            if (FASTA_sequences.size() < FASTA_lines.size()) {
-               FASTA_sequences.push_back(*line_iterator);
-            } else {
-               FASTA_sequences[sequence_index++] += *line_iterator;
+      });
+   } else {
+      //Iterate over all of the FASTAs synchronously, processing each row as it arrives:
+      string scaffold_name;
+      unsigned long scaffold_position = 0;
+      while ((row_status = FASTA_reader.readRow(FASTA_lines)) == READER_HEADER || row_status == READER_SEQUENCE) {
+         if (row_status == READER_HEADER) {
+            scaffold_name = FASTA_reader.scaffold();
+            scaffold_position = 0;
+            cerr << "Processing scaffold " << scaffold_name << endl;
+         } else if (count_writer != NULL) {
+            kernels.count_scaffold(scaffold_name, FASTA_lines, scaffold_position, layout, num_populations, allele_draws, *count_writer);
+            scaffold_position += FASTA_lines[0].length;
+         } else {
+            kernels.process_scaffold(scaffold_name, FASTA_lines, scaffold_position, layout, num_populations, memo, selection, allele_draws, cout, windows);
+            scaffold_position += FASTA_lines[0].length;
+            if (windows != NULL) {
+               windows->outputFinished(cout);
             }
          }
       }
    }
    
-   //Catch any IO errors that kicked us out of the while loop:
-   unsigned long which_input_FASTA = 0;
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      if ((*FASTA_iterator)->bad()) {
-         cerr << "Error reading input FASTA: " << input_FASTA_paths[which_input_FASTA] << endl;
-         cerr << "Fail bit: " << ((*FASTA_iterator)->rdstate() & ifstream::failbit) << " Bad bit: " << (*FASTA_iterator)->bad() << " EOF bit: " << (*FASTA_iterator)->eof() << endl;
-         closeFASTAs(input_FASTAs);
-         return 5;
-      }
-      which_input_FASTA++;
+   //Catch any synchronization or IO errors that kicked us out of the while loop:
+   if (row_status == READER_HEADERS_DIFFER) {
+      cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
+      cerr << string(FASTA_lines[0].bases, FASTA_lines[0].length) << endl;
+      cerr << string(FASTA_lines[FASTA_reader.failedInput()].bases, FASTA_lines[FASTA_reader.failedInput()].length) << endl;
+      FASTA_reader.close();
+      return 3;
+   } else if (row_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Error: FASTAs are not synchronized, scaffold " << FASTA_reader.scaffold() << " has a different length in " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      FASTA_reader.close();
+      return 4;
+   } else if (row_status == READER_IO_ERROR) {
+      cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      cerr << strerror(errno) << endl;
+      FASTA_reader.close();
+      return 5;
+   }
+   //Output the last window:
+   if (windows != NULL) {
+      windows->outputAll(cout);
    }
-   //If no errors kicked us out of the while loop, process the last scaffold:
-   processScaffold(FASTA_headers, FASTA_sequences, population_map, num_populations, memoized_pi, memoized_dxy, shared_poly, inbred, debug, usable);
-   
    //Close the input FASTAs:
-   closeFASTAs(input_FASTAs);
+   FASTA_reader.close();
+   if (count_writer != NULL && !count_writer->close()) {
+      cerr << "Error writing allele count file " << counts_path << endl;
+      return 2;
+   }
    
    return 0;
 }
@@ -7,6 +7,20 @@
  * Version 1.3 written 2018/08/09 (Fixed bug ignoring softmasked bases)     *
  * Version 1.4 written 2018/11/08 (Omit position may output weight instead) *
  * Version 1.5 written 2019/05/06 (Option to pass FOFN instead of pos args) *
+ * Version 1.6 written 2026/10/17 (Option to memory-map input FASTAs)       *
+ * Version 1.7 written 2026/10/17 (Parallel scaffolds using .fai indexes)   *
+ * Version 1.8 written 2026/10/17 (Read gzip and BGZF-compressed FASTAs)    *
+ * Version 1.9 written 2026/10/17 (FASTAs may be wrapped at any length)     *
+ * Version 1.10 written 2026/10/17 (Pipelined reading, compute, output)     *
+ * Version 1.11 written 2026/10/17 (Restrict to regions, --region/--bed)    *
+ * Version 1.12 written 2026/10/17 (Reference-delta cohort store input)     *
+ * Version 1.13 written 2026/10/17 (Read samples directly from a VCF)       *
+ * Version 1.14 written 2026/10/17 (Preflight check of input scaffolds)     *
+ * Version 1.15 written 2026/10/17 (Table-driven base decoding)             *
+ * Version 1.16 written 2026/10/17 (SIMD allele counting)                   *
+ * Version 1.17 written 2026/10/17 (Counter-based inbred allele draws)      *
+ * Version 1.18 written 2026/10/17 (Reuse output of uniform sites)          *
+ * Version 1.19 written 2026/10/17 (Site loops compiled for each option set)*
  *                                                                          *
  * Description:                                                             *
  *                                                                          *
@@ -20,6 +34,17 @@
 #include <getopt.h>
 #include <cctype>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <map>
+#include "pseudorefReader.h"
+#include "siteKernels.h"
+#include "simdKernels.h"
+#include "parallelScaffolds.h"
+#include "sitePipeline.h"
+#include "genomicRegions.h"
 
 //Define constants for getopt:
 #define no_argument 0
@@ -27,151 +52,92 @@
 #define optional_argument 2
 
 //Version:
-#define VERSION "1.5"
+#define VERSION "1.19"
 
 //Define number of bases:
 #define NUM_BASES 4
 
 //Usage/help:
-#define USAGE "calculatePolymorphism\nUsage:\n calculatePolymorphism [options] [list of pseudoreference FASTAs]\n Options:\n  --help,-h:\t\tOutput this documentation\n  --version,-v:\t\tOutput the version number\n  --fofn,-f:\t\tPass a file of filenames, rather than listing filenames\n  --segregating_sites,-s:\tOutput whether or not the site is segregating\n  --inbred,-i:\t\tAssume inbred input sequences\n  --prng_seed,-p:\t\tSet pseudo-random number generator seed for allele choice if -i is set\n  --usable_fraction,-u:\tFourth column represents fraction of unmasked bases\n  --debug,-d:\t\tOutput extra debugging info\n"
+#define USAGE "calculatePolymorphism\nUsage:\n calculatePolymorphism [options] [list of pseudoreference FASTAs]\n Options:\n  --help,-h:\t\tOutput this documentation\n  --version,-v:\t\tOutput the version number\n  --fofn,-f:\t\tPass a file of filenames, rather than listing filenames\n  --segregating_sites,-s:\tOutput whether or not the site is segregating\n  --inbred,-i:\t\tAssume inbred input sequences\n  --prng_seed,-p:\t\tSet pseudo-random number generator seed for allele choice if -i is set\n  --legacy_prng,-L:\tDraw alleles from rand() in site order if -i is set,\n\t\t\tas before version 1.17, instead of hashing the seed,\n\t\t\tscaffold, position, and sample\n  --usable_fraction,-u:\tFourth column represents fraction of unmasked bases\n  --mmap,-m:\t\tMemory-map input FASTAs instead of reading them in blocks\n  --threads,-t:\t\tProcess scaffolds on this many threads (default: 1)\n\t\t\tRequires a .fai index (samtools faidx) for each FASTA\n  --decompression_threads,-z:\tThreads for inflating BGZF FASTAs (default: 1)\n  --compute_threads,-c:\tRead, compute, and write on separate threads, with\n\t\t\tthis many compute threads (default: 0, no pipeline)\n  --queue_depth,-q:\tBlocks queued between pipeline stages (default: 4)\n  --region,-R:\t\tOnly process this region (scaffold:start-end, 1-based),\n\t\t\tmay be given more than once\n  --bed,-b:\t\tOnly process the regions in this BED file\n\t\t\tRegions require a .fai index for each FASTA\n  --vcf_reference,-V:\tReference FASTA (with a .fai) of any VCF inputs\n  --preflight,-P:\tOnly check that every input has the same scaffolds\n\t\t\tin the same order with the same lengths, using .fai\n\t\t\tfiles where possible, then exit\n  --debug,-d:\t\tOutput extra debugging info\n"
 
 using namespace std;
 
-bool openFASTAs(vector<ifstream*> &input_FASTAs, vector<string> input_FASTA_paths) {
-   for (auto path_iterator = input_FASTA_paths.begin(); path_iterator != input_FASTA_paths.end(); ++path_iterator) {
-      ifstream *input_FASTA = new ifstream(path_iterator->c_str(), ios::in);
-      if (!input_FASTA->is_open()) { //Check to make sure the input file was validly opened
-         cerr << "Error opening input FASTA: " << *path_iterator << "." << endl;
-         return 0;
-      }
-      input_FASTAs.push_back(input_FASTA);
-   }
-   return 1;
-}
-
-void closeFASTAs(vector<ifstream*> &input_FASTAs) {
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      (*FASTA_iterator)->close();
-      delete *FASTA_iterator;
-   }
-}
-
-bool readFASTAs(vector<ifstream*> &input_FASTAs, vector<string> &FASTA_lines) {
-   unsigned long which_input_FASTA = 0;
-   bool ifstream_notfail;
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      if ((*FASTA_iterator)->fail()) {
-         cerr << "Ifstream " << which_input_FASTA+1 << " failed." << endl;
-         return 0;
-      }
-      string FASTA_line;
-      ifstream_notfail = (bool)getline(**FASTA_iterator, FASTA_line);
-      if (!ifstream_notfail) {
-         return ifstream_notfail;
-      }
-      if (FASTA_lines.size() < input_FASTAs.size()) {
-         FASTA_lines.push_back(FASTA_line);
-      } else {
-         FASTA_lines[which_input_FASTA++] = FASTA_line;
-      }
-   }
-   return ifstream_notfail;
-}
-
-void processScaffold(vector<string> &FASTA_headers, vector<string> &FASTA_sequences, bool debug, bool segsites, bool inbred, bool usable) {
-   cerr << "Processing scaffold " << FASTA_headers[0].substr(1) << " of length " << FASTA_sequences[0].length() << endl;
-   //Do all the processing for this scaffold:
+//The options are template parameters, so each combination of them gets its
+// own loop without any tests of them at each site or sample:
+template <bool debug, bool segsites, bool inbred, bool usable>
+void processScaffold(const string &scaffold_name, vector<SequenceView> &FASTA_sequences, unsigned long position_offset, AlleleDraws &allele_draws, ostream &output) {
+   //Do all the processing for this row of the scaffold:
    //Polymorphism estimator: Given base frequencies at site:
    //\hat{\pi} = \(\frac{n}{n-1}\)\sum_{i=1}^{3}\sum_{j=i+1}^{4} 2\hat{p_{i}}\hat{p_{j}}
    //For biallelic sites, this reduces to the standard estimator: \(\frac{n}{n-1}\)2\hat{p}\hat{q}, since
    //p_{3} = p_{4} = 0
    unsigned long num_sequences = FASTA_sequences.size();
-   unsigned long scaffold_length = FASTA_sequences[0].length();
+   unsigned long scaffold_length = FASTA_sequences[0].length;
+   vector<unsigned long> all_samples(num_sequences);
+   for (unsigned long j = 0; j < num_sequences; j++) {
+      all_samples[j] = j;
+   }
+   BlockAlleleCounts block_counts; //Allele counts at the current block of sites
+   if (inbred) {
+      allele_draws.setScaffold(scaffold_name);
+   }
+   vector<char> gathered_site_bases;
+   const BaseDecode *decode = baseDecodeTable();
+   //At a site where every sample has the same byte (e.g. an invariant site,
+   // a site masked in every sample, or any site of a run of a cohort store
+   // where every sample matches the reference), the output only depends on
+   // that byte, so it is computed once per byte and reused:
+   bool shared_row = rowsShareBases(FASTA_sequences);
+   uint64_t uniform_sites = 0; //Mask of such sites in the current block
+   vector<char> uniform_site_bases;
+   map<char, string> uniform_site_outputs;
+   ostringstream uniform_site_output;
    for (unsigned long i = 0; i < scaffold_length; i++) {
+      if (i % TILE_SITES == 0) {
+         //Find the uniform sites of the next block whenever we reach its
+         // start, and count the rest of the block:
+         unsigned long num_sites = min((unsigned long)TILE_SITES, scaffold_length-i);
+         uniform_sites = shared_row ? blockSiteMask(num_sites) : uniformSites(FASTA_sequences, i, num_sites);
+         if (uniform_sites != blockSiteMask(num_sites)) {
+            countBlockAlleles(FASTA_sequences, all_samples, i, num_sites, block_counts);
+         }
+      }
+      const char *site_bases = NULL;
+      bool cache_site = 0;
+      bool uniform_site = (uniform_sites >> (i % TILE_SITES)) & 1;
+      if (uniform_site) {
+         char uniform_base = FASTA_sequences[0].bases[i];
+         auto cached_output = uniform_site_outputs.find(uniform_base);
+         if (cached_output != uniform_site_outputs.end()) {
+            output << scaffold_name << '\t' << position_offset+i+1 << cached_output->second;
+            continue;
+         }
+         //Alleles drawn at het sites in inbred mode differ between sites:
+         cache_site = !inbred || !isHetBase(uniform_base);
+         uniform_site_bases.assign(num_sequences, uniform_base);
+         site_bases = uniform_site_bases.data();
+      }
+      if (cache_site) {
+         uniform_site_output.str("");
+      }
+      ostream &site_output = cache_site ? uniform_site_output : output;
       double pi_hat = 0.0; //Accumulate the current polymorphism estimate in this variable
-      unsigned long base_frequency[5] = {0, 0, 0, 0, 0}; //Store the count of A, C, G, T, N for each base
-      for (unsigned long j = 0; j < num_sequences; j++) {
-         switch (FASTA_sequences[j][i]) {
-            case 'A':
-            case 'a':
-               base_frequency[0] += inbred ? 1 : 2;
-               break;
-            case 'C':
-            case 'c':
-               base_frequency[1] += inbred ? 1 : 2;
-               break;
-            case 'G':
-            case 'g':
-               base_frequency[2] += inbred ? 1 : 2;
-               break;
-            case 'K': //G/T het site
-            case 'k':
-               if (inbred) {
-                  base_frequency[rand() <= (RAND_MAX-1)/2 ? 2 : 3]++;
-               } else {
-                  base_frequency[2]++;
-                  base_frequency[3]++;
-               }
-               break;
-            case 'M': //A/C het site
-            case 'm':
-               if (inbred) {
-                  base_frequency[rand() <= (RAND_MAX-1)/2 ? 0 : 1]++;
-               } else {
-                  base_frequency[0]++;
-                  base_frequency[1]++;
-               }
-               break;
-            case 'R': //A/G het site
-            case 'r':
-               if (inbred) {
-                  base_frequency[rand() <= (RAND_MAX-1)/2 ? 0 : 2]++;
-               } else {
-                  base_frequency[0]++;
-                  base_frequency[2]++;
-               }
-               break;
-            case 'S': //C/G het site
-            case 's':
-               if (inbred) {
-                  base_frequency[rand() <= (RAND_MAX-1)/2 ? 1 : 2]++;
-               } else {
-                  base_frequency[1]++;
-                  base_frequency[2]++;
-               }
-               break;
-            case 'T':
-            case 't':
-               base_frequency[3] += inbred ? 1 : 2;
-               break;
-            case 'W': //A/T het site
-            case 'w':
-               if (inbred) {
-                  base_frequency[rand() <= (RAND_MAX-1)/2 ? 0 : 3]++;
-               } else {
-                  base_frequency[0]++;
-                  base_frequency[3]++;
-               }
-               break;
-            case 'Y': //C/T het site
-            case 'y':
-               if (inbred) {
-                  base_frequency[rand() <= (RAND_MAX-1)/2 ? 1 : 3]++;
-               } else {
-                  base_frequency[1]++;
-                  base_frequency[3]++;
-               }
-               break;
-            case 'N':
-            case 'n':
-               base_frequency[4] += inbred ? 1 : 2;
-               break;
-            case '-':
-               base_frequency[4] += inbred ? 1 : 2;
-               break;
-            default: //Assume that any case not handled here is an N
-               base_frequency[4] += inbred ? 1 : 2;
-               break;
+      unsigned long base_frequency[6] = {0, 0, 0, 0, 0, 0}; //Store the count of A, C, G, T, N (and non-N) for each base
+      //Inbred sites with hets are counted sample by sample, so their alleles
+      // are drawn in the same order as always:
+      if (uniform_site || !blockSiteAlleles(block_counts, num_sequences, i % TILE_SITES, inbred, base_frequency)) {
+         if (!uniform_site) {
+            gatherSite(FASTA_sequences, i, gathered_site_bases);
+            site_bases = gathered_site_bases.data();
+         }
+         for (unsigned long j = 0; j < num_sequences; j++) {
+            const BaseDecode &base_decode = decode[(unsigned char)site_bases[j]];
+            for (unsigned int b = 0; b < 5; b++) {
+               base_frequency[b] += base_decode.counts[inbred][b];
+            }
+            if (inbred && base_decode.het) { //Randomly choose one of the alleles
+               base_frequency[base_decode.het_alleles[allele_draws.next(position_offset+i, j)]]++;
+            }
          }
       }
       double p_hat[4];
@@ -185,41 +151,140 @@ void processScaffold(vector<string> &FASTA_headers, vector<string> &FASTA_sequen
          }
       }
       double usable_fraction = (double)nonN_bases/(double)(nonN_bases+base_frequency[4]);
+      output << scaffold_name << '\t' << position_offset+i+1;
       if (nonN_bases <= 1) { //The estimator doesn't work for n <= 1, so make sure this base gets ignored by the windowing script
          if (!usable) { // If we don't want to output the usable fraction, just output 1
-            cout << FASTA_headers[0].substr(1) << '\t' << i+1 << '\t' << "NA" << '\t' << 1 << endl;
+            site_output << '\t' << "NA" << '\t' << 1 << endl;
          } else {
-            cout << FASTA_headers[0].substr(1) << '\t' << i+1 << '\t' << "NA" << '\t' << usable_fraction << endl;
+            site_output << '\t' << "NA" << '\t' << usable_fraction << endl;
          }
       } else {
          if (segsites) {
             if (!usable) { // If we don't want to output the usable fraction, just output 1
-               cout << FASTA_headers[0].substr(1) << '\t' << i+1 << '\t' << (pi_hat > 0.0 ? 1 : 0) << '\t' << 0 << endl;
+               site_output << '\t' << (pi_hat > 0.0 ? 1 : 0) << '\t' << 0 << endl;
             } else {
-               cout << FASTA_headers[0].substr(1) << '\t' << i+1 << '\t' << (pi_hat > 0.0 ? 1 : 0) << '\t' << usable_fraction << endl;
+               site_output << '\t' << (pi_hat > 0.0 ? 1 : 0) << '\t' << usable_fraction << endl;
             }
          } else {
-            cout << FASTA_headers[0].substr(1) << '\t' << i+1 << '\t';
+            site_output << '\t';
             if (!usable) { // If we don't want to output the usable fraction, just output 1
-               cout << (double)nonN_bases/(double)(nonN_bases-1)*pi_hat << '\t' << 0;
+               site_output << (double)nonN_bases/(double)(nonN_bases-1)*pi_hat << '\t' << 0;
             } else {
-               cout << (double)nonN_bases/(double)(nonN_bases-1)*pi_hat << '\t' << usable_fraction;
+               site_output << (double)nonN_bases/(double)(nonN_bases-1)*pi_hat << '\t' << usable_fraction;
             }
             if (debug) {
-               cout << '\t' << nonN_bases << '\t' << pi_hat;
-               cout << '\t' << base_frequency[0] << '\t' << base_frequency[1] << '\t' << base_frequency[2];
-               cout << '\t' << base_frequency[3] << '\t' << base_frequency[4];
+               site_output << '\t' << nonN_bases << '\t' << pi_hat;
+               site_output << '\t' << base_frequency[0] << '\t' << base_frequency[1] << '\t' << base_frequency[2];
+               site_output << '\t' << base_frequency[3] << '\t' << base_frequency[4];
             }
-            cout << endl;
+            site_output << endl;
          }
       }
+      if (cache_site) {
+         string &cached_output = uniform_site_outputs[site_bases[0]];
+         cached_output = uniform_site_output.str();
+         output << cached_output;
+      }
+   }
+}
+
+typedef void (*ScaffoldProcessor)(const string &scaffold_name, vector<SequenceView> &FASTA_sequences, unsigned long position_offset, AlleleDraws &allele_draws, ostream &output);
+
+//Choose the processScaffold() for the given options, once at startup:
+ScaffoldProcessor selectScaffoldProcessor(bool debug, bool segsites, bool inbred, bool usable) {
+   //Indexed by debug + 2*segsites + 4*inbred + 8*usable:
+   static const ScaffoldProcessor instantiations[16] = {
+      processScaffold<0, 0, 0, 0>, processScaffold<1, 0, 0, 0>, processScaffold<0, 1, 0, 0>, processScaffold<1, 1, 0, 0>,
+      processScaffold<0, 0, 1, 0>, processScaffold<1, 0, 1, 0>, processScaffold<0, 1, 1, 0>, processScaffold<1, 1, 1, 0>,
+      processScaffold<0, 0, 0, 1>, processScaffold<1, 0, 0, 1>, processScaffold<0, 1, 0, 1>, processScaffold<1, 1, 0, 1>,
+      processScaffold<0, 0, 1, 1>, processScaffold<1, 0, 1, 1>, processScaffold<0, 1, 1, 1>, processScaffold<1, 1, 1, 1>
+   };
+   return instantiations[debug + 2*segsites + 4*inbred + 8*usable];
+}
+
+//Load the scaffold indexes of the input FASTAs, returning an exit code:
+int loadFASTAIndex(PseudorefReader &FASTA_reader) {
+   reader_status index_status = FASTA_reader.loadIndex();
+   if (index_status == READER_HEADERS_DIFFER) {
+      cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
+      cerr << FASTA_reader.scaffoldHeader(FASTA_reader.failedScaffold()) << endl;
+      cerr << FASTA_reader.scaffoldHeader(FASTA_reader.failedScaffold(), FASTA_reader.failedInput()) << endl;
+      return 3;
+   } else if (index_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Error: FASTAs are not synchronized, scaffolds differ in " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      return 4;
+   } else if (index_status == READER_IO_ERROR) {
+      return 5;
+   }
+   return 0;
+}
+
+//Process each scaffold on its own thread, seeking with the index of each input:
+//Inbred lines need counter-based allele draws, which are the same on any thread
+int processScaffoldsInParallel(PseudorefReader &FASTA_reader, unsigned int num_threads, ScaffoldProcessor process_scaffold, AlleleDraws &allele_draws) {
+   int index_exit_code = loadFASTAIndex(FASTA_reader);
+   if (index_exit_code != 0) {
+      return index_exit_code;
    }
+   OrderedOutput ordered_output(cout, FASTA_reader.numScaffolds());
+   return runParallelTasks(FASTA_reader.numScaffolds(), num_threads, [&](unsigned long scaffold_number, unsigned int thread_index) {
+      const string &scaffold_name = FASTA_reader.scaffoldHeader(scaffold_number);
+      {
+         lock_guard<mutex> message_lock(ordered_output.lock());
+         cerr << "Processing scaffold " << scaffold_name << endl;
+      }
+      AlleleDraws scaffold_draws = allele_draws;
+      ostringstream region_output;
+      string region_text;
+      if (FASTA_reader.readRange(scaffold_number, 0, FASTA_reader.scaffoldLength(scaffold_number), [&](vector<SequenceView> &FASTA_sites, uint64_t scaffold_position) {
+         process_scaffold(scaffold_name, FASTA_sites, scaffold_position, scaffold_draws, region_output);
+         region_text = region_output.str();
+         region_output.str("");
+         ordered_output.write(scaffold_number, region_text);
+      }) != READER_SEQUENCE) {
+         lock_guard<mutex> message_lock(ordered_output.lock());
+         cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+         cerr << strerror(errno) << endl;
+         return 5;
+      }
+      ordered_output.finish(scaffold_number);
+      return 0;
+   });
+}
+
+//Process only the given regions, seeking to each with the .fai indexes:
+int processRegions(PseudorefReader &FASTA_reader, vector<GenomicRegion> &regions, ScaffoldProcessor process_scaffold, AlleleDraws &allele_draws) {
+   int index_exit_code = loadFASTAIndex(FASTA_reader);
+   if (index_exit_code != 0) {
+      return index_exit_code;
+   }
+   for (auto region_iterator = regions.begin(); region_iterator != regions.end(); ++region_iterator) {
+      unsigned long scaffold_number;
+      if (!FASTA_reader.findScaffold(region_iterator->scaffold, scaffold_number)) {
+         cerr << "Error: Scaffold " << region_iterator->scaffold << " of region not found in the FASTAs" << endl;
+         return 6;
+      }
+      const string &scaffold_name = FASTA_reader.scaffoldHeader(scaffold_number);
+      uint64_t region_end = min(region_iterator->end, FASTA_reader.scaffoldLength(scaffold_number));
+      if (region_iterator->start >= region_end) {
+         cerr << "Skipping region beyond the end of scaffold " << scaffold_name << endl;
+         continue;
+      }
+      cerr << "Processing region " << scaffold_name << ":" << region_iterator->start+1 << "-" << region_end << endl;
+      if (FASTA_reader.readRange(scaffold_number, region_iterator->start, region_end, [&](vector<SequenceView> &FASTA_sites, uint64_t scaffold_position) {
+         process_scaffold(scaffold_name, FASTA_sites, scaffold_position, allele_draws, cout);
+      }) != READER_SEQUENCE) {
+         cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+         cerr << strerror(errno) << endl;
+         return 5;
+      }
+   }
+   return 0;
 }
 
 int main(int argc, char **argv) {
    //Variables for processing the FASTAs:
    vector<string> input_FASTA_paths;
-   vector<ifstream*> input_FASTAs;
    
    //Option for debugging:
    bool debug = 0;
@@ -231,8 +296,27 @@ int main(int argc, char **argv) {
    bool segsites = 0;
    //Seed for PRNG for choosing alleles at heterozygous sites in inbred strains:
    unsigned int prng_seed = 42;
+   //Draw alleles from rand() in site order, as before version 1.17:
+   bool legacy_prng = 0;
    //Option to output fraction of usable sites:
    bool usable = 0;
+   //Option to memory-map the input FASTAs:
+   bool use_mmap = 0;
+   //Number of threads to process scaffolds on:
+   unsigned int num_threads = 1;
+   //Number of threads to inflate BGZF-compressed FASTAs with:
+   unsigned int decompression_threads = 1;
+   //Number of compute workers for the reader/compute/writer pipeline (0 for no pipeline):
+   unsigned int compute_threads = 0;
+   //Number of blocks queued between pipeline stages:
+   unsigned long queue_depth = PIPELINE_QUEUE_DEPTH;
+   //Regions to restrict processing to (empty for the whole genome):
+   vector<GenomicRegion> regions;
+   GenomicRegion region;
+   //Reference FASTA that any VCF inputs were called against:
+   string VCF_reference_path = "";
+   //Option to only check the inputs against each other:
+   bool preflight = 0;
    
    //Variables for getopt_long:
    int optchar;
@@ -244,13 +328,23 @@ int main(int argc, char **argv) {
       {"segregating_sites", no_argument, 0, 's'},
       {"inbred", no_argument, 0, 'i'},
       {"prng_seed", required_argument, 0, 'p'},
+      {"legacy_prng", no_argument, 0, 'L'},
       {"usable_fraction", no_argument, 0, 'u'},
+      {"mmap", no_argument, 0, 'm'},
+      {"threads", required_argument, 0, 't'},
+      {"decompression_threads", required_argument, 0, 'z'},
+      {"compute_threads", required_argument, 0, 'c'},
+      {"queue_depth", required_argument, 0, 'q'},
+      {"region", required_argument, 0, 'R'},
+      {"bed", required_argument, 0, 'b'},
+      {"vcf_reference", required_argument, 0, 'V'},
+      {"preflight", no_argument, 0, 'P'},
       {"debug", no_argument, 0, 'd'},
       {"version", no_argument, 0, 'v'},
       {"help", no_argument, 0, 'h'}
    };
    //Read in the options:
-   while ((optchar = getopt_long(argc, argv, "f:sip:udvh", longoptions, &structindex)) > -1) {
+   while ((optchar = getopt_long(argc, argv, "f:sip:Lumt:z:c:q:R:b:V:Pdvh", longoptions, &structindex)) > -1) {
       switch(optchar) {
          case 'f':
             cerr << "Taking input from FOFN " << optarg << endl;
@@ -268,10 +362,56 @@ int main(int argc, char **argv) {
             cerr << "Using PRNG seed " << optarg << " for choosing alleles in inbred lines." << endl;
             prng_seed = atoi(optarg);
             break;
+         case 'L':
+            cerr << "Drawing alleles in inbred lines from rand() in site order." << endl;
+            legacy_prng = 1;
+            break;
          case 'u':
             cerr << "Outputting fraction of usable sites rather than omit column" << endl;
             usable = 1;
             break;
+         case 'm':
+            cerr << "Memory-mapping input FASTAs." << endl;
+            use_mmap = 1;
+            break;
+         case 't':
+            num_threads = atoi(optarg);
+            if (num_threads < 1) {
+               num_threads = 1;
+            }
+            break;
+         case 'z':
+            decompression_threads = atoi(optarg);
+            if (decompression_threads < 1) {
+               decompression_threads = 1;
+            }
+            break;
+         case 'c':
+            compute_threads = atoi(optarg);
+            break;
+         case 'q':
+            queue_depth = strtoul(optarg, NULL, 10);
+            break;
+         case 'R':
+            if (!parseRegion(optarg, region)) {
+               cerr << "Invalid region " << optarg << ", expected scaffold:start-end" << endl;
+               return 6;
+            }
+            regions.push_back(region);
+            break;
+         case 'b':
+            if (!readBEDRegions(optarg, regions)) {
+               cerr << "Error reading regions from BED file " << optarg << endl;
+               return 6;
+            }
+            break;
+         case 'V':
+            cerr << "Using reference FASTA " << optarg << " for VCF inputs" << endl;
+            VCF_reference_path = optarg;
+            break;
+         case 'P':
+            preflight = 1;
+            break;
          case 'd':
             cerr << "Debugging mode enabled." << endl;
             debug = 1;
@@ -327,83 +467,118 @@ int main(int argc, char **argv) {
    
    //Set the seed for the PRNG:
    srand(prng_seed);
+   //Alleles of hets in inbred lines are drawn by hashing the seed, scaffold,
+   // position, and sample, or from rand() in site order with -L:
+   AlleleDraws allele_draws = legacy_prng ? AlleleDraws() : AlleleDraws::counterBased(prng_seed);
+   //Pick the per-site loop for these options once, rather than testing
+   // them at every site:
+   ScaffoldProcessor process_scaffold = selectScaffoldProcessor(debug, segsites, inbred, usable);
    
    //Open the input FASTAs:
-   bool successfully_opened = openFASTAs(input_FASTAs, input_FASTA_paths);
+   PseudorefReader FASTA_reader;
+   FASTA_reader.useVCFReference(VCF_reference_path);
+   bool successfully_opened = FASTA_reader.open(input_FASTA_paths, use_mmap, decompression_threads);
    if (!successfully_opened) {
-      closeFASTAs(input_FASTAs);
+      FASTA_reader.close();
       return 2;
    }
-   cerr << "Opened " << input_FASTAs.size() << " input FASTA files." << endl;
-   
-   //Set up the vector to contain each line from the n FASTA files:
-   vector<string> FASTA_lines;
-   FASTA_lines.reserve(input_FASTA_paths.size());
-   
-   //Iterate over all of the FASTAs synchronously:
-   vector<string> FASTA_headers;
-   vector<string> FASTA_sequences;
-   while (readFASTAs(input_FASTAs, FASTA_lines)) {
-      //Check if we're on a header line:
-      bool all_header_lines = 1;
-      bool any_header_lines = 0;
-      for (auto line_iterator = FASTA_lines.begin(); line_iterator != FASTA_lines.end(); ++line_iterator) {
-         all_header_lines = all_header_lines && ((*line_iterator)[0] == '>');
-         any_header_lines = any_header_lines || ((*line_iterator)[0] == '>');
-      }
-      if (all_header_lines) {
-         if (debug) {
-            cerr << "Completed reading scaffold " << FASTA_lines[0].substr(1) << endl;
-         }
-         if (!FASTA_sequences.empty()) {
-            processScaffold(FASTA_headers, FASTA_sequences, debug, segsites, inbred, usable);
-            FASTA_sequences.clear();
-         }
-         FASTA_headers = FASTA_lines;
-         for (auto header_iterator = FASTA_headers.begin()+1; header_iterator != FASTA_headers.end(); ++header_iterator) {
-            if (*header_iterator != FASTA_headers[0]) {
-               cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
-               cerr << FASTA_headers[0] << endl;
-               cerr << *header_iterator << endl;
-               closeFASTAs(input_FASTAs);
-               return 3;
-            }
-         }
-      } else if (any_header_lines) {
-         cerr << "Error: FASTAs are not synchronized, or not wrapped at the same length." << endl;
-         closeFASTAs(input_FASTAs);
+   cerr << "Opened " << FASTA_reader.size() << " input FASTA files." << endl;
+   //Only check that the inputs have the same scaffolds, then stop:
+   if (preflight) {
+      reader_status preflight_status = FASTA_reader.preflight(max(num_threads, thread::hardware_concurrency()), debug);
+      unsigned long num_inputs = FASTA_reader.size();
+      FASTA_reader.close();
+      if (preflight_status == READER_HEADERS_DIFFER) {
+         cerr << "Preflight failed: FASTAs are not synchronized, headers differ." << endl;
+         return 3;
+      } else if (preflight_status == READER_NOT_SYNCHRONIZED) {
+         cerr << "Preflight failed: FASTAs are not synchronized, scaffolds or lengths differ." << endl;
          return 4;
-      } else {
-         if (debug) {
-            cerr << "Loading " << FASTA_lines.size() << " FASTA lines into sequences." << endl;
-         }
-         unsigned long sequence_index = 0;
-         for (auto line_iterator = FASTA_lines.begin(); line_iterator != FASTA_lines.end(); ++line_iterator) {
-            if (FASTA_sequences.size() < FASTA_lines.size()) {
-               FASTA_sequences.push_back(*line_iterator);
-            } else {
-               FASTA_sequences[sequence_index++] += *line_iterator;
-            }
-         }
+      } else if (preflight_status != READER_SEQUENCE) {
+         cerr << "Preflight failed: unable to read the scaffolds of every input." << endl;
+         return 5;
       }
+      cerr << "Preflight passed: all " << num_inputs << " inputs have the same scaffolds in the same order with the same lengths." << endl;
+      return 0;
+   }
+
+   //Only process the requested regions, in the order given:
+   if (!regions.empty()) {
+      int region_exit_code = processRegions(FASTA_reader, regions, process_scaffold, allele_draws);
+      FASTA_reader.close();
+      return region_exit_code;
    }
+
+   //With -L, alleles at het sites in inbred lines are drawn from one PRNG in
+   // site order:
+   if (num_threads > 1 && inbred && legacy_prng) {
+      cerr << "Inbred mode draws alleles in scaffold order, so running on a single thread." << endl;
+      num_threads = 1;
+   }
+   if (compute_threads > 1 && inbred && legacy_prng) {
+      cerr << "Inbred mode draws alleles in site order, so using a single compute thread." << endl;
+      compute_threads = 1;
+   }
+   if (debug) {
+      cerr << "Counting alleles with the " << simdLevelName(simdLevel()) << " kernels." << endl;
+   }
+   if (num_threads > 1) {
+      cerr << "Processing scaffolds on " << num_threads << " threads." << endl;
+      int parallel_exit_code = processScaffoldsInParallel(FASTA_reader, num_threads, process_scaffold, allele_draws);
+      FASTA_reader.close();
+      return parallel_exit_code;
+   }
+
+   //Set up the vector to contain views of each line from the n FASTA files:
+   vector<SequenceView> FASTA_lines;
+   FASTA_lines.reserve(input_FASTA_paths.size());
    
-   //Catch any IO errors that kicked us out of the while loop:
-   unsigned long which_input_FASTA = 0;
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      if ((*FASTA_iterator)->bad()) {
-         cerr << "Error reading input FASTA: " << input_FASTA_paths[which_input_FASTA] << endl;
-         cerr << "Fail bit: " << ((*FASTA_iterator)->rdstate() & ifstream::failbit) << " Bad bit: " << (*FASTA_iterator)->bad() << " EOF bit: " << (*FASTA_iterator)->eof() << endl;
-         closeFASTAs(input_FASTAs);
-         return 5;
+   reader_status row_status;
+   if (compute_threads > 0) {
+      //Read, compute, and write blocks of sites on separate threads:
+      vector<AlleleDraws> worker_draws(compute_threads, allele_draws);
+      row_status = runSitePipeline(FASTA_reader, FASTA_lines, compute_threads, queue_depth, [&](SiteBlock &block, unsigned int worker_index) {
+         ostringstream block_output;
+         process_scaffold(block.scaffold, block.rows, block.position_offset, worker_draws[worker_index], block_output);
+         block.output = block_output.str();
+      }, &cout, [](const string &scaffold_name) {
+         cerr << "Processing scaffold " << scaffold_name << endl;
+      });
+   } else {
+      //Iterate over all of the FASTAs synchronously, processing each row as it arrives:
+      string scaffold_name;
+      unsigned long scaffold_position = 0;
+      while ((row_status = FASTA_reader.readRow(FASTA_lines)) == READER_HEADER || row_status == READER_SEQUENCE) {
+         if (row_status == READER_HEADER) {
+            scaffold_name = FASTA_reader.scaffold();
+            scaffold_position = 0;
+            cerr << "Processing scaffold " << scaffold_name << endl;
+         } else {
+            process_scaffold(scaffold_name, FASTA_lines, scaffold_position, allele_draws, cout);
+            scaffold_position += FASTA_lines[0].length;
+         }
       }
-      which_input_FASTA++;
    }
-   //If no errors kicked us out of the while loop, process the last scaffold:
-   processScaffold(FASTA_headers, FASTA_sequences, debug, segsites, inbred, usable);
    
+   //Catch any synchronization or IO errors that kicked us out of the while loop:
+   if (row_status == READER_HEADERS_DIFFER) {
+      cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
+      cerr << string(FASTA_lines[0].bases, FASTA_lines[0].length) << endl;
+      cerr << string(FASTA_lines[FASTA_reader.failedInput()].bases, FASTA_lines[FASTA_reader.failedInput()].length) << endl;
+      FASTA_reader.close();
+      return 3;
+   } else if (row_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Error: FASTAs are not synchronized, scaffold " << FASTA_reader.scaffold() << " has a different length in " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      FASTA_reader.close();
+      return 4;
+   } else if (row_status == READER_IO_ERROR) {
+      cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      cerr << strerror(errno) << endl;
+      FASTA_reader.close();
+      return 5;
+   }
    //Close the input FASTAs:
-   closeFASTAs(input_FASTAs);
+   FASTA_reader.close();
    
    return 0;
 }
@@ -0,0 +1,235 @@
+/****************************************************************************
+ * cohortStore.h                                                            *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Definition of the reference-delta cohort store written by                *
+ *  buildCohortStore and read natively by PseudorefReader.                  *
+ * Pseudoreferences of a cohort are nearly identical to the reference they  *
+ *  were made from, so the store holds the reference once, and each sample  *
+ *  as a sorted list of runs of sites that differ from the reference, where *
+ *  every site of a run is the same base (e.g. a SNP, or a run of Ns).      *
+ * Sites are stored exactly as they appear in the FASTAs, including case.   *
+ * Each sample's runs on a scaffold are also indexed by bucket of           *
+ *  bucket_sites sites, so any range of sites of any sample can be read     *
+ *  with a few preads, and a range without any runs is just the reference.  *
+ *                                                                          *
+ * Layout (all integers are 64-bit little-endian):                          *
+ *  magic "PSCOHT\0\1", index offset                                        *
+ *  for each scaffold: the reference sites, then for each sample its runs   *
+ *   (start site, number of sites as 32 bits, base, 3 bytes of padding),    *
+ *   then its bucket table (number of buckets + 1 entries, entry b is the   *
+ *   index of the sample's first run that ends after site b*bucket_sites)   *
+ *  index: bucket_sites, number of samples, then for each sample:           *
+ *   name length, name                                                      *
+ *  number of scaffolds, then for each scaffold:                            *
+ *   header length, header (FASTA header without the >), number of sites,   *
+ *   offset of the reference sites, then for each sample:                   *
+ *   offset of its runs, number of runs, offset of its bucket table         *
+ ****************************************************************************/
+
+#ifndef COHORT_STORE_H
+#define COHORT_STORE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include "packedPseudoref.h"
+
+#define COHORT_MAGIC "PSCOHT\0\1"
+#define COHORT_MAGIC_LENGTH 8
+#define COHORT_HEADER_LENGTH 16
+
+//Default number of sites per bucket of the run index:
+#define COHORT_BUCKET_SITES 65536
+
+//Number of sites per row when reading a store sequentially:
+#define COHORT_ROW_SITES 65536
+
+//A run of sites of one sample that differ from the reference:
+struct CohortDelta {
+   uint64_t start;
+   uint32_t length;
+   char base;
+   char padding[3];
+};
+
+//Where one sample's runs on one scaffold are:
+struct CohortSampleScaffold {
+   uint64_t deltas_offset;
+   uint64_t num_deltas;
+   uint64_t buckets_offset;
+};
+
+//One entry of the scaffold index of a cohort store:
+struct CohortScaffold {
+   std::string header;
+   uint64_t length;
+   uint64_t reference_offset;
+   std::vector<CohortSampleScaffold> samples;
+};
+
+//Check whether an open file starts with the cohort store magic:
+inline bool isCohortStore(int fd) {
+   char magic[COHORT_MAGIC_LENGTH];
+   return preadFully(fd, magic, COHORT_MAGIC_LENGTH, 0) && memcmp(magic, COHORT_MAGIC, COHORT_MAGIC_LENGTH) == 0;
+}
+
+class CohortStore {
+   public:
+      CohortStore() : fd(-1), bucket_sites(COHORT_BUCKET_SITES), chunk_scaffold(0), chunk_start(0), chunk_length(0) {}
+      ~CohortStore() {
+         if (fd >= 0) {
+            ::close(fd);
+         }
+      }
+
+      //Open a store and read its index, returning 0 on failure:
+      bool open(const std::string &store_path) {
+         path = store_path;
+         fd = ::open(store_path.c_str(), O_RDONLY);
+         if (fd < 0 || !isCohortStore(fd)) {
+            return 0;
+         }
+         uint64_t index_offset, num_samples, num_scaffolds;
+         if (!preadFully(fd, &index_offset, 8, COHORT_MAGIC_LENGTH) || !preadFully(fd, &bucket_sites, 8, index_offset) || !preadFully(fd, &num_samples, 8, index_offset+8) || bucket_sites == 0) {
+            return 0;
+         }
+         uint64_t offset = index_offset + 16;
+         sample_names.resize(num_samples);
+         for (uint64_t j = 0; j < num_samples; j++) {
+            if (!readString(offset, sample_names[j])) {
+               return 0;
+            }
+         }
+         if (!preadFully(fd, &num_scaffolds, 8, offset)) {
+            return 0;
+         }
+         offset += 8;
+         scaffolds.resize(num_scaffolds);
+         for (uint64_t k = 0; k < num_scaffolds; k++) {
+            CohortScaffold &scaffold = scaffolds[k];
+            if (!readString(offset, scaffold.header) || !preadFully(fd, &scaffold.length, 8, offset) || !preadFully(fd, &scaffold.reference_offset, 8, offset+8)) {
+               return 0;
+            }
+            offset += 16;
+            scaffold.samples.resize(num_samples);
+            if (num_samples > 0 && !preadFully(fd, scaffold.samples.data(), num_samples*sizeof(CohortSampleScaffold), offset)) {
+               return 0;
+            }
+            offset += num_samples*sizeof(CohortSampleScaffold);
+         }
+         chunk.resize(COHORT_ROW_SITES);
+         return 1;
+      }
+
+      const std::string &storePath() const {
+         return path;
+      }
+      unsigned long numSamples() const {
+         return sample_names.size();
+      }
+      const std::string &sampleName(unsigned long sample) const {
+         return sample_names[sample];
+      }
+      const std::vector<CohortScaffold> &index() const {
+         return scaffolds;
+      }
+
+      //Read num_sites reference sites starting at first_site of a scaffold:
+      bool readReference(unsigned long scaffold_number, uint64_t first_site, unsigned long num_sites, char *destination) const {
+         return num_sites == 0 || preadFully(fd, destination, num_sites, scaffolds[scaffold_number].reference_offset + first_site);
+      }
+
+      //Fill in num_sites sites of a sample starting at first_site, given
+      // the reference sites of that range
+      //If no run of the sample overlaps the range, matches_reference is set
+      // and destination is left alone, so the caller can use the reference
+      //deltas is scratch space, so this may be called from several threads,
+      // each with its own
+      bool readSample(unsigned long scaffold_number, unsigned long sample, uint64_t first_site, unsigned long num_sites, const char *reference, std::vector<CohortDelta> &deltas, char *destination, bool &matches_reference) const {
+         matches_reference = 1;
+         const CohortSampleScaffold &sample_scaffold = scaffolds[scaffold_number].samples[sample];
+         if (num_sites == 0 || sample_scaffold.num_deltas == 0) {
+            return 1;
+         }
+         //Runs that can overlap the range are between the bucket entry of
+         // its first site and the bucket entry after its last site, plus the
+         // one run that may straddle the start of that next bucket:
+         uint64_t first_bucket = first_site / bucket_sites;
+         uint64_t end_bucket = (first_site + num_sites - 1) / bucket_sites + 1;
+         uint64_t first_delta, end_delta;
+         if (!preadFully(fd, &first_delta, 8, sample_scaffold.buckets_offset + first_bucket*8) || !preadFully(fd, &end_delta, 8, sample_scaffold.buckets_offset + end_bucket*8)) {
+            return 0;
+         }
+         end_delta = std::min(end_delta+1, sample_scaffold.num_deltas);
+         if (end_delta <= first_delta) {
+            return 1;
+         }
+         deltas.resize(end_delta - first_delta);
+         if (!preadFully(fd, deltas.data(), deltas.size()*sizeof(CohortDelta), sample_scaffold.deltas_offset + first_delta*sizeof(CohortDelta))) {
+            return 0;
+         }
+         uint64_t end_site = first_site + num_sites;
+         for (auto delta_iterator = deltas.begin(); delta_iterator != deltas.end(); ++delta_iterator) {
+            uint64_t delta_start = std::max(delta_iterator->start, first_site);
+            uint64_t delta_end = std::min(delta_iterator->start + delta_iterator->length, end_site);
+            if (delta_start >= delta_end) {
+               continue;
+            }
+            if (matches_reference) {
+               memcpy(destination, reference, num_sites);
+               matches_reference = 0;
+            }
+            memset(destination + (delta_start - first_site), delta_iterator->base, delta_end - delta_start);
+         }
+         return 1;
+      }
+
+      //Reference sites of the range being read sequentially, shared by
+      // every sample of the store, and only reread when the range changes:
+      const char *referenceChunk(unsigned long scaffold_number, uint64_t first_site, unsigned long num_sites) {
+         if (chunk_length != num_sites || chunk_scaffold != scaffold_number || chunk_start != first_site) {
+            if (!readReference(scaffold_number, first_site, num_sites, chunk.data())) {
+               chunk_length = 0;
+               return NULL;
+            }
+            chunk_scaffold = scaffold_number;
+            chunk_start = first_site;
+            chunk_length = num_sites;
+         }
+         return chunk.data();
+      }
+
+   private:
+      std::string path;
+      int fd;
+      uint64_t bucket_sites;
+      std::vector<std::string> sample_names;
+      std::vector<CohortScaffold> scaffolds;
+      std::vector<char> chunk;
+      unsigned long chunk_scaffold;
+      uint64_t chunk_start;
+      unsigned long chunk_length;
+
+      //Read a length-prefixed string at offset, advancing offset past it:
+      bool readString(uint64_t &offset, std::string &value) const {
+         uint64_t value_length;
+         if (!preadFully(fd, &value_length, 8, offset)) {
+            return 0;
+         }
+         value.resize(value_length);
+         if (value_length > 0 && !preadFully(fd, &value[0], value_length, offset+8)) {
+            return 0;
+         }
+         offset += 8 + value_length;
+         return 1;
+      }
+};
+
+#endif
@@ -0,0 +1,299 @@
+/****************************************************************************
+ * compressedInput.h                                                        *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Decompressing stream for gzipped FASTAs, used by PseudorefReader in      *
+ *  place of read() on inputs that start with the gzip magic number.        *
+ * Plain gzip (including concatenated members) is inflated serially.        *
+ * BGZF (as written by bgzip) is a series of independent gzip members of at *
+ *  most 64 KiB each, whose compressed sizes are in their headers, so a     *
+ *  batch of blocks is read at once and the blocks are inflated in          *
+ *  parallel, num_threads contiguous runs of blocks at a time.              *
+ * Works from non-seekable inputs (pipes and process substitutions) too.    *
+ ****************************************************************************/
+
+#ifndef COMPRESSED_INPUT_H
+#define COMPRESSED_INPUT_H
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <zlib.h>
+
+//Size of the gzip header of a BGZF block, and its largest block:
+#define BGZF_HEADER_LENGTH 18
+#define BGZF_MAX_BLOCK_SIZE 65536
+
+//Number of BGZF blocks inflated by each thread per batch:
+#define BGZF_BLOCKS_PER_THREAD 4
+
+//Size of the reads of compressed data for plain gzip:
+#define GZIP_READ_SIZE 262144
+
+//Check for the gzip magic number at the start of a buffer:
+inline bool isGzipMagic(const unsigned char *bytes, unsigned long length) {
+   return length >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b;
+}
+
+class CompressedInput {
+   public:
+      //prefix holds any bytes already read from fd (e.g. from a pipe
+      // while checking for the magic number)
+      CompressedInput(int input_fd, unsigned int threads, const unsigned char *prefix, unsigned long prefix_length) : fd(input_fd), num_threads(threads < 1 ? 1 : threads), raw_begin(0), raw_end(0), raw_eof(0), stream_open(0), stream_done(0), bgzf(0), output_begin(0), output_end(0), failed(0) {
+         raw.resize(std::max((unsigned long)GZIP_READ_SIZE, (unsigned long)num_threads*BGZF_BLOCKS_PER_THREAD*BGZF_MAX_BLOCK_SIZE));
+         if (prefix_length > 0) {
+            memcpy(raw.data(), prefix, prefix_length);
+            raw_end = prefix_length;
+         }
+         if (fillRaw(BGZF_HEADER_LENGTH)) {
+            bgzf = bgzfBlockSize(raw.data()+raw_begin) > 0;
+         }
+         if (!bgzf) {
+            memset(&stream, 0, sizeof(stream));
+            if (inflateInit2(&stream, 15+16) != Z_OK) { //Expect a gzip header
+               failed = 1;
+            } else {
+               stream_open = 1;
+            }
+         }
+      }
+      ~CompressedInput() {
+         if (stream_open) {
+            inflateEnd(&stream);
+         }
+      }
+
+      bool isBGZF() const {
+         return bgzf;
+      }
+
+      //Read up to length decompressed bytes into destination
+      //Returns the number of bytes read, 0 at the end of the input, or -1
+      // on a read or decompression error
+      ssize_t read(char *destination, unsigned long length) {
+         if (failed) {
+            errno = EIO;
+            return -1;
+         }
+         if (bgzf) {
+            while (output_begin == output_end) {
+               int batch_status = inflateBatch();
+               if (batch_status <= 0) {
+                  return batch_status;
+               }
+            }
+            unsigned long copy_length = std::min(length, output_end - output_begin);
+            memcpy(destination, output.data()+output_begin, copy_length);
+            output_begin += copy_length;
+            return copy_length;
+         }
+         return inflateStream(destination, length);
+      }
+
+   private:
+      int fd;
+      unsigned int num_threads;
+      //Compressed data read from fd but not yet inflated:
+      std::vector<unsigned char> raw;
+      unsigned long raw_begin;
+      unsigned long raw_end;
+      bool raw_eof;
+      //Plain gzip state:
+      z_stream stream;
+      bool stream_open;
+      bool stream_done;
+      //BGZF state, the inflated contents of the current batch:
+      bool bgzf;
+      std::vector<char> output;
+      unsigned long output_begin;
+      unsigned long output_end;
+      bool failed;
+
+      //Make sure at least min_bytes of compressed data are buffered,
+      // returning 0 if the input ends first
+      bool fillRaw(unsigned long min_bytes) {
+         if (raw_end - raw_begin >= min_bytes) {
+            return 1;
+         }
+         if (raw_begin > 0) {
+            memmove(raw.data(), raw.data()+raw_begin, raw_end-raw_begin);
+            raw_end -= raw_begin;
+            raw_begin = 0;
+         }
+         while (raw_end < min_bytes && !raw_eof) {
+            ssize_t bytes_read = ::read(fd, raw.data()+raw_end, raw.size()-raw_end);
+            if (bytes_read < 0) {
+               if (errno == EINTR) {
+                  continue;
+               }
+               failed = 1;
+               return 0;
+            } else if (bytes_read == 0) {
+               raw_eof = 1;
+            }
+            raw_end += bytes_read;
+         }
+         return raw_end >= min_bytes;
+      }
+
+      //Total size of the BGZF block starting at header, or 0 if it isn't one:
+      static unsigned long bgzfBlockSize(const unsigned char *header) {
+         if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4)) {
+            return 0;
+         }
+         unsigned long extra_length = header[10] | (header[11] << 8);
+         if (extra_length < 6 || header[12] != 'B' || header[13] != 'C' || header[14] != 2 || header[15] != 0) {
+            return 0;
+         }
+         return (header[16] | (header[17] << 8)) + 1;
+      }
+
+      //Inflate one raw deflate block of a BGZF member into destination,
+      // checking its CRC:
+      static bool inflateBGZFBlock(const unsigned char *block, unsigned long block_size, char *destination, unsigned long inflated_size) {
+         unsigned long extra_length = block[10] | (block[11] << 8);
+         unsigned long data_start = 12 + extra_length;
+         if (block_size < data_start + 8) {
+            return 0;
+         }
+         char empty_output; //zlib needs somewhere to point for empty blocks
+         if (inflated_size == 0) {
+            destination = &empty_output;
+         }
+         z_stream block_stream;
+         memset(&block_stream, 0, sizeof(block_stream));
+         if (inflateInit2(&block_stream, -15) != Z_OK) {
+            return 0;
+         }
+         block_stream.next_in = (Bytef *)block + data_start;
+         block_stream.avail_in = block_size - data_start - 8;
+         block_stream.next_out = (Bytef *)destination;
+         block_stream.avail_out = inflated_size;
+         int inflate_status = inflate(&block_stream, Z_FINISH);
+         bool complete = inflate_status == Z_STREAM_END && block_stream.total_out == inflated_size;
+         inflateEnd(&block_stream);
+         const unsigned char *trailer = block + block_size - 8;
+         unsigned long expected_crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned long)trailer[3] << 24);
+         return complete && crc32(0, (const Bytef *)destination, inflated_size) == expected_crc;
+      }
+
+      //Read and inflate the next batch of BGZF blocks into output
+      //Returns 1 if a batch was inflated, 0 at the end of the input, and -1
+      // on an error
+      int inflateBatch() {
+         //Find the blocks of the batch, reading more of the input as needed:
+         std::vector<unsigned long> block_starts, block_sizes, inflated_starts;
+         unsigned long batch_blocks = num_threads * BGZF_BLOCKS_PER_THREAD;
+         unsigned long batch_end = raw_begin;
+         unsigned long inflated_total = 0;
+         while (block_starts.size() < batch_blocks) {
+            unsigned long batch_offset = batch_end - raw_begin;
+            if (!fillRaw(batch_offset + BGZF_HEADER_LENGTH)) {
+               if (failed || raw_end > raw_begin + batch_offset) { //Truncated header
+                  failed = 1;
+                  errno = EIO;
+                  return -1;
+               }
+               batch_end = raw_begin + batch_offset; //fillRaw() may have moved the buffered data
+               break;
+            }
+            batch_end = raw_begin + batch_offset;
+            unsigned long block_size = bgzfBlockSize(raw.data()+batch_end);
+            if (block_size == 0 || !fillRaw(batch_offset + block_size)) {
+               failed = 1;
+               errno = EIO;
+               return -1;
+            }
+            batch_end = raw_begin + batch_offset;
+            const unsigned char *trailer = raw.data() + batch_end + block_size - 4;
+            unsigned long inflated_size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned long)trailer[3] << 24);
+            if (inflated_size > BGZF_MAX_BLOCK_SIZE) {
+               failed = 1;
+               errno = EIO;
+               return -1;
+            }
+            block_starts.push_back(batch_offset);
+            block_sizes.push_back(block_size);
+            inflated_starts.push_back(inflated_total);
+            inflated_total += inflated_size;
+            batch_end += block_size;
+         }
+         if (block_starts.empty()) {
+            return 0;
+         }
+         inflated_starts.push_back(inflated_total);
+         output.resize(std::max(output.size(), (size_t)inflated_total));
+         //Inflate contiguous runs of blocks on each thread:
+         const unsigned char *batch_data = raw.data() + raw_begin;
+         unsigned long num_blocks = block_starts.size();
+         unsigned int run_threads = std::min((unsigned long)num_threads, num_blocks);
+         std::vector<char> run_ok(run_threads, 1);
+         auto inflateRun = [&](unsigned int thread_index) {
+            for (unsigned long b = thread_index * num_blocks / run_threads; b < (thread_index+1) * num_blocks / run_threads; b++) {
+               if (!inflateBGZFBlock(batch_data + block_starts[b], block_sizes[b], output.data() + inflated_starts[b], inflated_starts[b+1] - inflated_starts[b])) {
+                  run_ok[thread_index] = 0;
+                  return;
+               }
+            }
+         };
+         std::vector<std::thread> threads;
+         for (unsigned int thread_index = 1; thread_index < run_threads; thread_index++) {
+            threads.push_back(std::thread(inflateRun, thread_index));
+         }
+         inflateRun(0);
+         for (auto thread_iterator = threads.begin(); thread_iterator != threads.end(); ++thread_iterator) {
+            thread_iterator->join();
+         }
+         for (unsigned int thread_index = 0; thread_index < run_threads; thread_index++) {
+            if (!run_ok[thread_index]) {
+               failed = 1;
+               errno = EIO;
+               return -1;
+            }
+         }
+         raw_begin = batch_end;
+         output_begin = 0;
+         output_end = inflated_total;
+         return 1;
+      }
+
+      //Inflate plain gzip, moving on to the next member at the end of each:
+      ssize_t inflateStream(char *destination, unsigned long length) {
+         stream.next_out = (Bytef *)destination;
+         stream.avail_out = length;
+         while (stream.avail_out == length && !stream_done) {
+            if (raw_end == raw_begin && !fillRaw(1)) {
+               if (failed) {
+                  errno = EIO;
+                  return -1;
+               }
+               if (stream.total_in > 0) { //Input ended partway through a member
+                  failed = 1;
+                  errno = EIO;
+                  return -1;
+               }
+               stream_done = 1;
+               break;
+            }
+            stream.next_in = raw.data() + raw_begin;
+            stream.avail_in = raw_end - raw_begin;
+            int inflate_status = inflate(&stream, Z_NO_FLUSH);
+            raw_begin = raw_end - stream.avail_in;
+            if (inflate_status == Z_STREAM_END) {
+               inflateReset(&stream); //total_in is zeroed until the next member starts
+            } else if (inflate_status != Z_OK && inflate_status != Z_BUF_ERROR) {
+               failed = 1;
+               errno = EIO;
+               return -1;
+            }
+         }
+         return length - stream.avail_out;
+      }
+};
+
+#endif
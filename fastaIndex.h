@@ -0,0 +1,122 @@
+/****************************************************************************
+ * fastaIndex.h                                                             *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Reader for samtools faidx-style .fai indexes, which give the length and  *
+ *  byte offset of each scaffold in a FASTA along with its line wrapping,   *
+ *  so that any site of a scaffold can be found with a single seek.         *
+ * Each line of a .fai is tab-separated: name, length, offset of the first  *
+ *  base, bases per line, bytes per line (including the line terminator).   *
+ * Also reads runs of sites and full header lines from an indexed FASTA     *
+ *  with pread(), so several threads can share one file descriptor.         *
+ ****************************************************************************/
+
+#ifndef FASTA_INDEX_H
+#define FASTA_INDEX_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include "packedPseudoref.h"
+
+//One line of a .fai:
+struct FastaIndexEntry {
+   std::string name;
+   uint64_t length;
+   uint64_t offset;
+   uint64_t line_bases;
+   uint64_t line_width;
+};
+
+//Read the .fai of a FASTA (i.e. FASTA_path+".fai"), returning 0 if it
+// could not be opened or is malformed:
+inline bool readFastaIndex(const std::string &FASTA_path, std::vector<FastaIndexEntry> &index) {
+   std::ifstream fai_file(FASTA_path + ".fai", std::ios::in);
+   if (!fai_file) {
+      return 0;
+   }
+   index.clear();
+   std::string fai_line;
+   while (getline(fai_file, fai_line)) {
+      if (fai_line.empty()) {
+         continue;
+      }
+      std::istringstream fai_fields(fai_line);
+      FastaIndexEntry entry;
+      if (!getline(fai_fields, entry.name, '\t') || !(fai_fields >> entry.length >> entry.offset >> entry.line_bases >> entry.line_width)) {
+         return 0;
+      }
+      //Scaffolds with sequence need a consistent wrapping:
+      if (entry.length > 0 && (entry.line_bases == 0 || entry.line_width < entry.line_bases)) {
+         return 0;
+      }
+      index.push_back(entry);
+   }
+   return 1;
+}
+
+//Byte offset of a site within a scaffold of an indexed FASTA:
+inline uint64_t fastaSiteOffset(const FastaIndexEntry &entry, uint64_t site) {
+   return entry.offset + (site / entry.line_bases) * entry.line_width + site % entry.line_bases;
+}
+
+//Read num_sites sites starting at first_site of an indexed scaffold into
+// buffer, with line terminators removed, returning 0 on a read error:
+inline bool readFastaSites(int fd, const FastaIndexEntry &entry, uint64_t first_site, unsigned long num_sites, std::string &buffer) {
+   if (num_sites == 0) {
+      buffer.clear();
+      return 1;
+   }
+   uint64_t byte_start = fastaSiteOffset(entry, first_site);
+   uint64_t byte_end = fastaSiteOffset(entry, first_site + num_sites - 1) + 1;
+   buffer.resize(byte_end - byte_start);
+   if (!preadFully(fd, &buffer[0], byte_end - byte_start, byte_start)) {
+      return 0;
+   }
+   //Squeeze out the line terminators in place:
+   unsigned long sites_copied = 0;
+   unsigned long read_position = 0;
+   unsigned long line_remaining = entry.line_bases - first_site % entry.line_bases;
+   while (sites_copied < num_sites) {
+      unsigned long copy_length = std::min((unsigned long)line_remaining, num_sites - sites_copied);
+      if (read_position != sites_copied) {
+         memmove(&buffer[sites_copied], &buffer[read_position], copy_length);
+      }
+      sites_copied += copy_length;
+      read_position += copy_length + (entry.line_width - entry.line_bases);
+      line_remaining = entry.line_bases;
+   }
+   buffer.resize(num_sites);
+   return 1;
+}
+
+//Find the header line (without the > or line terminator) ending just before
+// offset, since the .fai only keeps the first word of each header:
+inline bool readFastaHeaderBefore(int fd, uint64_t offset, std::string &header) {
+   unsigned long window = 4096;
+   while (true) {
+      uint64_t window_start = offset > window ? offset - window : 0;
+      std::string bytes(offset - window_start, '\0');
+      if (!preadFully(fd, &bytes[0], bytes.length(), window_start)) {
+         return 0;
+      }
+      size_t header_start = bytes.rfind('>');
+      if (header_start != std::string::npos) {
+         size_t header_end = bytes.find_first_of("\r\n", header_start);
+         header = bytes.substr(header_start+1, header_end == std::string::npos ? std::string::npos : header_end-header_start-1);
+         return 1;
+      }
+      if (window_start == 0) {
+         return 0;
+      }
+      window *= 4;
+   }
+}
+
+#endif
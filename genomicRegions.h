@@ -0,0 +1,101 @@
+/****************************************************************************
+ * genomicRegions.h                                                         *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Parsing of the regions given to --region and --bed, which restrict the   *
+ *  per-site tools to parts of the genome.                                  *
+ * Regions on the command line are samtools-style: scaffold, scaffold:start *
+ *  or scaffold:start-end, 1-based and inclusive, and commas in the numbers *
+ *  are ignored.  BED regions are 0-based and half-open, as usual.          *
+ * Either way, regions are stored 0-based and half-open.                    *
+ ****************************************************************************/
+
+#ifndef GENOMIC_REGIONS_H
+#define GENOMIC_REGIONS_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+
+//End of a region that runs to the end of its scaffold:
+#define REGION_TO_END UINT64_MAX
+
+struct GenomicRegion {
+   std::string scaffold;
+   uint64_t start;
+   uint64_t end;
+};
+
+//Parse a position, ignoring commas, returning 0 if it isn't a number:
+inline bool parseRegionPosition(const std::string &position_string, uint64_t &position) {
+   std::string digits;
+   for (auto character_iterator = position_string.begin(); character_iterator != position_string.end(); ++character_iterator) {
+      if (*character_iterator >= '0' && *character_iterator <= '9') {
+         digits += *character_iterator;
+      } else if (*character_iterator != ',') {
+         return 0;
+      }
+   }
+   if (digits.empty()) {
+      return 0;
+   }
+   position = strtoull(digits.c_str(), NULL, 10);
+   return 1;
+}
+
+//Parse a samtools-style region string, returning 0 if it is malformed:
+//If the text after the last : isn't a position or range, the whole string
+// is taken as the scaffold name, so names containing : still work
+inline bool parseRegion(const std::string &region_string, GenomicRegion &region) {
+   region.scaffold = region_string;
+   region.start = 0;
+   region.end = REGION_TO_END;
+   size_t colon_position = region_string.rfind(':');
+   if (colon_position == std::string::npos) {
+      return !region_string.empty();
+   }
+   std::string range = region_string.substr(colon_position+1);
+   size_t dash_position = range.find('-');
+   uint64_t first_position, last_position;
+   if (!parseRegionPosition(range.substr(0, dash_position), first_position) || first_position == 0) {
+      return !region_string.empty();
+   }
+   if (dash_position != std::string::npos) {
+      if (!parseRegionPosition(range.substr(dash_position+1), last_position) || last_position < first_position) {
+         return 0;
+      }
+      region.end = last_position;
+   }
+   region.scaffold = region_string.substr(0, colon_position);
+   region.start = first_position - 1;
+   return !region.scaffold.empty();
+}
+
+//Append the regions of a BED file, returning 0 if it can't be read or a
+// line is malformed (header, track, and comment lines are skipped):
+inline bool readBEDRegions(const std::string &BED_path, std::vector<GenomicRegion> &regions) {
+   std::ifstream BED_file(BED_path);
+   if (!BED_file) {
+      return 0;
+   }
+   std::string BED_line;
+   while (getline(BED_file, BED_line)) {
+      if (BED_line.empty() || BED_line[0] == '#' || BED_line.compare(0, 5, "track") == 0 || BED_line.compare(0, 7, "browser") == 0) {
+         continue;
+      }
+      std::istringstream BED_fields(BED_line);
+      GenomicRegion region;
+      if (!getline(BED_fields, region.scaffold, '\t') || !(BED_fields >> region.start >> region.end) || region.end < region.start) {
+         return 0;
+      }
+      regions.push_back(region);
+   }
+   return 1;
+}
+
+#endif
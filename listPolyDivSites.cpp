@@ -2,6 +2,12 @@
  * listPolyDivSites.cpp                                                     *
  * Written by Patrick Reilly                                                *
  * Version 1.0 written 2016/05/03                                           *
+ * Version 1.1 written 2026/10/17 (Packed pseudoreference input)            *
+ * Version 1.2 written 2026/10/17 (Inputs may be wrapped at any length)     *
+ * Version 1.3 written 2026/10/17 (Pipelined reading, compute, and output)  *
+ * Version 1.4 written 2026/10/17 (Restrict to regions with --region/--bed) *
+ * Version 1.5 written 2026/10/17 (Shared table-driven base decoding)       *
+ * Version 1.6 written 2026/10/17 (SIMD site classification)                *
  * Description:                                                             *
  *  Lists the differences between two IUPAC-degenerated diploid references  *
  *  either in terms of polymorphisms or divergent sites.  Sites with Ns are *
@@ -14,13 +20,24 @@
  *  -d:                    Only list divergent sites in query               *
  *  -n:                    Include a column that says if site is N in ref or*
  *                         query                                            *
+ *  -c:                    Number of compute threads for pipelined mode     *
+ *  -q:                    Blocks queued between pipeline stages            *
+ *  -R:                    Only list sites in this region (repeatable)      *
+ *  -b:                    Only list sites in the regions of this BED file  *
  ****************************************************************************/
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstdlib>
 #include <getopt.h>
 #include <cctype>
+#include <vector>
+#include <sstream>
+#include "pseudorefReader.h"
+#include "sitePipeline.h"
+#include "genomicRegions.h"
+#include "simdKernels.h"
 
 //Define constants for getopt:
 #define no_argument 0
@@ -28,22 +45,76 @@
 #define optional_argument 2
 
 //Version:
-#define version "1.0"
+#define version "1.6"
 
 //Usage/help:
-#define usage "listPolyDivSites\nUsage:\n listPolyDivSites [options] <reference FASTA> <query FASTA>\n Options:\n  --polymorphisms_only,-p\tOnly list polymorphic sites in query\n  --divergences_only,-d\t\tOnly list divergent sites in query\n  --list_n,-n\t\t\tInclude a column for if ref or query has an N\n\n Mandatory arguments:\n  reference FASTA\t\tPath to FASTA of reference diploid\n  query FASTA\t\t\tPath to FASTA of query diploid\n\n Description:\n  Lists the differences between two IUPAC-degenerated diploid references\n  either in terms of polymorphisms or divergent sites.\n  Sites with Ns do not count as polymorphism or divergence.\n"
+#define usage "listPolyDivSites\nUsage:\n listPolyDivSites [options] <reference FASTA> <query FASTA>\n Options:\n  --polymorphisms_only,-p\tOnly list polymorphic sites in query\n  --divergences_only,-d\t\tOnly list divergent sites in query\n  --list_n,-n\t\t\tInclude a column for if ref or query has an N\n  --compute_threads,-c\t\tRead, compare, and write on separate threads,\n\t\t\t\twith this many compute threads (default: 0)\n  --queue_depth,-q\t\tBlocks queued between pipeline stages (default: 4)\n  --region,-R\t\t\tOnly list sites in this region (scaffold:start-end,\n\t\t\t\t1-based), may be given more than once\n  --bed,-b\t\t\tOnly list sites in the regions of this BED file\n\t\t\t\tRegions require a .fai index for each FASTA\n\n Mandatory arguments:\n  reference FASTA\t\tPath to FASTA of reference diploid\n  query FASTA\t\t\tPath to FASTA of query diploid\n  Either may instead be a packed pseudoreference from packPseudoref\n  Line wrapping may differ between the two\n\n Description:\n  Lists the differences between two IUPAC-degenerated diploid references\n  either in terms of polymorphisms or divergent sites.\n  Sites with Ns do not count as polymorphism or divergence.\n"
 
 using namespace std;
 
+//List each site of a row as variant or not, numbering sites from site_position:
+void processRow(const string &scaffold_name, vector<SequenceView> &FASTA_lines, unsigned long int site_position, bool polymorphisms_only, bool divergences_only, bool list_Ns, ostream &output) {
+   unsigned long int reflength = FASTA_lines[0].length;
+   //Classify the whole row at once, ignoring case, and treating anything but
+   // a base or het code as N:
+   //Assumption:
+   //Reference does not contain degenerate bases
+   int mode = polymorphisms_only ? POLYDIV_POLYMORPHISMS : (divergences_only ? POLYDIV_DIVERGENCES : POLYDIV_ALL);
+   vector<unsigned char> site_classes(reflength);
+   classifyPolyDivSites(FASTA_lines[0].bases, FASTA_lines[1].bases, reflength, mode, site_classes.data());
+   for (unsigned long int i = 0; i < reflength; i++) {
+      //Masked sites are listed as not variant:
+      output << scaffold_name << '\t' << site_position << '\t' << (site_classes[i] == SITE_VARIANT ? "1" : "0");
+      if (list_Ns) {
+         output << '\t' << (site_classes[i] == SITE_MASKED ? "1" : "0");
+      }
+      output << '\n';
+      site_position++;
+   }
+}
+
+//List the sites of each region only, seeking to it with the .fai indexes:
+int processRegions(PseudorefReader &FASTA_reader, vector<GenomicRegion> &regions, bool polymorphisms_only, bool divergences_only, bool list_Ns) {
+   reader_status index_status = FASTA_reader.loadIndex();
+   if (index_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Reference and query FASTAs have different scaffolds or scaffold lengths." << endl;
+      return 5;
+   } else if (index_status != READER_SEQUENCE) {
+      return 3;
+   }
+   for (auto region_iterator = regions.begin(); region_iterator != regions.end(); ++region_iterator) {
+      unsigned long scaffold_number;
+      if (!FASTA_reader.findScaffold(region_iterator->scaffold, scaffold_number)) {
+         cerr << "Scaffold " << region_iterator->scaffold << " of region not found in the reference FASTA." << endl;
+         return 6;
+      }
+      const string &scaffold_name = FASTA_reader.scaffoldHeader(scaffold_number, 1);
+      uint64_t region_end = min(region_iterator->end, FASTA_reader.scaffoldLength(scaffold_number));
+      if (FASTA_reader.readRange(scaffold_number, region_iterator->start, region_end, [&](vector<SequenceView> &FASTA_sites, uint64_t site_position) {
+         processRow(scaffold_name, FASTA_sites, site_position+1, polymorphisms_only, divergences_only, list_Ns, cout);
+      }) != READER_SEQUENCE) {
+         cerr << "Error reading " << (FASTA_reader.failedInput() == 0 ? "reference" : "query") << " FASTA file." << endl;
+         return 3;
+      }
+   }
+   return 0;
+}
+
 int main(int argc, char **argv) {
    //Variables for processing the FASTAs:
    bool polymorphisms_only = 0;
    bool divergences_only = 0;
    bool list_Ns = 0;
    string reference_FASTA = "", query_FASTA = "";
-   string reference_line = "", query_line = "";
    string scaffold_name = "";
    unsigned long int scaffold_position = 1;
+   //Number of compute workers for the reader/compute/writer pipeline (0 for no pipeline):
+   unsigned int compute_threads = 0;
+   //Number of blocks queued between pipeline stages:
+   unsigned long queue_depth = PIPELINE_QUEUE_DEPTH;
+   //Regions to restrict the listing to (empty for the whole genome):
+   vector<GenomicRegion> regions;
+   GenomicRegion region;
 
    //Variables for getopt_long:
    int optchar;
@@ -55,10 +126,14 @@ int main(int argc, char **argv) {
       {"help", no_argument, 0, 'h'},
       {"polymorphism_only", no_argument, 0, 'p'},
       {"divergences_only", no_argument, 0, 'd'},
-      {"list_n", no_argument, 0, 'n'}
+      {"list_n", no_argument, 0, 'n'},
+      {"compute_threads", required_argument, 0, 'c'},
+      {"queue_depth", required_argument, 0, 'q'},
+      {"region", required_argument, 0, 'R'},
+      {"bed", required_argument, 0, 'b'}
    };
    //Read in the options:
-   while ((optchar = getopt_long(argc, argv, "pdnvh", longoptions, &structindex)) > -1) {
+   while ((optchar = getopt_long(argc, argv, "pdnc:q:R:b:vh", longoptions, &structindex)) > -1) {
       switch(optchar) {
          case 'v':
             cerr << "listPolyDivSites version " << version << endl;
@@ -77,6 +152,25 @@ int main(int argc, char **argv) {
          case 'n':
             list_Ns = 1;
             break;
+         case 'c':
+            compute_threads = atoi(optarg);
+            break;
+         case 'q':
+            queue_depth = strtoul(optarg, NULL, 10);
+            break;
+         case 'R':
+            if (!parseRegion(optarg, region)) {
+               cerr << "Invalid region " << optarg << ", expected scaffold:start-end" << endl;
+               return 6;
+            }
+            regions.push_back(region);
+            break;
+         case 'b':
+            if (!readBEDRegions(optarg, regions)) {
+               cerr << "Error reading regions from BED file " << optarg << endl;
+               return 6;
+            }
+            break;
          default:
             cerr << "Unknown option " << (unsigned char)optchar << " supplied." << endl;
             cerr << usage;
@@ -95,131 +189,67 @@ int main(int argc, char **argv) {
       cerr << "Ignoring extra positional arguments starting at " << argv[optind++] << endl;
    }
    
-   //Do some error checking on the arguments:
-   ifstream reference, query;
-   reference.open(reference_FASTA);
-   if (!reference) {
-      cerr << "Error opening reference FASTA file." << endl;
+   //Open the reference and query, which may be FASTAs or packed pseudoreferences:
+   vector<string> input_paths;
+   input_paths.push_back(reference_FASTA);
+   input_paths.push_back(query_FASTA);
+   PseudorefReader FASTA_reader;
+   FASTA_reader.checkHeaders(0); //Scaffold names are taken from the query
+   if (!FASTA_reader.open(input_paths)) {
       return 2;
    }
-   getline(reference, reference_line);
-   if (!reference) {
-      cerr << "Error reading reference FASTA file." << endl;
-      reference.close();
-      return 3;
-   }
-   if (reference_line[0] != '>') {
-      cerr << "Reference FASTA is not properly formatted FASTA: Does not start with >." << endl;
-      reference.close();
-      return 4;
-   }
-   reference_line = "";
-   reference.close();
-   query.open(query_FASTA);
-   if (!query) {
-      cerr << "Error opening query FASTA file." << endl;
-      return 2;
+   if (!regions.empty()) {
+      int region_exit_code = processRegions(FASTA_reader, regions, polymorphisms_only, divergences_only, list_Ns);
+      FASTA_reader.close();
+      return region_exit_code;
    }
-   getline(query, query_line);
-   if (!query) {
-      cerr << "Error reading query FASTA file." << endl;
-      query.close();
+   
+   //Do some error checking on the first line of each input:
+   vector<SequenceView> FASTA_lines;
+   reader_status row_status = FASTA_reader.readRow(FASTA_lines);
+   if (row_status == READER_IO_ERROR || row_status == READER_EOF) {
+      cerr << "Error reading " << (FASTA_reader.failedInput() == 0 ? "reference" : "query") << " FASTA file." << endl;
       return 3;
    }
-   if (query_line[0] != '>') {
-      cerr << "Query FASTA is not properly formatted FASTA: Does not start with >." << endl;
-      query.close();
+   if (row_status != READER_HEADER) {
+      if (FASTA_lines[0].length == 0 || FASTA_lines[0].bases[0] != '>') {
+         cerr << "Reference FASTA is not properly formatted FASTA: Does not start with >." << endl;
+      } else {
+         cerr << "Query FASTA is not properly formatted FASTA: Does not start with >." << endl;
+      }
       return 4;
    }
-
-   query_line = "";
-   query.close();
    
    //Now perform the main processing:
-   reference.open(reference_FASTA);
-   query.open(query_FASTA);
-   getline(reference, reference_line);
-   getline(query, query_line);
-   while (reference && query) {
-      if (reference_line.length() == 0 || query_line.length() == 0) {
-         break;
-      }
-      if (reference_line[0] != '>' && query_line[0] != '>') {
-         if (reference_line.length() != query_line.length()) {
-            cerr << "Reference and query FASTAs do not wrap at same line length." << endl;
-            reference.close();
-            query.close();
-            return 5;
-         }
-         unsigned long int reflength = reference_line.length();
-         for (unsigned long int i = 0; i < reflength; i++) {
-            //Ignore case:
-            int refbase = toupper(reference_line[i]);
-            int querybase = toupper(query_line[i]);
-            //Assumption:
-            //Reference does not contain degenerate bases
-            
-            if (refbase == 'N' || querybase == 'N') { //List masked sites as not variant
-               if (list_Ns) {
-                  cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << '\t' << "1" << endl;
-               } else {
-                  cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << endl;
-               }
-            } else if (polymorphisms_only) { //If the polymorphisms_only flag is set, only list query polymorphisms as variant
-               if (refbase != querybase && querybase != 'A' && querybase != 'C' && querybase != 'G' && querybase != 'T') {
-                  if (list_Ns) {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "1" << '\t' << "0" << endl;
-                  } else {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "1" << endl;
-                  }
-               } else { //List invariant sites as not variant
-                  if (list_Ns) {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << '\t' << "0" << endl;
-                  } else {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << endl;
-                  }
-               }
-            } else if (divergences_only) { //If the divergences_only flag is set, only list query divergent sites as variant
-               if (refbase != querybase && (querybase == 'A' || querybase == 'C' || querybase == 'G' || querybase == 'T')) {
-                  if (list_Ns) {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "1" << '\t' << "0" << endl;
-                  } else {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "1" << endl;
-                  }
-               } else { //List invariant sites as not variant
-                  if (list_Ns) {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << '\t' << "0" << endl;
-                  } else {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << endl;
-                  }
-               }
-            } else { //Else list all sites where query base != ref base as variant
-               if (refbase != querybase) {
-                  if (list_Ns) {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "1" << '\t' << "0" << endl;
-                  } else {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "1" << endl;
-                  }
-               } else { //List invariant sites as not variant
-                  if (list_Ns) {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << '\t' << "0" << endl;
-                  } else {
-                     cout << scaffold_name << '\t' << scaffold_position << '\t' << "0" << endl;
-                  }
-               }
-            }
-            scaffold_position++;
+   if (compute_threads > 0) {
+      //Read, compare, and write blocks of sites on separate threads:
+      scaffold_name.assign(FASTA_lines[1].bases+1, FASTA_lines[1].length-1);
+      row_status = runSitePipeline(FASTA_reader, FASTA_lines, compute_threads, queue_depth, [&](SiteBlock &block, unsigned int worker_index) {
+         ostringstream block_output;
+         processRow(block.scaffold, block.rows, block.position_offset+1, polymorphisms_only, divergences_only, list_Ns, block_output);
+         block.output = block_output.str();
+      }, &cout, NULL, 1, scaffold_name);
+   } else {
+      while (row_status == READER_HEADER || row_status == READER_SEQUENCE) {
+         if (row_status == READER_SEQUENCE) {
+            processRow(scaffold_name, FASTA_lines, scaffold_position, polymorphisms_only, divergences_only, list_Ns, cout);
+            scaffold_position += FASTA_lines[0].length;
+         } else {
+            //Get the scaffold name from the FASTA header line:
+            scaffold_name.assign(FASTA_lines[1].bases+1, FASTA_lines[1].length-1);
+            scaffold_position = 1;
          }
-      } else {
-         //Get the scaffold name from the FASTA header line:
-         scaffold_name = query_line.substr(1,string::npos);
-         scaffold_position = 1;
+         row_status = FASTA_reader.readRow(FASTA_lines);
       }
-      getline(reference, reference_line);
-      getline(query, query_line);
    }
-   reference.close();
-   query.close();
+   if (row_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Reference and query FASTAs have different lengths for scaffold " << scaffold_name << "." << endl;
+      return 5;
+   } else if (row_status == READER_IO_ERROR) {
+      cerr << "Error reading " << (FASTA_reader.failedInput() == 0 ? "reference" : "query") << " FASTA file." << endl;
+      return 3;
+   }
+   FASTA_reader.close();
    
    return 0;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
  * Version 1.2 written 2018/08/22 Bugfix for header and nonzero omitted stat*
  *   as well as handling a custom statistic column                          *
  * Version 1.3 written 2018/11/08 Filter or use non-N fraction as weight    *
+ * Version 1.4 written 2026/10/17 Exact window sums, partial windows of     *
+ *   shards and merging them                                                *
  * Description:                                                             *
  *  Calculates the mean of a statistic over non-overlapping windows of      *
  *  user-defined length, and can adjust the denominator of the mean based   *
@@ -17,6 +19,11 @@
  *  identified as scaffold, position, and statistic, respectively.          *
  *  If the scaffold length is not an integral multiple of the window size,  *
  *  the final window's mean is scaled according to its size.                *
+ *  Sites are placed in windows by their position, and each window's sums   *
+ *  are kept exactly, so a genome split into shards by scaffold or by       *
+ *  coordinates can be windowed shard by shard with -p, which outputs each  *
+ *  window's partial sums instead of its mean, and the shards' partial      *
+ *  windows merged with -m, giving exactly the output of a single run.      *
  *                                                                          *
  * Syntax: nonOverlappingWindows [options]                                  *
  *  -i:     Path to the input TSV of per-scaffold per-site statistics       *
@@ -30,6 +37,9 @@
  *          (default: 3, cannot be 1 or 4)                                  *
  *  -f:     Minimum non-N fraction to include in average                    *
  *  -a:     Calculate weighted average using non-N fraction as weight       *
+ *  -p:     Output partial window sums for merging, rather than means       *
+ *  -m:     Merge the partial windows of shards (given in genome order as   *
+ *          positional arguments, or concatenated on -i or STDIN)           *
  ****************************************************************************/
 
 #include <iostream>
@@ -41,6 +51,8 @@
 #include <vector>
 #include <sstream>
 #include <stdexcept>
+#include <set>
+#include "windowSums.h"
 
 //Define constants for getopt:
 #define no_argument 0
@@ -48,10 +60,10 @@
 #define optional_argument 2
 
 //Version:
-#define version "1.3"
+#define version "1.4"
 
 //Usage/help:
-#define usage "nonOverlappingWindows\nUsage:\n nonOverlappingWindows [options]\n Options:\n  --input_tsv,-i\tPath to input TSV (default: STDIN)\n  --output_tsv,-o\tPath to output TSV (default: STDOUT)\n  --omit_n,-n\t\tOmit sites indicated in the filter (4th) column\n  --window_size,-w\tSize of the non-overlapping windows\n  --usable_fraction,-u\tOutput the fraction of usable sites in\n\t\t\teach window as column 4\n  --stat_column,-s\tUse this column as the statistic to summarize\n\t\t(default: 3, cannot be 1 or 4)\n  --infimum_nonN,-f\tInfimum fraction of non-Ns to include in average\n\t\t(i.e. include sites with non-N fraction > this value)\n\t\tAssumes column 4 is fraction of non-N bases at site\n  --weighted_average,-a\tCalculate weighted average based on non-N fraction\n\t\tAssumes column 4 is the fraction of non-N bases at the site\n\n Description:\n  Calculates the mean of a statistic over non-overlapping windows\n  across scaffolds in a genome. Sites may be omitted from the average.\n  Input is a 3- or 4-column TSV consisting of scaffold name,\n  position, statistic, and a filter column.\n  If the filter column is 1 and -n is set, the row is omitted from the average.\n  If the fourth column is the fraction of non-N bases,\n  sites may be omitted based on an infimum filter (-f),\n  or a weighted average may be calculated (-a).\n  If the scaffold length is not an integral multiple of the window size,\n  the last window's average is scaled appropriately.\n"
+#define usage "nonOverlappingWindows\nUsage:\n nonOverlappingWindows [options]\n Options:\n  --input_tsv,-i\tPath to input TSV (default: STDIN)\n  --output_tsv,-o\tPath to output TSV (default: STDOUT)\n  --omit_n,-n\t\tOmit sites indicated in the filter (4th) column\n  --window_size,-w\tSize of the non-overlapping windows\n  --usable_fraction,-u\tOutput the fraction of usable sites in\n\t\t\teach window as column 4\n  --stat_column,-s\tUse this column as the statistic to summarize\n\t\t(default: 3, cannot be 1 or 4)\n  --infimum_nonN,-f\tInfimum fraction of non-Ns to include in average\n\t\t(i.e. include sites with non-N fraction > this value)\n\t\tAssumes column 4 is fraction of non-N bases at site\n  --weighted_average,-a\tCalculate weighted average based on non-N fraction\n\t\tAssumes column 4 is the fraction of non-N bases at the site\n  --partial,-p\t\tOutput each window's partial sums instead of its mean,\n\t\tfor merging shards of the genome with -m\n  --merge,-m\t\tMerge the partial windows of shards, given in genome\n\t\torder as positional arguments (or concatenated on -i)\n\n Description:\n  Calculates the mean of a statistic over non-overlapping windows\n  across scaffolds in a genome. Sites may be omitted from the average.\n  Input is a 3- or 4-column TSV consisting of scaffold name,\n  position, statistic, and a filter column.\n  If the filter column is 1 and -n is set, the row is omitted from the average.\n  If the fourth column is the fraction of non-N bases,\n  sites may be omitted based on an infimum filter (-f),\n  or a weighted average may be calculated (-a).\n  If the scaffold length is not an integral multiple of the window size,\n  the last window's average is scaled appropriately.\n  Sites are placed in windows by their position (column 2).\n"
 
 using namespace std;
 
@@ -65,92 +77,140 @@ vector<string> splitString(string line_to_split, char delimiter) {
    return line_vector;
 }
 
-string calcDepths(vector<double> &statistics, string scaffold, unsigned long window_size, vector<double> &N_list, bool usable_fraction, unsigned char nonN_weight, double infimum_nonN, bool debug) {
-   string output = "";
-   if (statistics.size() == 0) { //Fast skip for size 0 scaffolds
-      return output;
+//Partial sums of one window:
+struct WindowSums {
+   unsigned long start; //Position of the first site of the window
+   unsigned long sites; //Number of sites in the window so far
+   ExactSum sum;
+   ExactSum denominator;
+};
+
+//Output a window as its mean (and optionally the fraction of usable sites),
+// or as its partial sums for merging:
+//If the scaffold does not contain an integral number of windows, its last
+// window's length is the number of sites in it
+void outputWindow(ostream &output, const string &scaffold, WindowSums &window, unsigned long window_size, bool filtered, bool last_window, bool usable_fraction, bool partial) {
+   if (partial) {
+      output << scaffold << '\t' << window.start << '\t' << window.sites << '\t' << window.sum.terms() << '\t' << window.denominator.terms() << '\n';
+      return;
    }
-   if (N_list.size() > 0 && N_list.size() != statistics.size()) { //Something weird happened, we shouldn't ever see this
-      throw runtime_error("Somehow there aren't as many weights as statistics for scaffold" + scaffold + ", bugging out.");
+   double window_length = last_window ? (double)window.sites : (double)window_size;
+   //No adjustments to denominator if not filtering:
+   double denominator = filtered ? window.denominator.value() : window_length;
+   output << scaffold << '\t' << window.start << '\t';
+   if (denominator > 0.0) { //Avoid dividing by zero
+      output << to_string(window.sum.value()/denominator);
+   } else {
+      output << "NA";
    }
-   if (debug) {
-      cerr << "Processing scaffold " << scaffold << " with omit list of size " << N_list.size() << " and statistic list of size " << statistics.size() << endl;
-      if (N_list.size() > 0) {
-         if (nonN_weight == 0) {
-            cerr << "Omitting sites based on column 4" << endl;
-         } else if (nonN_weight == 1) {
-            cerr << "Filtering sites unless column 4 >= " << infimum_nonN << endl;
-         } else {
-            cerr << "Performing weighted average based on column 4" << endl;
-         }
-      } else {
-         cerr << "Nothing in column 4, so performing naive average" << endl;
-      }
+   if (usable_fraction) {
+      output << '\t' << to_string(denominator/window_length);
    }
-   double sum = 0.0;
-   unsigned long window_start = 1;
-   unsigned long last_window;
-   double denominator = 0.0;
-   unsigned long current_position = 1;
-   for (auto stat_iterator = statistics.begin(); stat_iterator != statistics.end(); ++stat_iterator) {
-      if (current_position % window_size == 1) {
-         window_start = current_position;
-         output += scaffold + '\t' + to_string(current_position) + '\t';
+   output << '\n';
+}
+
+//Merge the partial windows of shards of the genome into their means (or
+// into partial windows again, if partial is set):
+//Shards are read in the order given (or from one concatenated stream), so
+// each window's pieces must be adjacent, which they are if the shards are
+// given in genome order
+int mergePartialWindows(const vector<string> &partial_paths, istream &default_input, ostream &output, bool usable_fraction, bool partial, bool debug) {
+   unsigned long window_size = 0;
+   bool filtered = 0;
+   bool header_seen = 0;
+   string previous_scaffold = "";
+   set<string> finished_scaffolds;
+   WindowSums window;
+   bool window_open = 0;
+   unsigned long num_inputs = partial_paths.empty() ? 1 : partial_paths.size();
+   for (unsigned long f = 0; f < num_inputs; f++) {
+      ifstream partial_file;
+      string partial_path = partial_paths.empty() ? "input" : partial_paths[f];
+      if (!partial_paths.empty()) {
+         partial_file.open(partial_path);
+         if (!partial_file) {
+            cerr << "Error opening partial windows " << partial_path << endl;
+            return 2;
+         }
+         if (debug) {
+            cerr << "Merging partial windows from " << partial_path << endl;
+         }
       }
-      //We either call with empty N_list (to not omit any sites), or N_list.size() == statistics.size()
-      if (N_list.size() > 0) {
-         if (nonN_weight == 0) {
-            denominator += 1.0 - N_list[current_position-1]; //Increment the denominator if omit was 0
-            if (N_list[current_position-1] == 0.0) { //If we don't skip this site, add it to the sum
-               sum += *stat_iterator;
+      istream &partial_input = partial_paths.empty() ? default_input : partial_file;
+      string input_line;
+      while (getline(partial_input, input_line)) {
+         if (input_line.empty()) {
+            continue;
+         }
+         vector<string> line_vector = splitString(input_line, '\t');
+         //Every shard starts with the window size and whether it was filtered:
+         if (line_vector[0] == "#partial_windows") {
+            unsigned long shard_window_size = line_vector.size() == 3 ? atol(line_vector[1].c_str()) : 0;
+            bool shard_filtered = line_vector.size() == 3 && line_vector[2] == "1";
+            if (shard_window_size == 0) {
+               cerr << "Malformatted partial windows header in " << partial_path << endl;
+               return 4;
             }
-         } else if (nonN_weight == 1) { //Only include the site if the fraction of non-N bases is high enough, don't include NAs
-            if (N_list[current_position-1] > infimum_nonN) {
-               sum += *stat_iterator;
-               denominator += 1.0;
+            if (!header_seen) {
+               window_size = shard_window_size;
+               filtered = shard_filtered;
+               header_seen = 1;
+               if (partial) {
+                  output << "#partial_windows\t" << window_size << '\t' << filtered << '\n';
+               }
+            } else if (shard_window_size != window_size || shard_filtered != filtered) {
+               cerr << "Partial windows in " << partial_path << " were made with a different window size or filtering than the first shard." << endl;
+               return 9;
             }
-         } else { //Weight the statistic by the fraction of non-N bases for that site
-            sum += *stat_iterator * N_list[current_position-1];
-            denominator += N_list[current_position-1];
+            continue;
          }
-      } else {
-         sum += *stat_iterator;
-      }
-      if (current_position % window_size == 0) {
-         if (N_list.size() == 0) { //No adjustments to denominator if no N_list provided
-            denominator = (double)window_size;
+         if (!header_seen) {
+            cerr << partial_path << " is not a partial windows file from nonOverlappingWindows -p." << endl;
+            return 4;
          }
-         if (denominator > 0.0) { //Avoid dividing by zero
-            output += to_string(sum/denominator);
-         } else {
-            output += "NA";
+         unsigned long window_start = 0, window_sites = 0;
+         if (line_vector.size() == 5) {
+            window_start = atol(line_vector[1].c_str());
+            window_sites = atol(line_vector[2].c_str());
+         }
+         if (window_start == 0 || window_sites == 0) {
+            cerr << "Malformatted partial window in " << partial_path << ": " << input_line << endl;
+            return 4;
+         }
+         string scaffold_name = line_vector[0];
+         //Output the previous window once all of its pieces are in:
+         if (window_open && (scaffold_name != previous_scaffold || window_start != window.start)) {
+            if ((scaffold_name == previous_scaffold && window_start < window.start) || finished_scaffolds.count(scaffold_name) > 0) {
+               cerr << "Partial windows are not in genome order: " << scaffold_name << " window " << window_start << " in " << partial_path << " comes after " << previous_scaffold << " window " << window.start << endl;
+               cerr << "Pass the shards in the order of the genome." << endl;
+               return 9;
+            }
+            outputWindow(output, previous_scaffold, window, window_size, filtered, scaffold_name != previous_scaffold, usable_fraction, partial);
+            window_open = 0;
+            if (scaffold_name != previous_scaffold) {
+               finished_scaffolds.insert(previous_scaffold);
+            }
+         }
+         if (!window_open) {
+            window.start = window_start;
+            window.sites = 0;
+            window.sum.clear();
+            window.denominator.clear();
+            window_open = 1;
          }
-         if (usable_fraction) {
-            output += '\t' + to_string(denominator/window_size);
+         window.sites += window_sites;
+         if (!window.sum.addTerms(line_vector[3]) || !window.denominator.addTerms(line_vector[4])) {
+            cerr << "Malformatted partial window sums in " << partial_path << ": " << input_line << endl;
+            return 4;
          }
-         output += '\n';
-         sum = 0.0;
-         denominator = 0.0;
+         previous_scaffold = scaffold_name;
       }
-      ++current_position;
    }
-   //If the scaffold does not contain an integral number of windows:
-   if (statistics.size() % window_size > 0) {
-      last_window = statistics.size() - window_start + 1;
-      if (N_list.size() == 0) { //No adjustments to denominator if no N_list provided
-         denominator = (double)last_window;
-      }
-      if (denominator > 0.0) { //Avoid dividing by zero
-         output += to_string(sum/denominator);
-      } else {
-         output += "NA";
-      }
-      if (usable_fraction) {
-         output += '\t' + to_string(denominator/last_window);
-      }
-      output += '\n';
+   //Make sure to capture the last window:
+   if (window_open) {
+      outputWindow(output, previous_scaffold, window, window_size, filtered, 1, usable_fraction, partial);
    }
-   return output;
+   return 0;
 }
 
 int main(int argc, char **argv) {
@@ -169,6 +229,9 @@ int main(int argc, char **argv) {
    bool use_cin = 1, use_cout = 1; //Default to reading from cin and outputting to cout
    string input_line = "", output_line = "";
    string scaffold_name = "";
+   //Output partial windows, or merge them:
+   bool partial = 0;
+   bool merge = 0;
 
    //Variables for getopt_long:
    int optchar;
@@ -186,10 +249,12 @@ int main(int argc, char **argv) {
       {"usable_fraction", no_argument, 0, 'u'},
       {"stat_column", required_argument, 0, 's'},
       {"infimum_nonN", required_argument, 0, 'f'},
-      {"weighted_average", no_argument, 0, 'a'}
+      {"weighted_average", no_argument, 0, 'a'},
+      {"partial", no_argument, 0, 'p'},
+      {"merge", no_argument, 0, 'm'}
    };
    //Read in the options:
-   while ((optchar = getopt_long(argc, argv, "i:o:w:s:nuf:avhd", longoptions, &structindex)) > -1) {
+   while ((optchar = getopt_long(argc, argv, "i:o:w:s:nuf:apmvhd", longoptions, &structindex)) > -1) {
       switch(optchar) {
          case 'v':
             cerr << "nonOverlappingWindows version " << version << endl;
@@ -238,6 +303,12 @@ int main(int argc, char **argv) {
             cerr << "Using column 4 as weight for weighted average." << endl;
             nonN_weight = 2;
             break;
+         case 'p':
+            partial = 1;
+            break;
+         case 'm':
+            merge = 1;
+            break;
          default:
             cerr << "Unknown option " << (unsigned char)optchar << " supplied." << endl;
             cerr << usage;
@@ -246,9 +317,18 @@ int main(int argc, char **argv) {
       }
    }
 
-   //Ignore positional arguments
-   if (optind < argc) {
-      cerr << "Ignoring extra positional arguments starting at " << argv[optind++] << endl;
+   //Positional arguments are the partial windows to merge:
+   vector<string> partial_paths;
+   while (optind < argc) {
+      partial_paths.push_back(argv[optind++]);
+   }
+   if (!merge && !partial_paths.empty()) {
+      cerr << "Ignoring extra positional arguments starting at " << partial_paths[0] << endl;
+   }
+   if (window_size == 0) {
+      cerr << "Window size must be at least 1." << endl;
+      cerr << usage;
+      return 1;
    }
    
    //Do some error checking on the arguments:
@@ -270,13 +350,44 @@ int main(int argc, char **argv) {
       }
       use_cout = 0;
    }
+   ostream &window_output = use_cout ? cout : output;
+   
+   if (merge) {
+      int merge_status = mergePartialWindows(partial_paths, use_cin ? cin : input, window_output, usable_fraction, partial, debug);
+      if (!use_cin) {
+         input.close();
+      }
+      if (!use_cout) {
+         output.close();
+      }
+      return merge_status;
+   }
    
    //Set initial state:
    string previous_scaffold = "";
-   vector<double> N_list;
-   vector<double> scaffold_stats;
+   WindowFilter window_filter;
+   window_filter.omit_Ns = omit_Ns;
+   window_filter.nonN_weight = nonN_weight;
+   window_filter.infimum_nonN = infimum_nonN;
+   bool filtered = window_filter.filtered();
+   WindowSums window;
+   bool window_open = 0;
    bool header_line = 1;
    unsigned long header_position;
+   if (partial) {
+      window_output << "#partial_windows\t" << window_size << '\t' << filtered << '\n';
+   }
+   if (debug) {
+      if (nonN_weight == 2) {
+         cerr << "Performing weighted average based on column 4" << endl;
+      } else if (nonN_weight == 1) {
+         cerr << "Filtering sites unless column 4 > " << infimum_nonN << endl;
+      } else if (omit_Ns) {
+         cerr << "Omitting sites based on column 4" << endl;
+      } else {
+         cerr << "Not using column 4, so performing naive average" << endl;
+      }
+   }
    
    //Now perform the main processing:
    while (getline(use_cin ? cin : input, input_line)) {
@@ -316,6 +427,7 @@ int main(int argc, char **argv) {
       
       //Convert the column values from strings:
       string scaffold_name = "";
+      unsigned long position;
       double local_statistic;
       double omit_position = 0.0;
       scaffold_name = line_vector[0];
@@ -329,6 +441,21 @@ int main(int argc, char **argv) {
          }
          return 6;
       }
+      try {
+         position = stoul(line_vector[1]);
+      } catch (const logic_error&) {
+         position = 0;
+      }
+      if (position == 0) {
+         cerr << "Malformatted input TSV: Position " << line_vector[1] << " on scaffold " << scaffold_name << " is not a 1-based position." << endl;
+         if (!use_cin) {
+            input.close();
+         }
+         if (!use_cout) {
+            output.close();
+         }
+         return 4;
+      }
       if (line_vector[stat_column-1] == "NA") {
          local_statistic = 0.0;
          if (nonN_weight > 0) {
@@ -359,29 +486,47 @@ int main(int argc, char **argv) {
          }
       }
       
-      //If we're not on the same scaffold, output the window averages for the previous scaffold:
-      if (scaffold_name != previous_scaffold) {
-         if (use_cout) {
-            cout << calcDepths(scaffold_stats, previous_scaffold, window_size, N_list, usable_fraction, nonN_weight, infimum_nonN, debug);
-         } else {
-            output << calcDepths(scaffold_stats, previous_scaffold, window_size, N_list, usable_fraction, nonN_weight, infimum_nonN, debug);
+      //Output the previous window once we've moved past it:
+      unsigned long window_start = ((position-1)/window_size)*window_size+1;
+      if (window_open && (scaffold_name != previous_scaffold || window_start != window.start)) {
+         if (scaffold_name == previous_scaffold && window_start < window.start) {
+            cerr << "Input TSV is not sorted by position: " << scaffold_name << " pos " << position << " follows window starting at " << window.start << endl;
+            if (!use_cin) {
+               input.close();
+            }
+            if (!use_cout) {
+               output.close();
+            }
+            return 9;
+         }
+         outputWindow(window_output, previous_scaffold, window, window_size, filtered, scaffold_name != previous_scaffold, usable_fraction, partial);
+         window_open = 0;
+      }
+      if (!window_open) {
+         if (debug && scaffold_name != previous_scaffold) {
+            cerr << "Processing scaffold " << scaffold_name << endl;
          }
-         //Make sure to reset the window containers:
-         scaffold_stats.clear();
-         N_list.clear();
+         window.start = window_start;
+         window.sites = 0;
+         window.sum.clear();
+         window.denominator.clear();
+         window_open = 1;
       }
       //Accumulate the window statistics:
-      scaffold_stats.push_back(local_statistic);
-      if (omit_Ns || nonN_weight) {
-         N_list.push_back(omit_position);
+      window.sites++;
+      double site_weight, denominator_term;
+      bool include_site = window_filter.siteWeight(omit_position, site_weight, denominator_term);
+      if (filtered) {
+         window.denominator.add(denominator_term);
+      }
+      if (include_site) {
+         window.sum.add(local_statistic * site_weight);
       }
       previous_scaffold = scaffold_name;
    }
-   //Make sure to capture the last scaffold:
-   if (use_cout) {
-      cout << calcDepths(scaffold_stats, previous_scaffold, window_size, N_list, usable_fraction, nonN_weight, infimum_nonN, debug);
-   } else {
-      output << calcDepths(scaffold_stats, previous_scaffold, window_size, N_list, usable_fraction, nonN_weight, infimum_nonN, debug);
+   //Make sure to capture the last window:
+   if (window_open) {
+      outputWindow(window_output, previous_scaffold, window, window_size, filtered, 1, usable_fraction, partial);
    }
 
    //Close the files if they were used instead of STDIN and STDOUT:
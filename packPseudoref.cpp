@@ -0,0 +1,174 @@
+/****************************************************************************
+ * packPseudoref.cpp                                                        *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Converts a pseudoreference FASTA into the packed binary format described *
+ *  in packedPseudoref.h (4 bits per site with a per-scaffold index), which *
+ *  calculateDxy, calculatePolymorphism, sitePatterns, and                  *
+ *  listPolyDivSites read natively.                                         *
+ * The FASTA may be wrapped at any length.                                  *
+ *                                                                          *
+ * Syntax: packPseudoref [options] <input FASTA> <output packed file>       *
+ ****************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <getopt.h>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include "pseudorefReader.h"
+#include "packedPseudoref.h"
+
+//Define constants for getopt:
+#define no_argument 0
+#define required_argument 1
+#define optional_argument 2
+
+//Version:
+#define VERSION "1.0"
+
+//Usage/help:
+#define USAGE "packPseudoref\nUsage:\n packPseudoref [options] <input FASTA> <output packed file>\n Options:\n  --help,-h:\t\tOutput this documentation\n  --version,-v:\t\tOutput the version number\n  --debug,-d:\t\tOutput extra debugging info\n\n Description:\n  Packs a pseudoreference FASTA into 4 bits per site with a scaffold index.\n  Case is not preserved, and symbols other than ACGTKMRSWY are stored as N.\n"
+
+using namespace std;
+
+void writeUint64(ofstream &output, uint64_t value) {
+   output.write((const char *)&value, 8);
+}
+
+int main(int argc, char **argv) {
+   //Option for debugging:
+   bool debug = 0;
+   string input_FASTA_path = "", output_path = "";
+
+   //Variables for getopt_long:
+   int optchar;
+   int structindex = 0;
+   extern int optind;
+   //Create the struct used for getopt:
+   const struct option longoptions[] {
+      {"debug", no_argument, 0, 'd'},
+      {"version", no_argument, 0, 'v'},
+      {"help", no_argument, 0, 'h'}
+   };
+   //Read in the options:
+   while ((optchar = getopt_long(argc, argv, "dvh", longoptions, &structindex)) > -1) {
+      switch(optchar) {
+         case 'd':
+            cerr << "Debugging mode enabled." << endl;
+            debug = 1;
+            break;
+         case 'v':
+            cerr << "packPseudoref version " << VERSION << endl;
+            return 0;
+            break;
+         case 'h':
+            cerr << USAGE;
+            return 0;
+            break;
+         default:
+            cerr << "Unknown option " << (unsigned char)optchar << " supplied." << endl;
+            cerr << USAGE;
+            return 1;
+            break;
+      }
+   }
+   //Read in the positional arguments:
+   if (optind < argc) {
+      input_FASTA_path = argv[optind++];
+   }
+   if (optind < argc) {
+      output_path = argv[optind++];
+   }
+   if (input_FASTA_path == "" || output_path == "") {
+      cerr << "Both an input FASTA and an output path are required." << endl;
+      cerr << USAGE;
+      return 1;
+   }
+
+   //Open the input FASTA:
+   PseudorefReader FASTA_reader;
+   if (!FASTA_reader.open(vector<string>(1, input_FASTA_path))) {
+      return 2;
+   }
+   ofstream output(output_path, ios::out | ios::binary);
+   if (!output) {
+      cerr << "Error opening output packed file " << output_path << endl;
+      return 2;
+   }
+   //Index offset is filled in once all of the scaffolds are written:
+   output.write(PACKED_MAGIC, PACKED_MAGIC_LENGTH);
+   writeUint64(output, 0);
+
+   //Pack each scaffold, carrying the low nibble of an incomplete byte across rows:
+   vector<PackedScaffold> index;
+   uint64_t offset = PACKED_HEADER_LENGTH;
+   unsigned char partial_byte = 0;
+   vector<unsigned char> packed_row;
+   vector<SequenceView> FASTA_lines;
+   reader_status row_status;
+   while ((row_status = FASTA_reader.readRow(FASTA_lines)) == READER_HEADER || row_status == READER_SEQUENCE) {
+      if (row_status == READER_HEADER) {
+         //Flush the last half byte of the previous scaffold:
+         if (!index.empty() && index.back().length % 2 == 1) {
+            output.put(partial_byte);
+            offset++;
+         }
+         PackedScaffold scaffold;
+         scaffold.header = FASTA_reader.scaffold();
+         scaffold.length = 0;
+         scaffold.offset = offset;
+         index.push_back(scaffold);
+         if (debug) {
+            cerr << "Packing scaffold " << scaffold.header << endl;
+         }
+      } else if (!index.empty()) {
+         PackedScaffold &scaffold = index.back();
+         packed_row.clear();
+         for (unsigned long i = 0; i < FASTA_lines[0].length; i++) {
+            unsigned char code = packedCode(FASTA_lines[0].bases[i]);
+            if ((scaffold.length + i) % 2 == 0) {
+               partial_byte = code;
+            } else {
+               packed_row.push_back(partial_byte | (code << 4));
+            }
+         }
+         scaffold.length += FASTA_lines[0].length;
+         output.write((const char *)packed_row.data(), packed_row.size());
+         offset += packed_row.size();
+      }
+   }
+   if (row_status == READER_IO_ERROR) {
+      cerr << "Error reading input FASTA: " << input_FASTA_path << endl;
+      cerr << strerror(errno) << endl;
+      return 5;
+   }
+   if (!index.empty() && index.back().length % 2 == 1) {
+      output.put(partial_byte);
+      offset++;
+   }
+   FASTA_reader.close();
+
+   //Write the index, then point the header at it:
+   writeUint64(output, index.size());
+   for (auto scaffold_iterator = index.begin(); scaffold_iterator != index.end(); ++scaffold_iterator) {
+      writeUint64(output, scaffold_iterator->header.length());
+      output.write(scaffold_iterator->header.data(), scaffold_iterator->header.length());
+      writeUint64(output, scaffold_iterator->length);
+      writeUint64(output, scaffold_iterator->offset);
+   }
+   output.seekp(PACKED_MAGIC_LENGTH);
+   writeUint64(output, offset);
+   output.close();
+   if (!output) {
+      cerr << "Error writing output packed file " << output_path << endl;
+      return 6;
+   }
+   cerr << "Packed " << index.size() << " scaffolds into " << output_path << endl;
+
+   return 0;
+}
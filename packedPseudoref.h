@@ -0,0 +1,142 @@
+/****************************************************************************
+ * packedPseudoref.h                                                        *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Definition of the packed binary pseudoreference format written by        *
+ *  packPseudoref and read natively by PseudorefReader.                     *
+ * IUPAC diploid pseudoreferences only use 11 symbols, so each site is      *
+ *  stored in 4 bits, two sites per byte (even sites in the low nibble).    *
+ * Case is not preserved, and any symbol other than A, C, G, T, K, M, R, S, *
+ *  W, or Y is stored as N, matching how the per-site tools treat them.     *
+ *                                                                          *
+ * Layout (all integers are 64-bit little-endian):                          *
+ *  magic "PSREF4\0\1", index offset                                        *
+ *  packed sites of each scaffold, each scaffold starting on a byte         *
+ *  index: number of scaffolds, then for each scaffold:                     *
+ *   header length, header (FASTA header without the >), number of sites,   *
+ *   offset of the scaffold's packed sites                                  *
+ ****************************************************************************/
+
+#ifndef PACKED_PSEUDOREF_H
+#define PACKED_PSEUDOREF_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+
+#define PACKED_MAGIC "PSREF4\0\1"
+#define PACKED_MAGIC_LENGTH 8
+#define PACKED_HEADER_LENGTH 16
+
+//Base for each 4-bit code:
+static const char packed_bases[17] = "ACGTKMRSWYNNNNNN";
+
+//One entry of the scaffold index of a packed pseudoreference:
+struct PackedScaffold {
+   std::string header;
+   uint64_t length;
+   uint64_t offset;
+};
+
+//4-bit code for a base:
+inline unsigned char packedCode(char base) {
+   switch (base) {
+      case 'A':
+      case 'a':
+         return 0;
+      case 'C':
+      case 'c':
+         return 1;
+      case 'G':
+      case 'g':
+         return 2;
+      case 'T':
+      case 't':
+         return 3;
+      case 'K':
+      case 'k':
+         return 4;
+      case 'M':
+      case 'm':
+         return 5;
+      case 'R':
+      case 'r':
+         return 6;
+      case 'S':
+      case 's':
+         return 7;
+      case 'W':
+      case 'w':
+         return 8;
+      case 'Y':
+      case 'y':
+         return 9;
+      default: //Anything else is an N
+         return 10;
+   }
+}
+
+//Expand num_sites sites from packed bytes starting at an even site:
+inline void unpackSites(const unsigned char *packed, unsigned long num_sites, char *bases) {
+   for (unsigned long i = 0; i+1 < num_sites; i += 2) {
+      bases[i] = packed_bases[packed[i/2] & 15];
+      bases[i+1] = packed_bases[packed[i/2] >> 4];
+   }
+   if (num_sites % 2 == 1) {
+      bases[num_sites-1] = packed_bases[packed[num_sites/2] & 15];
+   }
+}
+
+//Read exactly length bytes at offset, returning 0 on a short read or error:
+inline bool preadFully(int fd, void *destination, unsigned long length, uint64_t offset) {
+   char *destination_bytes = (char *)destination;
+   while (length > 0) {
+      ssize_t bytes_read = pread(fd, destination_bytes, length, offset);
+      if (bytes_read <= 0) {
+         if (bytes_read < 0 && errno == EINTR) {
+            continue;
+         }
+         return 0;
+      }
+      destination_bytes += bytes_read;
+      length -= bytes_read;
+      offset += bytes_read;
+   }
+   return 1;
+}
+
+//Check whether an open file starts with the packed magic:
+inline bool isPackedPseudoref(int fd) {
+   char magic[PACKED_MAGIC_LENGTH];
+   return preadFully(fd, magic, PACKED_MAGIC_LENGTH, 0) && memcmp(magic, PACKED_MAGIC, PACKED_MAGIC_LENGTH) == 0;
+}
+
+//Read the scaffold index of a packed pseudoreference:
+inline bool readPackedIndex(int fd, std::vector<PackedScaffold> &index) {
+   uint64_t index_offset, num_scaffolds;
+   if (!preadFully(fd, &index_offset, 8, PACKED_MAGIC_LENGTH) || !preadFully(fd, &num_scaffolds, 8, index_offset)) {
+      return 0;
+   }
+   uint64_t offset = index_offset + 8;
+   index.resize(num_scaffolds);
+   for (uint64_t i = 0; i < num_scaffolds; i++) {
+      uint64_t header_length;
+      if (!preadFully(fd, &header_length, 8, offset)) {
+         return 0;
+      }
+      offset += 8;
+      index[i].header.resize(header_length);
+      if ((header_length > 0 && !preadFully(fd, &index[i].header[0], header_length, offset)) || !preadFully(fd, &index[i].length, 8, offset+header_length) || !preadFully(fd, &index[i].offset, 8, offset+header_length+8)) {
+         return 0;
+      }
+      offset += header_length + 16;
+   }
+   return 1;
+}
+
+#endif
@@ -0,0 +1,136 @@
+/****************************************************************************
+ * parallelScaffolds.h                                                      *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Helpers for processing independent scaffolds on several threads, used   *
+ *  by the --threads modes of calculateDxy and calculatePolymorphism.       *
+ * WorkStealingScheduler hands each thread scaffolds from its own deque in  *
+ *  scaffold order, and an idle thread steals the furthest-ahead scaffold   *
+ *  from another thread's deque, so a few huge chromosome arms don't leave  *
+ *  the other threads waiting behind thousands of tiny contigs.             *
+ * OrderedOutput puts the output of each scaffold back in scaffold order:   *
+ *  the earliest unfinished scaffold writes straight through, and later     *
+ *  scaffolds are held in memory until every earlier scaffold is done.      *
+ ****************************************************************************/
+
+#ifndef PARALLEL_SCAFFOLDS_H
+#define PARALLEL_SCAFFOLDS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+class WorkStealingScheduler {
+   public:
+      //Deal the tasks out round-robin, so each thread starts near the front:
+      WorkStealingScheduler(unsigned long num_tasks, unsigned int num_threads) : queues(num_threads), queue_mutexes(num_threads) {
+         for (unsigned long task = 0; task < num_tasks; task++) {
+            queues[task % num_threads].push_back(task);
+         }
+      }
+
+      //Get the next task for a thread, returning 0 once no work is left:
+      bool next(unsigned int thread_index, unsigned long &task) {
+         {
+            std::lock_guard<std::mutex> own_lock(queue_mutexes[thread_index]);
+            if (!queues[thread_index].empty()) {
+               task = queues[thread_index].front();
+               queues[thread_index].pop_front();
+               return 1;
+            }
+         }
+         //Steal from the back of another thread's deque:
+         for (unsigned int offset = 1; offset < queues.size(); offset++) {
+            unsigned int victim = (thread_index + offset) % queues.size();
+            std::lock_guard<std::mutex> victim_lock(queue_mutexes[victim]);
+            if (!queues[victim].empty()) {
+               task = queues[victim].back();
+               queues[victim].pop_back();
+               return 1;
+            }
+         }
+         return 0;
+      }
+
+   private:
+      std::vector<std::deque<unsigned long>> queues;
+      std::vector<std::mutex> queue_mutexes;
+};
+
+class OrderedOutput {
+   public:
+      OrderedOutput(std::ostream &output_stream, unsigned long num_tasks) : output(output_stream), next_task(0), pending(num_tasks), finished(num_tasks, 0) {}
+
+      //Append output of a task, and empty text:
+      void write(unsigned long task, std::string &text) {
+         std::lock_guard<std::mutex> output_lock(output_mutex);
+         if (task == next_task) {
+            output << text;
+         } else {
+            pending[task] += text;
+         }
+         text.clear();
+      }
+
+      //Mark a task as done, writing out any tasks that were waiting on it:
+      void finish(unsigned long task) {
+         std::lock_guard<std::mutex> output_lock(output_mutex);
+         finished[task] = 1;
+         while (next_task < finished.size() && finished[next_task]) {
+            output << pending[next_task];
+            std::string().swap(pending[next_task]);
+            next_task++;
+         }
+         //The new earliest task writes straight through from now on:
+         if (next_task < finished.size()) {
+            output << pending[next_task];
+            std::string().swap(pending[next_task]);
+         }
+      }
+
+      //Lock for other shared streams (e.g. progress messages on cerr):
+      std::mutex &lock() {
+         return output_mutex;
+      }
+
+   private:
+      std::ostream &output;
+      std::mutex output_mutex;
+      unsigned long next_task;
+      std::vector<std::string> pending;
+      std::vector<bool> finished;
+};
+
+//Run worker(task, thread_index) on every task using num_threads threads
+//A nonzero return from worker stops all threads from starting new tasks,
+// and the first such return value is returned
+inline int runParallelTasks(unsigned long num_tasks, unsigned int num_threads, std::function<int(unsigned long, unsigned int)> worker) {
+   WorkStealingScheduler scheduler(num_tasks, num_threads);
+   std::atomic<int> exit_code(0);
+   std::vector<std::thread> threads;
+   for (unsigned int thread_index = 0; thread_index < num_threads; thread_index++) {
+      threads.push_back(std::thread([&, thread_index]() {
+         unsigned long task;
+         while (exit_code.load() == 0 && scheduler.next(thread_index, task)) {
+            int task_exit_code = worker(task, thread_index);
+            if (task_exit_code != 0) {
+               int no_error = 0;
+               exit_code.compare_exchange_strong(no_error, task_exit_code);
+            }
+         }
+      }));
+   }
+   for (auto thread_iterator = threads.begin(); thread_iterator != threads.end(); ++thread_iterator) {
+      thread_iterator->join();
+   }
+   return exit_code.load();
+}
+
+#endif
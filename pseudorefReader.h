@@ -0,0 +1,1098 @@
+/****************************************************************************
+ * pseudorefReader.h                                                        *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Shared synchronized reader for sets of pseudoreference FASTAs, used by   *
+ *  calculateDxy, calculatePolymorphism, and sitePatterns.                  *
+ * Each FASTA is read in large blocks rather than one getline at a time,    *
+ *  and each call to readRow() hands back a run of sites from every FASTA   *
+ *  as a view into that FASTA's block buffer, so no per-line strings are    *
+ *  made.                                                                   *
+ * The FASTAs are kept in lockstep by site position rather than by line: a  *
+ *  row is either all headers (which must be identical), or the longest run *
+ *  of sites left on the current line of every FASTA, so FASTAs wrapped at  *
+ *  different lengths (or not at all) stay synchronized, and scaffolds of   *
+ *  different lengths are caught when one FASTA reaches a header early.     *
+ *  Inputs are only ever read forwards, so pipes work as well as files.     *
+ * Views returned by readRow() stay valid until the next call to readRow(). *
+ * In mmap mode, each FASTA is instead memory-mapped once with a sequential *
+ *  access hint, and views point directly into the mapping, so they stay    *
+ *  valid until the reader is closed.  Inputs that cannot be mapped (e.g.   *
+ *  pipes) fall back to block reads.                                        *
+ * Packed pseudoreferences (see packedPseudoref.h) are detected by their    *
+ *  magic number, and are read scaffold by scaffold using their index, with *
+ *  up to PACKED_ROW_SITES sites unpacked at a time, acting as a line.      *
+ * Cohort stores (see cohortStore.h) are also detected by their magic       *
+ *  number, and stand for every sample in them, or for one sample if given  *
+ *  as store:sample.  Their samples are read COHORT_ROW_SITES at a time,    *
+ *  and where a sample has no differences from the reference, its view      *
+ *  points at the reference sites shared by the whole store, so rows where  *
+ *  every sample matches the reference cost a single read (see              *
+ *  rowsShareBases() in siteKernels.h).                                     *
+ * VCFs (see vcfInput.h) are detected by their extension, and likewise      *
+ *  stand for every sample in them, or for one sample as VCF:sample, with   *
+ *  the reference they were called against given to useVCFReference().      *
+ *  Their samples are decoded VCF_ROW_SITES at a time, sharing sites the    *
+ *  same way, but VCFs can only be read sequentially, not by readRegion().  *
+ * Gzipped FASTAs (including BGZF) are detected by their magic number, and  *
+ *  decompressed on the fly by CompressedInput (see compressedInput.h),     *
+ *  with BGZF blocks inflated on decompression_threads threads.             *
+ * Alternatively, once loadIndex() has found every scaffold in every input  *
+ *  (from the .fai of each FASTA, or the index of each packed input),       *
+ *  readRegion() reads any run of sites of a scaffold directly, without     *
+ *  regard to line wrapping, into caller-owned buffers.  readRegion() only  *
+ *  uses pread(), so several threads may call it at once.  readRange()      *
+ *  does the same for a longer run of sites, REGION_SITES at a time, e.g.   *
+ *  for a --region, whose scaffold is found by name with findScaffold().    *
+ * preflight() checks that every input has the same scaffolds in the same   *
+ *  order with the same lengths, from .fai files and indexes where they     *
+ *  exist, or a scan of each FASTA's headers and line lengths, on several   *
+ *  threads, so a mismatched cohort can be caught before any compute.       *
+ ****************************************************************************/
+
+#ifndef PSEUDOREF_READER_H
+#define PSEUDOREF_READER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "packedPseudoref.h"
+#include "fastaIndex.h"
+#include "compressedInput.h"
+#include "cohortStore.h"
+#include "vcfInput.h"
+#include "parallelScaffolds.h"
+
+//Size of the blocks read from each FASTA:
+#define READER_BLOCK_SIZE 1048576
+
+//Number of sites unpacked per row from packed pseudoreferences:
+#define PACKED_ROW_SITES 65536
+
+//Suggested number of sites per call to readRegion():
+#define REGION_SITES 65536
+
+//Status of a call to readRow():
+enum reader_status {
+   READER_SEQUENCE, //Every FASTA is on a sequence line
+   READER_HEADER, //Every FASTA is on the same header line
+   READER_EOF, //At least one FASTA has no more lines
+   READER_HEADERS_DIFFER, //Every FASTA is on a header line, but they differ
+   READER_NOT_SYNCHRONIZED, //Some but not all FASTAs are on a header line, so scaffold lengths differ
+   READER_IO_ERROR //A read failed
+};
+
+//A view of one line from one FASTA (or of a run of sites within a scaffold):
+struct SequenceView {
+   const char *bases;
+   unsigned long length;
+};
+
+//Location of one scaffold within an input, from its .fai or packed index:
+struct ScaffoldIndex {
+   std::string header; //Header line without the >
+   uint64_t length;
+   uint64_t offset; //Offset of the first site (or first packed byte)
+   uint64_t line_bases; //Wrapping of a FASTA scaffold, 0 for packed inputs
+   uint64_t line_width;
+};
+
+//Block buffer state for one input FASTA or packed pseudoreference:
+struct PseudorefInput {
+   std::string path;
+   int fd;
+   char *buffer;
+   unsigned long buffer_size;
+   unsigned long begin; //Start of unconsumed data in buffer
+   unsigned long end; //End of valid data in buffer
+   bool eof;
+   bool mapped; //Buffer is a memory mapping of the whole file
+   bool packed; //Input is a packed pseudoreference, buffer holds unpacked sites
+   std::vector<PackedScaffold> index; //Scaffold index of a packed input
+   SequenceView line; //Unconsumed part of the current line
+   bool line_pending; //Whether line still has anything left in it
+   //Position of a packed input or cohort sample, and the header of its
+   // current scaffold:
+   bool packed_in_scaffold;
+   unsigned long packed_scaffold;
+   uint64_t packed_site;
+   std::string header_line;
+   unsigned char *packed_buffer;
+   CompressedInput *compressed; //Decompressor of a gzipped FASTA, otherwise NULL
+   CohortStore *cohort; //Store of a cohort sample, otherwise NULL
+   unsigned long cohort_number; //Which of the reader's stores it is
+   unsigned long cohort_sample;
+   std::vector<CohortDelta> cohort_deltas;
+   VCFInput *vcf; //VCF of a VCF sample, otherwise NULL
+   unsigned long vcf_sample;
+   std::vector<ScaffoldIndex> scaffolds; //Filled in by loadIndex()
+};
+
+class PseudorefReader {
+   public:
+      PseudorefReader() : failed_input(0), failed_scaffold(0), check_headers(1) {}
+      ~PseudorefReader() {
+         close();
+      }
+
+      //Open all of the inputs, returning 0 if any of them failed to open:
+      bool open(const std::vector<std::string> &paths, bool use_mmap = 0, unsigned int decompression_threads = 1) {
+         for (auto path_iterator = paths.begin(); path_iterator != paths.end(); ++path_iterator) {
+            PseudorefInput input;
+            input.path = *path_iterator;
+            if (isVCFPath(*path_iterator)) {
+               if (!addVCFInputs(*path_iterator, "", decompression_threads)) {
+                  return 0;
+               }
+               continue;
+            }
+            input.fd = ::open(path_iterator->c_str(), O_RDONLY);
+            if (input.fd < 0) { //Check to make sure the input file was validly opened
+               //It may be one sample of a VCF or cohort store, as
+               // VCF:sample or store:sample:
+               size_t colon_position = path_iterator->rfind(':');
+               if (colon_position != std::string::npos && colon_position > 0 && isVCFPath(path_iterator->substr(0, colon_position))) {
+                  if (!addVCFInputs(path_iterator->substr(0, colon_position), path_iterator->substr(colon_position+1), decompression_threads)) {
+                     return 0;
+                  }
+                  continue;
+               } else if (colon_position != std::string::npos && colon_position > 0) {
+                  int cohort_status = addCohortInputs(path_iterator->substr(0, colon_position), path_iterator->substr(colon_position+1), 1);
+                  if (cohort_status > 0) {
+                     continue;
+                  } else if (cohort_status < 0) {
+                     return 0;
+                  }
+               }
+               std::cerr << "Error opening input FASTA: " << *path_iterator << "." << std::endl;
+               return 0;
+            }
+            if (isCohortStore(input.fd)) {
+               ::close(input.fd);
+               if (addCohortInputs(*path_iterator, "", 0) <= 0) {
+                  return 0;
+               }
+               continue;
+            }
+            input.begin = 0;
+            input.end = 0;
+            input.eof = 0;
+            input.mapped = 0;
+            input.line_pending = 0;
+            input.packed_in_scaffold = 0;
+            input.packed_scaffold = 0;
+            input.packed_site = 0;
+            input.packed = isPackedPseudoref(input.fd);
+            input.packed_buffer = NULL;
+            input.compressed = NULL;
+            input.cohort = NULL;
+            input.vcf = NULL;
+            if (input.packed) {
+               if (!readPackedIndex(input.fd, input.index)) {
+                  std::cerr << "Error reading index of packed pseudoreference: " << *path_iterator << "." << std::endl;
+                  ::close(input.fd);
+                  return 0;
+               }
+               input.buffer_size = PACKED_ROW_SITES;
+               input.buffer = new char[input.buffer_size];
+               input.packed_buffer = new unsigned char[PACKED_ROW_SITES/2];
+               inputs.push_back(input);
+               continue;
+            }
+            //Check for gzip, keeping any bytes we had to consume from a pipe:
+            unsigned char magic[2];
+            unsigned long magic_length = 0;
+            bool consumed_magic = 0;
+            ssize_t magic_read = pread(input.fd, magic, 2, 0);
+            if (magic_read < 0 && errno == ESPIPE) {
+               consumed_magic = 1;
+               while (magic_length < 2 && (magic_read = ::read(input.fd, magic+magic_length, 2-magic_length)) != 0) {
+                  if (magic_read < 0) {
+                     if (errno == EINTR) {
+                        continue;
+                     }
+                     std::cerr << "Error reading input FASTA: " << *path_iterator << "." << std::endl;
+                     ::close(input.fd);
+                     return 0;
+                  }
+                  magic_length += magic_read;
+               }
+            } else if (magic_read > 0) {
+               magic_length = magic_read;
+            }
+            if (isGzipMagic(magic, magic_length)) {
+               input.compressed = new CompressedInput(input.fd, decompression_threads, magic, consumed_magic ? magic_length : 0);
+               if (use_mmap) {
+                  std::cerr << "Input FASTA " << *path_iterator << " is compressed, decompressing it in blocks instead of memory-mapping." << std::endl;
+               }
+            } else if (use_mmap && (consumed_magic || !mapInput(input))) {
+               std::cerr << "Unable to memory-map input FASTA " << *path_iterator << ", reading it in blocks instead." << std::endl;
+            }
+            if (!input.mapped) {
+               input.buffer_size = READER_BLOCK_SIZE;
+               input.buffer = new char[input.buffer_size];
+               if (consumed_magic && input.compressed == NULL) {
+                  memcpy(input.buffer, magic, magic_length);
+                  input.end = magic_length;
+               }
+            }
+            inputs.push_back(input);
+         }
+         return 1;
+      }
+
+      void close() {
+         for (auto input_iterator = inputs.begin(); input_iterator != inputs.end(); ++input_iterator) {
+            if (input_iterator->fd >= 0) {
+               ::close(input_iterator->fd);
+            }
+            if (input_iterator->mapped) {
+               if (input_iterator->buffer != NULL) {
+                  munmap(input_iterator->buffer, input_iterator->buffer_size);
+               }
+            } else {
+               delete[] input_iterator->buffer;
+            }
+            delete[] input_iterator->packed_buffer;
+            delete input_iterator->compressed;
+         }
+         inputs.clear();
+         for (auto cohort_iterator = cohorts.begin(); cohort_iterator != cohorts.end(); ++cohort_iterator) {
+            delete *cohort_iterator;
+         }
+         cohorts.clear();
+         for (auto vcf_iterator = vcfs.begin(); vcf_iterator != vcfs.end(); ++vcf_iterator) {
+            delete *vcf_iterator;
+         }
+         vcfs.clear();
+      }
+
+      unsigned long size() const {
+         return inputs.size();
+      }
+
+      //Name of the current scaffold (header line without the >):
+      const std::string &scaffold() const {
+         return scaffold_name;
+      }
+
+      //Whether header rows must be identical across inputs (default: 1):
+      void checkHeaders(bool check) {
+         check_headers = check;
+      }
+
+      //Reference FASTA (with a .fai) that VCF inputs were called against,
+      // set before open():
+      void useVCFReference(const std::string &reference_path) {
+         VCF_reference_path = reference_path;
+      }
+
+      //Index of the input that caused the last error status:
+      unsigned long failedInput() const {
+         return failed_input;
+      }
+
+      const std::string &path(unsigned long which_input) const {
+         return inputs[which_input].path;
+      }
+
+      //Read the next header, or the next run of sites, from every input, and
+      // check that they are synchronized:
+      reader_status readRow(std::vector<SequenceView> &row) {
+         if (inputs.empty()) {
+            return READER_EOF;
+         }
+         row.resize(inputs.size());
+         unsigned long num_headers = 0;
+         for (unsigned long i = 0; i < inputs.size(); i++) {
+            PseudorefInput &input = inputs[i];
+            while (!input.line_pending) {
+               int line_status;
+               if (input.vcf != NULL) {
+                  line_status = readVCFLine(input, input.line);
+               } else if (input.cohort != NULL) {
+                  line_status = readCohortLine(input, input.line);
+               } else if (input.packed) {
+                  line_status = readPackedLine(input, input.line);
+               } else {
+                  line_status = readLine(input, input.line);
+               }
+               if (line_status < 0) {
+                  failed_input = i;
+                  return READER_IO_ERROR;
+               } else if (line_status == 0) {
+                  failed_input = i;
+                  return READER_EOF;
+               }
+               input.line_pending = input.line.length > 0; //Skip blank lines
+            }
+            row[i] = input.line;
+            if (input.line.bases[0] == '>') {
+               num_headers++;
+            }
+         }
+         if (num_headers == inputs.size()) {
+            if (!headersMatch(row)) {
+               return READER_HEADERS_DIFFER;
+            }
+            for (unsigned long i = 0; i < inputs.size(); i++) {
+               inputs[i].line_pending = 0;
+            }
+            scaffold_name.assign(row[0].bases+1, row[0].length-1);
+            return READER_HEADER;
+         } else if (num_headers > 0) {
+            //Report the first input that disagrees with the first input:
+            for (unsigned long i = 1; i < inputs.size(); i++) {
+               if ((row[i].bases[0] == '>') != (row[0].bases[0] == '>')) {
+                  failed_input = i;
+                  break;
+               }
+            }
+            return READER_NOT_SYNCHRONIZED;
+         }
+         //Hand back the longest run that every input has left on its line:
+         unsigned long run_length = row[0].length;
+         for (unsigned long i = 1; i < inputs.size(); i++) {
+            run_length = std::min(run_length, row[i].length);
+         }
+         for (unsigned long i = 0; i < inputs.size(); i++) {
+            row[i].length = run_length;
+            inputs[i].line.bases += run_length;
+            inputs[i].line.length -= run_length;
+            inputs[i].line_pending = inputs[i].line.length > 0;
+         }
+         return READER_SEQUENCE;
+      }
+
+      //Whether the last row returned by readRow() reached the end of the
+      // current line of an input (e.g. to preserve its line wrapping):
+      bool lineEnded(unsigned long which_input) const {
+         return !inputs[which_input].line_pending;
+      }
+
+      //Find every scaffold in every input, and check that the inputs have
+      // the same scaffolds with the same lengths in the same order
+      //FASTA inputs need a .fai (e.g. from samtools faidx)
+      reader_status loadIndex() {
+         for (unsigned long i = 0; i < inputs.size(); i++) {
+            if (!loadInputIndex(inputs[i])) {
+               failed_input = i;
+               return READER_IO_ERROR;
+            }
+         }
+         for (unsigned long i = 1; i < inputs.size(); i++) {
+            if (inputs[i].scaffolds.size() != inputs[0].scaffolds.size()) {
+               failed_input = i;
+               return READER_NOT_SYNCHRONIZED;
+            }
+            for (unsigned long k = 0; k < inputs[0].scaffolds.size(); k++) {
+               if (check_headers && inputs[i].scaffolds[k].header != inputs[0].scaffolds[k].header) {
+                  failed_input = i;
+                  failed_scaffold = k;
+                  return READER_HEADERS_DIFFER;
+               }
+               if (inputs[i].scaffolds[k].length != inputs[0].scaffolds[k].length) {
+                  failed_input = i;
+                  failed_scaffold = k;
+                  return READER_NOT_SYNCHRONIZED;
+               }
+            }
+         }
+         //Scaffolds can be looked up by full header or by the first word
+         // of the header (i.e. the name in the .fai):
+         scaffold_numbers.clear();
+         if (!inputs.empty()) {
+            for (unsigned long k = 0; k < inputs[0].scaffolds.size(); k++) {
+               const std::string &header = inputs[0].scaffolds[k].header;
+               scaffold_numbers.insert(std::make_pair(header, k));
+               scaffold_numbers.insert(std::make_pair(header.substr(0, header.find_first_of(" \t")), k));
+            }
+         }
+         return READER_SEQUENCE;
+      }
+
+      //Find a scaffold by name after loadIndex(), returning 0 if there is
+      // no such scaffold:
+      bool findScaffold(const std::string &name, unsigned long &scaffold_number) const {
+         auto scaffold_iterator = scaffold_numbers.find(name);
+         if (scaffold_iterator == scaffold_numbers.end()) {
+            return 0;
+         }
+         scaffold_number = scaffold_iterator->second;
+         return 1;
+      }
+
+      //Scaffolds found by loadIndex():
+      unsigned long numScaffolds() const {
+         return inputs.empty() ? 0 : inputs[0].scaffolds.size();
+      }
+      const std::string &scaffoldHeader(unsigned long scaffold_number, unsigned long which_input = 0) const {
+         return inputs[which_input].scaffolds[scaffold_number].header;
+      }
+      uint64_t scaffoldLength(unsigned long scaffold_number) const {
+         return inputs[0].scaffolds[scaffold_number].length;
+      }
+
+      //Index of the scaffold that caused the last error status from loadIndex():
+      unsigned long failedScaffold() const {
+         return failed_scaffold;
+      }
+
+      //Check that every input has the same scaffolds with the same lengths
+      // in the same order, without reading any sequence where possible, so
+      // a mismatched cohort fails before any compute:
+      //Each FASTA's layout comes from its .fai if it has an up-to-date one,
+      // otherwise from a single scan of its header and line lengths, and
+      // the other inputs' layouts come from their indexes (or, for VCFs,
+      // from their reference), on num_threads threads
+      //Every mismatched input is reported, along with any FASTA whose lines
+      // aren't evenly wrapped (which samtools faidx would reject), and the
+      // status is that of the first mismatched input
+      reader_status preflight(unsigned int num_threads, bool debug) {
+         std::vector<PreflightLayout> layouts(inputs.size());
+         runParallelTasks(inputs.size(), num_threads, [&](unsigned long i, unsigned int thread_index) {
+            findPreflightLayout(inputs[i], layouts[i]);
+            return 0;
+         });
+         reader_status preflight_status = READER_SEQUENCE;
+         for (unsigned long i = 0; i < inputs.size(); i++) {
+            const PreflightLayout &layout = layouts[i];
+            reader_status input_status = READER_SEQUENCE;
+            if (!layout.error.empty()) {
+               std::cerr << "Preflight: " << inputs[i].path << ": " << layout.error << std::endl;
+               input_status = READER_IO_ERROR;
+            } else if (i > 0 && layouts[0].error.empty()) {
+               input_status = comparePreflightLayouts(layouts[0], layout, i);
+            }
+            if (!layout.ragged_scaffold.empty()) {
+               std::cerr << "Preflight warning: " << inputs[i].path << ": lines of scaffold " << layout.ragged_scaffold << " are not all the same length, so it can't be indexed with samtools faidx." << std::endl;
+            }
+            if (debug && layout.error.empty()) {
+               std::cerr << "Preflight: " << inputs[i].path << ": " << layout.scaffolds.size() << " scaffolds from " << layout.source << std::endl;
+            }
+            if (input_status != READER_SEQUENCE && preflight_status == READER_SEQUENCE) {
+               preflight_status = input_status;
+               failed_input = i;
+            }
+         }
+         return preflight_status;
+      }
+
+      //Read num_sites sites starting at first_site of a scaffold from every
+      // input, with line terminators removed, into views of buffers
+      //Does not modify the reader, so may be called from several threads,
+      // each with its own buffers
+      reader_status readRegion(unsigned long scaffold_number, uint64_t first_site, unsigned long num_sites, std::vector<std::string> &buffers, std::vector<SequenceView> &row) const {
+         //Buffers past the inputs hold the reference sites of each store:
+         buffers.resize(inputs.size() + cohorts.size());
+         row.resize(inputs.size());
+         std::vector<bool> reference_read(cohorts.size(), 0);
+         std::vector<CohortDelta> deltas;
+         for (unsigned long i = 0; i < inputs.size(); i++) {
+            const ScaffoldIndex &scaffold = inputs[i].scaffolds[scaffold_number];
+            std::string &buffer = buffers[i];
+            if (num_sites == 0) {
+               buffer.clear();
+            } else if (inputs[i].cohort != NULL) {
+               std::string &reference = buffers[inputs.size() + inputs[i].cohort_number];
+               if (!reference_read[inputs[i].cohort_number]) {
+                  reference.resize(num_sites);
+                  if (!inputs[i].cohort->readReference(scaffold_number, first_site, num_sites, &reference[0])) {
+                     failed_input = i;
+                     return READER_IO_ERROR;
+                  }
+                  reference_read[inputs[i].cohort_number] = 1;
+               }
+               buffer.resize(num_sites);
+               bool matches_reference;
+               if (!inputs[i].cohort->readSample(scaffold_number, inputs[i].cohort_sample, first_site, num_sites, reference.data(), deltas, &buffer[0], matches_reference)) {
+                  failed_input = i;
+                  return READER_IO_ERROR;
+               }
+               row[i].bases = matches_reference ? reference.data() : buffer.data();
+               row[i].length = num_sites;
+               continue;
+            } else if (inputs[i].packed) {
+               //Unpack from the even site at or before first_site, with the
+               // packed bytes read into the tail of the buffer:
+               uint64_t even_site = first_site & ~(uint64_t)1;
+               unsigned long unpacked_sites = first_site + num_sites - even_site;
+               unsigned long packed_bytes = (unpacked_sites+1)/2;
+               buffer.resize(unpacked_sites + packed_bytes);
+               unsigned char *packed_bytes_start = (unsigned char *)&buffer[unpacked_sites];
+               if (!preadFully(inputs[i].fd, packed_bytes_start, packed_bytes, scaffold.offset + even_site/2)) {
+                  failed_input = i;
+                  return READER_IO_ERROR;
+               }
+               unpackSites(packed_bytes_start, unpacked_sites, &buffer[0]);
+               row[i].bases = buffer.data() + (first_site - even_site);
+               row[i].length = num_sites;
+               continue;
+            } else {
+               FastaIndexEntry entry = {scaffold.header, scaffold.length, scaffold.offset, scaffold.line_bases, scaffold.line_width};
+               if (!readFastaSites(inputs[i].fd, entry, first_site, num_sites, buffer)) {
+                  failed_input = i;
+                  return READER_IO_ERROR;
+               }
+            }
+            row[i].bases = buffer.data();
+            row[i].length = num_sites;
+         }
+         return READER_SEQUENCE;
+      }
+
+      //Read the sites from first_site up to end_site of a scaffold with
+      // readRegion(), REGION_SITES at a time, calling process(row, site)
+      // with each run of sites and the position of its first site
+      reader_status readRange(unsigned long scaffold_number, uint64_t first_site, uint64_t end_site, std::function<void(std::vector<SequenceView> &, uint64_t)> process) const {
+         std::vector<std::string> buffers;
+         std::vector<SequenceView> row;
+         for (uint64_t site = first_site; site < end_site; site += REGION_SITES) {
+            unsigned long num_sites = std::min((uint64_t)REGION_SITES, end_site-site);
+            reader_status region_status = readRegion(scaffold_number, site, num_sites, buffers, row);
+            if (region_status != READER_SEQUENCE) {
+               return region_status;
+            }
+            process(row, site);
+         }
+         return READER_SEQUENCE;
+      }
+
+   private:
+      std::vector<PseudorefInput> inputs;
+      std::vector<CohortStore *> cohorts;
+      std::vector<VCFInput *> vcfs;
+      std::string VCF_reference_path;
+      std::unordered_map<std::string, unsigned long> scaffold_numbers;
+      std::string scaffold_name;
+      mutable unsigned long failed_input;
+      unsigned long failed_scaffold;
+      bool check_headers;
+
+      bool headersMatch(std::vector<SequenceView> &row) {
+         if (!check_headers) {
+            return 1;
+         }
+         for (unsigned long i = 1; i < inputs.size(); i++) {
+            if (row[i].length != row[0].length || memcmp(row[i].bases, row[0].bases, row[0].length) != 0) {
+               failed_input = i;
+               return 0;
+            }
+         }
+         return 1;
+      }
+
+      //Equivalent of readLine() for packed inputs, using their scaffold index:
+      //Each scaffold yields its header line, then its sites in lines of up to
+      // PACKED_ROW_SITES sites
+      int readPackedLine(PseudorefInput &input, SequenceView &line) {
+         if (!input.packed_in_scaffold || input.packed_site == input.index[input.packed_scaffold].length) {
+            //Move on to the next scaffold, returning its header:
+            if (input.packed_in_scaffold) {
+               input.packed_scaffold++;
+            }
+            if (input.packed_scaffold >= input.index.size()) {
+               return 0;
+            }
+            input.packed_in_scaffold = 1;
+            input.packed_site = 0;
+            input.header_line = ">" + input.index[input.packed_scaffold].header;
+            line.bases = input.header_line.data();
+            line.length = input.header_line.length();
+            return 1;
+         }
+         PackedScaffold &scaffold = input.index[input.packed_scaffold];
+         unsigned long row_sites = std::min((uint64_t)PACKED_ROW_SITES, scaffold.length - input.packed_site);
+         if (!preadFully(input.fd, input.packed_buffer, (row_sites+1)/2, scaffold.offset + input.packed_site/2)) {
+            return -1;
+         }
+         unpackSites(input.packed_buffer, row_sites, input.buffer);
+         line.bases = input.buffer;
+         line.length = row_sites;
+         input.packed_site += row_sites;
+         return 1;
+      }
+
+      //Add an input for one sample (or every sample if sample_name is
+      // empty) of a cohort store, opening the store if it isn't already
+      //Returns 1 on success, 0 if the path isn't a cohort store (when
+      // quiet), and -1 on any other error
+      int addCohortInputs(const std::string &store_path, const std::string &sample_name, bool quiet) {
+         unsigned long cohort_number = 0;
+         while (cohort_number < cohorts.size() && cohorts[cohort_number]->storePath() != store_path) {
+            cohort_number++;
+         }
+         if (cohort_number == cohorts.size()) {
+            CohortStore *cohort = new CohortStore();
+            if (!cohort->open(store_path)) {
+               delete cohort;
+               if (quiet) {
+                  return 0;
+               }
+               std::cerr << "Error reading index of cohort store: " << store_path << "." << std::endl;
+               return -1;
+            }
+            cohorts.push_back(cohort);
+         }
+         CohortStore *cohort = cohorts[cohort_number];
+         bool found_sample = 0;
+         for (unsigned long j = 0; j < cohort->numSamples(); j++) {
+            if (!sample_name.empty() && cohort->sampleName(j) != sample_name) {
+               continue;
+            }
+            found_sample = 1;
+            PseudorefInput input;
+            input.path = store_path + ":" + cohort->sampleName(j);
+            input.fd = -1;
+            input.buffer_size = COHORT_ROW_SITES;
+            input.buffer = new char[input.buffer_size];
+            input.begin = 0;
+            input.end = 0;
+            input.eof = 0;
+            input.mapped = 0;
+            input.packed = 0;
+            input.line_pending = 0;
+            input.packed_in_scaffold = 0;
+            input.packed_scaffold = 0;
+            input.packed_site = 0;
+            input.packed_buffer = NULL;
+            input.compressed = NULL;
+            input.cohort = cohort;
+            input.cohort_number = cohort_number;
+            input.cohort_sample = j;
+            input.vcf = NULL;
+            inputs.push_back(input);
+            if (!sample_name.empty()) {
+               break;
+            }
+         }
+         if (!found_sample && !sample_name.empty()) {
+            std::cerr << "No sample " << sample_name << " in cohort store " << store_path << "." << std::endl;
+            return -1;
+         }
+         return 1;
+      }
+
+      //Equivalent of readLine() for cohort samples, using the store's index:
+      //Each scaffold yields its header line, then its sites in lines of up to
+      // COHORT_ROW_SITES sites, pointing at the store's shared reference
+      // sites wherever the sample matches the reference
+      int readCohortLine(PseudorefInput &input, SequenceView &line) {
+         const std::vector<CohortScaffold> &index = input.cohort->index();
+         if (!input.packed_in_scaffold || input.packed_site == index[input.packed_scaffold].length) {
+            //Move on to the next scaffold, returning its header:
+            if (input.packed_in_scaffold) {
+               input.packed_scaffold++;
+            }
+            if (input.packed_scaffold >= index.size()) {
+               return 0;
+            }
+            input.packed_in_scaffold = 1;
+            input.packed_site = 0;
+            input.header_line = ">" + index[input.packed_scaffold].header;
+            line.bases = input.header_line.data();
+            line.length = input.header_line.length();
+            return 1;
+         }
+         unsigned long row_sites = std::min((uint64_t)COHORT_ROW_SITES, index[input.packed_scaffold].length - input.packed_site);
+         const char *reference = input.cohort->referenceChunk(input.packed_scaffold, input.packed_site, row_sites);
+         bool matches_reference;
+         if (reference == NULL || !input.cohort->readSample(input.packed_scaffold, input.cohort_sample, input.packed_site, row_sites, reference, input.cohort_deltas, input.buffer, matches_reference)) {
+            return -1;
+         }
+         line.bases = matches_reference ? reference : input.buffer;
+         line.length = row_sites;
+         input.packed_site += row_sites;
+         return 1;
+      }
+
+      //Add an input for one sample (or every sample if sample_name is
+      // empty) of a VCF, opening the VCF if it isn't already
+      //Returns 0 on error
+      bool addVCFInputs(const std::string &VCF_path, const std::string &sample_name, unsigned int decompression_threads) {
+         unsigned long vcf_number = 0;
+         while (vcf_number < vcfs.size() && vcfs[vcf_number]->VCFPath() != VCF_path) {
+            vcf_number++;
+         }
+         if (vcf_number == vcfs.size()) {
+            VCFInput *vcf = new VCFInput();
+            if (!vcf->open(VCF_path, VCF_reference_path, decompression_threads)) {
+               delete vcf;
+               return 0;
+            }
+            vcfs.push_back(vcf);
+         }
+         VCFInput *vcf = vcfs[vcf_number];
+         bool found_sample = 0;
+         for (unsigned long j = 0; j < vcf->numSamples(); j++) {
+            if (!sample_name.empty() && vcf->sampleName(j) != sample_name) {
+               continue;
+            }
+            found_sample = 1;
+            PseudorefInput input;
+            input.path = VCF_path + ":" + vcf->sampleName(j);
+            input.fd = -1;
+            input.buffer_size = 0;
+            input.buffer = NULL;
+            input.begin = 0;
+            input.end = 0;
+            input.eof = 0;
+            input.mapped = 0;
+            input.packed = 0;
+            input.line_pending = 0;
+            input.packed_in_scaffold = 0;
+            input.packed_scaffold = 0;
+            input.packed_site = 0;
+            input.packed_buffer = NULL;
+            input.compressed = NULL;
+            input.cohort = NULL;
+            input.vcf = vcf;
+            input.vcf_sample = j;
+            inputs.push_back(input);
+            if (!sample_name.empty()) {
+               break;
+            }
+         }
+         if (!found_sample) {
+            if (sample_name.empty()) {
+               std::cerr << "Input VCF " << VCF_path << " has no samples." << std::endl;
+            } else {
+               std::cerr << "No sample " << sample_name << " in input VCF " << VCF_path << "." << std::endl;
+            }
+            return 0;
+         }
+         return 1;
+      }
+
+      //Equivalent of readLine() for VCF samples:
+      //Each scaffold of the reference yields its header line, then its
+      // sites in lines of up to VCF_ROW_SITES sites, decoded once for every
+      // sample of the VCF
+      int readVCFLine(PseudorefInput &input, SequenceView &line) {
+         VCFInput *vcf = input.vcf;
+         if (!input.packed_in_scaffold || input.packed_site == vcf->scaffoldLength(input.packed_scaffold)) {
+            //Move on to the next scaffold, returning its header:
+            if (input.packed_in_scaffold) {
+               input.packed_scaffold++;
+            }
+            if (input.packed_scaffold >= vcf->numScaffolds()) {
+               return 0;
+            }
+            input.packed_in_scaffold = 1;
+            input.packed_site = 0;
+            input.header_line = ">" + vcf->scaffoldHeader(input.packed_scaffold);
+            line.bases = input.header_line.data();
+            line.length = input.header_line.length();
+            return 1;
+         }
+         unsigned long row_sites = std::min((uint64_t)VCF_ROW_SITES, vcf->scaffoldLength(input.packed_scaffold) - input.packed_site);
+         if (!vcf->loadChunk(input.packed_scaffold, input.packed_site, row_sites)) {
+            return -1;
+         }
+         line.bases = vcf->sampleSites(input.vcf_sample);
+         line.length = row_sites;
+         input.packed_site += row_sites;
+         return 1;
+      }
+
+      //Layout of one input found by preflight():
+      struct PreflightLayout {
+         std::vector<ScaffoldIndex> scaffolds;
+         bool full_headers; //Whether headers are whole lines, or just the names from a .fai
+         std::string source;
+         std::string ragged_scaffold; //First scaffold with uneven line wrapping
+         std::string error;
+      };
+
+      //Find the scaffolds of one input for preflight(), from its .fai, its
+      // index, or a scan of the FASTA:
+      void findPreflightLayout(const PseudorefInput &input, PreflightLayout &layout) {
+         layout.full_headers = 1;
+         if (input.vcf != NULL) {
+            layout.source = "VCF reference";
+            for (unsigned long k = 0; k < input.vcf->numScaffolds(); k++) {
+               ScaffoldIndex scaffold = {input.vcf->scaffoldHeader(k), input.vcf->scaffoldLength(k), 0, 0, 0};
+               layout.scaffolds.push_back(scaffold);
+            }
+            return;
+         }
+         if (input.cohort != NULL || input.packed) {
+            //The index of a packed input or store is already loaded:
+            PseudorefInput indexed_input = input;
+            loadInputIndex(indexed_input);
+            layout.scaffolds.swap(indexed_input.scaffolds);
+            layout.source = input.packed ? "packed index" : "cohort store index";
+            return;
+         }
+         //Use the .fai unless the FASTA was modified after it was made:
+         struct stat FASTA_stat, fai_stat;
+         std::vector<FastaIndexEntry> fai;
+         if (stat(input.path.c_str(), &FASTA_stat) == 0 && stat((input.path + ".fai").c_str(), &fai_stat) == 0 && fai_stat.st_mtime >= FASTA_stat.st_mtime && readFastaIndex(input.path, fai)) {
+            layout.source = ".fai";
+            //Full headers can only be recovered from an uncompressed FASTA:
+            layout.full_headers = input.compressed == NULL;
+            for (auto entry_iterator = fai.begin(); entry_iterator != fai.end(); ++entry_iterator) {
+               ScaffoldIndex scaffold = {entry_iterator->name, entry_iterator->length, entry_iterator->offset, entry_iterator->line_bases, entry_iterator->line_width};
+               if (layout.full_headers && !readFastaHeaderBefore(input.fd, entry_iterator->offset, scaffold.header)) {
+                  layout.error = "Unable to find the header of scaffold " + entry_iterator->name + ", is the .fai out of date?";
+                  return;
+               }
+               layout.scaffolds.push_back(scaffold);
+            }
+            return;
+         }
+         layout.source = "header scan";
+         scanFastaLayout(input.path, layout);
+      }
+
+      //Scan a whole FASTA (which may be gzipped) for its headers and line
+      // lengths, without keeping any of its sequence:
+      void scanFastaLayout(const std::string &FASTA_path, PreflightLayout &layout) {
+         int fd = ::open(FASTA_path.c_str(), O_RDONLY);
+         if (fd < 0) {
+            layout.error = "Unable to open FASTA for scanning";
+            return;
+         }
+         posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+         unsigned char magic[2];
+         ssize_t magic_read = pread(fd, magic, 2, 0);
+         CompressedInput *compressed = NULL;
+         if (magic_read > 0 && isGzipMagic(magic, magic_read)) {
+            compressed = new CompressedInput(fd, 1, magic, 0);
+         }
+         std::vector<char> block(READER_BLOCK_SIZE);
+         bool line_start = 1, in_header = 0;
+         uint64_t line_length = 0;
+         bool short_line_seen = 0; //A line shorter than the scaffold's first line
+         std::string header;
+         while (true) {
+            ssize_t bytes_read = compressed != NULL ? compressed->read(block.data(), block.size()) : ::read(fd, block.data(), block.size());
+            if (bytes_read < 0 && errno == EINTR) {
+               continue;
+            } else if (bytes_read < 0) {
+               layout.error = std::string("Error scanning FASTA: ") + strerror(errno);
+               break;
+            }
+            //Finish the last line at the end of the file, then finish each
+            // line at its newline:
+            unsigned long position = 0;
+            while (position < (unsigned long)bytes_read || (bytes_read == 0 && !line_start)) {
+               const char *newline = NULL;
+               if (bytes_read > 0) {
+                  if (line_start && block[position] == '>') {
+                     in_header = 1;
+                     header.clear();
+                     position++;
+                  }
+                  line_start = 0;
+                  newline = (const char *)memchr(block.data()+position, '\n', bytes_read-position);
+                  unsigned long segment_end = newline != NULL ? newline - block.data() : bytes_read;
+                  if (in_header) {
+                     header.append(block.data()+position, segment_end-position);
+                  } else {
+                     line_length += segment_end-position;
+                  }
+                  position = segment_end + 1;
+                  if (newline == NULL) {
+                     break;
+                  }
+               }
+               if (in_header) {
+                  ScaffoldIndex scaffold = {header, 0, 0, 0, 0};
+                  layout.scaffolds.push_back(scaffold);
+                  short_line_seen = 0;
+                  in_header = 0;
+               } else if (line_length > 0) {
+                  if (layout.scaffolds.empty()) {
+                     layout.error = "Sequence before the first header";
+                     break;
+                  }
+                  ScaffoldIndex &scaffold = layout.scaffolds.back();
+                  if (scaffold.line_bases == 0) {
+                     scaffold.line_bases = line_length;
+                     scaffold.line_width = line_length + 1;
+                  } else if (short_line_seen || line_length > scaffold.line_bases) {
+                     if (layout.ragged_scaffold.empty()) {
+                        layout.ragged_scaffold = scaffold.header;
+                     }
+                  }
+                  short_line_seen = short_line_seen || line_length < scaffold.line_bases;
+                  scaffold.length += line_length;
+               }
+               line_length = 0;
+               line_start = 1;
+            }
+            if (bytes_read == 0 || !layout.error.empty()) {
+               break;
+            }
+         }
+         delete compressed;
+         ::close(fd);
+      }
+
+      //Compare an input's layout to the first input's, reporting the first
+      // difference:
+      reader_status comparePreflightLayouts(const PreflightLayout &first_layout, const PreflightLayout &layout, unsigned long which_input) {
+         const std::string &input_path = inputs[which_input].path;
+         unsigned long shared_scaffolds = std::min(first_layout.scaffolds.size(), layout.scaffolds.size());
+         for (unsigned long k = 0; k < shared_scaffolds; k++) {
+            const ScaffoldIndex &expected = first_layout.scaffolds[k];
+            const ScaffoldIndex &scaffold = layout.scaffolds[k];
+            //Compare names if either side only has the names from a .fai:
+            bool same_header = first_layout.full_headers && layout.full_headers ? scaffold.header == expected.header : scaffold.header.substr(0, scaffold.header.find_first_of(" \t")) == expected.header.substr(0, expected.header.find_first_of(" \t"));
+            if (check_headers && !same_header) {
+               std::cerr << "Preflight: " << input_path << ": scaffold " << k+1 << " is " << scaffold.header << ", but is " << expected.header << " in " << inputs[0].path << std::endl;
+               failed_scaffold = k;
+               return READER_HEADERS_DIFFER;
+            }
+            if (scaffold.length != expected.length) {
+               std::cerr << "Preflight: " << input_path << ": scaffold " << scaffold.header << " has " << scaffold.length << " sites, but has " << expected.length << " in " << inputs[0].path << std::endl;
+               failed_scaffold = k;
+               return READER_NOT_SYNCHRONIZED;
+            }
+         }
+         if (layout.scaffolds.size() != first_layout.scaffolds.size()) {
+            const PreflightLayout &longer_layout = layout.scaffolds.size() > first_layout.scaffolds.size() ? layout : first_layout;
+            std::cerr << "Preflight: " << input_path << " has " << layout.scaffolds.size() << " scaffolds, but " << inputs[0].path << " has " << first_layout.scaffolds.size() << ", starting with " << longer_layout.scaffolds[shared_scaffolds].header << std::endl;
+            failed_scaffold = shared_scaffolds;
+            return READER_NOT_SYNCHRONIZED;
+         }
+         return READER_SEQUENCE;
+      }
+
+      //Fill in the scaffolds of one input from its packed index or .fai
+      bool loadInputIndex(PseudorefInput &input) {
+         input.scaffolds.clear();
+         if (input.vcf != NULL) {
+            std::cerr << "Cannot seek within input VCF " << input.path << ", please give FASTA, packed, or cohort store inputs to use an index." << std::endl;
+            return 0;
+         }
+         if (input.cohort != NULL) {
+            const std::vector<CohortScaffold> &index = input.cohort->index();
+            for (auto scaffold_iterator = index.begin(); scaffold_iterator != index.end(); ++scaffold_iterator) {
+               ScaffoldIndex scaffold = {scaffold_iterator->header, scaffold_iterator->length, scaffold_iterator->reference_offset, 0, 0};
+               input.scaffolds.push_back(scaffold);
+            }
+            return 1;
+         }
+         if (input.packed) {
+            for (auto scaffold_iterator = input.index.begin(); scaffold_iterator != input.index.end(); ++scaffold_iterator) {
+               ScaffoldIndex scaffold = {scaffold_iterator->header, scaffold_iterator->length, scaffold_iterator->offset, 0, 0};
+               input.scaffolds.push_back(scaffold);
+            }
+            return 1;
+         }
+         if (input.compressed != NULL) {
+            std::cerr << "Cannot seek within compressed FASTA " << input.path << ", please decompress it to use a .fai index." << std::endl;
+            return 0;
+         }
+         std::vector<FastaIndexEntry> fai;
+         if (!readFastaIndex(input.path, fai)) {
+            std::cerr << "Error reading index " << input.path << ".fai, please index the FASTA with samtools faidx." << std::endl;
+            return 0;
+         }
+         for (auto entry_iterator = fai.begin(); entry_iterator != fai.end(); ++entry_iterator) {
+            ScaffoldIndex scaffold = {"", entry_iterator->length, entry_iterator->offset, entry_iterator->line_bases, entry_iterator->line_width};
+            //The .fai only keeps the first word of the header, so recover
+            // the full header line that ends just before the sequence:
+            if (!readFastaHeaderBefore(input.fd, entry_iterator->offset, scaffold.header)) {
+               std::cerr << "Error finding header of scaffold " << entry_iterator->name << " in " << input.path << ", is the .fai out of date?" << std::endl;
+               return 0;
+            }
+            input.scaffolds.push_back(scaffold);
+         }
+         return 1;
+      }
+
+      //Map a regular file in its entirety, returning 0 if it can't be mapped:
+      bool mapInput(PseudorefInput &input) {
+         struct stat input_stat;
+         if (fstat(input.fd, &input_stat) != 0 || !S_ISREG(input_stat.st_mode)) {
+            return 0;
+         }
+         input.buffer_size = input_stat.st_size;
+         input.buffer = NULL;
+         if (input.buffer_size > 0) {
+            void *mapping = mmap(NULL, input.buffer_size, PROT_READ, MAP_PRIVATE, input.fd, 0);
+            if (mapping == MAP_FAILED) {
+               return 0;
+            }
+            madvise(mapping, input.buffer_size, MADV_SEQUENTIAL);
+            input.buffer = (char *)mapping;
+         }
+         posix_fadvise(input.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+         input.end = input.buffer_size;
+         input.eof = 1; //Everything is already in the buffer
+         input.mapped = 1;
+         return 1;
+      }
+
+      //Read the next line of a FASTA into a view of its buffer
+      //Returns 1 on success, 0 at end of file, and -1 on a read error
+      int readLine(PseudorefInput &input, SequenceView &line) {
+         unsigned long search_start = input.begin;
+         while (true) {
+            char *newline = NULL;
+            if (input.end > search_start) {
+               newline = (char *)memchr(input.buffer+search_start, '\n', input.end-search_start);
+            }
+            if (newline != NULL) {
+               line.bases = input.buffer+input.begin;
+               line.length = newline - line.bases;
+               input.begin += line.length + 1;
+               return 1;
+            }
+            if (input.eof) { //Last line may lack a newline
+               if (input.begin == input.end) {
+                  return 0;
+               }
+               line.bases = input.buffer+input.begin;
+               line.length = input.end - input.begin;
+               input.begin = input.end;
+               return 1;
+            }
+            //Move the partial line to the front of the buffer, growing it if the line fills it:
+            unsigned long partial_length = input.end - input.begin;
+            if (partial_length == input.buffer_size) {
+               char *larger_buffer = new char[input.buffer_size*2];
+               memcpy(larger_buffer, input.buffer+input.begin, partial_length);
+               delete[] input.buffer;
+               input.buffer = larger_buffer;
+               input.buffer_size *= 2;
+            } else if (input.begin > 0) {
+               memmove(input.buffer, input.buffer+input.begin, partial_length);
+            }
+            input.begin = 0;
+            input.end = partial_length;
+            search_start = partial_length;
+            ssize_t bytes_read;
+            if (input.compressed != NULL) {
+               bytes_read = input.compressed->read(input.buffer+input.end, input.buffer_size-input.end);
+            } else {
+               bytes_read = ::read(input.fd, input.buffer+input.end, input.buffer_size-input.end);
+            }
+            if (bytes_read < 0) {
+               if (errno == EINTR) {
+                  continue;
+               }
+               return -1;
+            } else if (bytes_read == 0) {
+               input.eof = 1;
+            }
+            input.end += bytes_read;
+         }
+      }
+};
+
+#endif
@@ -0,0 +1,514 @@
+/****************************************************************************
+ * simdKernels.h                                                            *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Vectorized versions of the per-site loops, for SSE4.2, AVX2, and         *
+ *  AVX-512 (AVX-512BW), with a scalar fallback.  The best version the CPU  *
+ *  supports is picked once by CPUID, so one binary runs at full speed on   *
+ *  every generation of x86-64 node, and other CPUs use the scalar code.    *
+ * countBlockAlleles() counts the homozygous and het alleles of a group of  *
+ *  samples at each site of a block of up to TILE_SITES sites, reading each *
+ *  sample's row directly (so no transpose is needed), and classifying 16,  *
+ *  32, or 64 sites per instruction.                                        *
+ * classifyPolyDivSites() and softmaskRun() compare the bases of two rows   *
+ *  16, 32, or 64 sites at a time, for listPolyDivSites and                 *
+ *  softmaskFromHardmask.                                                   *
+ * Every version decodes bases exactly as baseDecodeTable() does.           *
+ ****************************************************************************/
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include "pseudorefReader.h"
+#include "siteKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+//Instruction sets the kernels come in, from slowest to fastest:
+enum simd_level {SIMD_SCALAR, SIMD_SSE42, SIMD_AVX2, SIMD_AVX512};
+
+//Best instruction set this CPU (and OS) supports:
+inline simd_level detectSimdLevel() {
+#ifdef SIMD_KERNELS_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512bw")) {
+      return SIMD_AVX512;
+   }
+   if (__builtin_cpu_supports("avx2")) {
+      return SIMD_AVX2;
+   }
+   if (__builtin_cpu_supports("sse4.2")) {
+      return SIMD_SSE42;
+   }
+#endif
+   return SIMD_SCALAR;
+}
+
+//Instruction set the kernels use, detected the first time it's needed:
+inline simd_level &activeSimdLevel() {
+   static simd_level level = detectSimdLevel();
+   return level;
+}
+inline simd_level simdLevel() {
+   return activeSimdLevel();
+}
+
+//Use at most this instruction set (e.g. to compare versions), returning
+// the one actually used:
+inline simd_level setSimdLevel(simd_level level) {
+   simd_level detected = detectSimdLevel();
+   activeSimdLevel() = level < detected ? level : detected;
+   return activeSimdLevel();
+}
+
+inline const char *simdLevelName(simd_level level) {
+   switch (level) {
+      case SIMD_AVX512:
+         return "AVX-512";
+      case SIMD_AVX2:
+         return "AVX2";
+      case SIMD_SSE42:
+         return "SSE4.2";
+      default:
+         return "scalar";
+   }
+}
+
+//Allele counts of a group of samples at each site of a block:
+struct BlockAlleleCounts {
+   uint32_t homozygous[4][TILE_SITES]; //Samples homozygous for A, C, G, T
+   uint32_t het_alleles[4][TILE_SITES]; //Het samples with an A, C, G, T allele
+};
+
+//Fill in the A, C, G, T, N, and non-N allele counts (as in calculateDxy)
+// of one site of a block counted over num_samples samples
+//Returns 0 instead for an inbred site with hets, whose alleles have to be
+// drawn sample by sample
+inline bool blockSiteAlleles(const BlockAlleleCounts &counts, unsigned long num_samples, unsigned long block_site, bool inbred, unsigned long *allele_counts) {
+   unsigned long het_alleles = counts.het_alleles[0][block_site] + counts.het_alleles[1][block_site] + counts.het_alleles[2][block_site] + counts.het_alleles[3][block_site];
+   if (inbred && het_alleles > 0) {
+      return 0;
+   }
+   unsigned long nonN_alleles = 0;
+   for (unsigned int b = 0; b < 4; b++) {
+      allele_counts[b] = (inbred ? 1 : 2)*counts.homozygous[b][block_site] + counts.het_alleles[b][block_site];
+      nonN_alleles += allele_counts[b];
+   }
+   allele_counts[4] = (inbred ? 1 : 2)*num_samples - nonN_alleles;
+   allele_counts[5] = nonN_alleles;
+   return 1;
+}
+
+//Copy one site of every row, e.g. to draw inbred alleles in sample order:
+inline void gatherSite(const std::vector<SequenceView> &rows, unsigned long site, std::vector<char> &site_bases) {
+   site_bases.resize(rows.size());
+   for (unsigned long j = 0; j < rows.size(); j++) {
+      site_bases[j] = rows[j].bases[site];
+   }
+}
+
+//Kinds of difference classifyPolyDivSites() lists as variant:
+#define POLYDIV_ALL 0 //Any difference from the reference
+#define POLYDIV_POLYMORPHISMS 1 //A het query that differs from the reference
+#define POLYDIV_DIVERGENCES 2 //A homozygous query that differs from the reference
+
+//Classes of sites from classifyPolyDivSites():
+#define SITE_NOT_VARIANT 0
+#define SITE_VARIANT 1
+#define SITE_MASKED 2 //Either base is N (or anything not a base or het code)
+
+//Most samples added up in 8-bit lanes before adding them to the block counts:
+#define SIMD_BATCH_SAMPLES 255
+
+inline void countBlockAllelesScalar(const SequenceView *rows, const unsigned long *samples, unsigned long num_samples, unsigned long first_site, unsigned long block_start, unsigned long block_end, BlockAlleleCounts &counts) {
+   const BaseDecode *decode = baseDecodeTable();
+   for (unsigned long j = 0; j < num_samples; j++) {
+      const char *bases = rows[samples[j]].bases + first_site;
+      for (unsigned long i = block_start; i < block_end; i++) {
+         const BaseDecode &base_decode = decode[(unsigned char)bases[i]];
+         if (base_decode.het) {
+            counts.het_alleles[base_decode.het_alleles[0]][i]++;
+            counts.het_alleles[base_decode.het_alleles[1]][i]++;
+         } else {
+            for (unsigned int b = 0; b < 4; b++) {
+               counts.homozygous[b][i] += base_decode.counts[1][b];
+            }
+         }
+      }
+   }
+}
+
+inline void classifyPolyDivSitesScalar(const char *ref, const char *query, unsigned long start, unsigned long end, int mode, unsigned char *site_classes) {
+   const BaseDecode *decode = baseDecodeTable();
+   for (unsigned long i = start; i < end; i++) {
+      const BaseDecode &refbase = decode[(unsigned char)ref[i]];
+      const BaseDecode &querybase = decode[(unsigned char)query[i]];
+      if (refbase.missing || querybase.missing) {
+         site_classes[i] = SITE_MASKED;
+      } else if (refbase.code == querybase.code) {
+         site_classes[i] = SITE_NOT_VARIANT;
+      } else if (mode == POLYDIV_POLYMORPHISMS) {
+         site_classes[i] = querybase.het ? SITE_VARIANT : SITE_NOT_VARIANT;
+      } else if (mode == POLYDIV_DIVERGENCES) {
+         site_classes[i] = querybase.het ? SITE_NOT_VARIANT : SITE_VARIANT;
+      } else {
+         site_classes[i] = SITE_VARIANT;
+      }
+   }
+}
+
+inline void softmaskRunScalar(const char *unmasked, const char *hardmasked, unsigned long start, unsigned long end, char *softmasked) {
+   for (unsigned long i = start; i < end; i++) {
+      //Force to uppercase for comparison:
+      int unmaskedbase = toupper(unmasked[i]);
+      int hardmaskedbase = toupper(hardmasked[i]);
+      if (unmaskedbase != 'N' && hardmaskedbase == 'N') {
+         softmasked[i] = tolower(unmaskedbase);
+      } else {
+         softmasked[i] = unmaskedbase;
+      }
+   }
+}
+
+#ifdef SIMD_KERNELS_X86
+//Add the 8-bit lane counts of a batch of samples (homozygous A, C, G, T,
+// then het A, C, G, T, each lane_stride lanes apart) to the block counts:
+inline void addLaneCounts(const uint8_t *lane_counts, unsigned long lane_stride, unsigned long num_lanes, unsigned long block_site, BlockAlleleCounts &counts) {
+   for (unsigned int b = 0; b < 4; b++) {
+      for (unsigned long k = 0; k < num_lanes; k++) {
+         counts.homozygous[b][block_site+k] += lane_counts[b*lane_stride+k];
+         counts.het_alleles[b][block_site+k] += lane_counts[(b+4)*lane_stride+k];
+      }
+   }
+}
+
+__attribute__((target("sse4.2")))
+inline void countBlockAllelesSSE42(const SequenceView *rows, const unsigned long *samples, unsigned long num_samples, unsigned long first_site, unsigned long num_sites, BlockAlleleCounts &counts) {
+   unsigned long vector_sites = num_sites - num_sites % 16;
+   const __m128i case_mask = _mm_set1_epi8((char)0xDF);
+   for (unsigned long block_site = 0; block_site < vector_sites; block_site += 16) {
+      for (unsigned long batch_start = 0; batch_start < num_samples; batch_start += SIMD_BATCH_SAMPLES) {
+         unsigned long batch_end = num_samples - batch_start > SIMD_BATCH_SAMPLES ? batch_start + SIMD_BATCH_SAMPLES : num_samples;
+         __m128i lanes[8];
+         for (unsigned int b = 0; b < 8; b++) {
+            lanes[b] = _mm_setzero_si128();
+         }
+         for (unsigned long j = batch_start; j < batch_end; j++) {
+            //Clearing bit 5 makes lowercase uppercase:
+            __m128i bases = _mm_and_si128(_mm_loadu_si128((const __m128i *)(rows[samples[j]].bases + first_site + block_site)), case_mask);
+            __m128i is_K = _mm_cmpeq_epi8(bases, _mm_set1_epi8('K'));
+            __m128i is_M = _mm_cmpeq_epi8(bases, _mm_set1_epi8('M'));
+            __m128i is_R = _mm_cmpeq_epi8(bases, _mm_set1_epi8('R'));
+            __m128i is_S = _mm_cmpeq_epi8(bases, _mm_set1_epi8('S'));
+            __m128i is_W = _mm_cmpeq_epi8(bases, _mm_set1_epi8('W'));
+            __m128i is_Y = _mm_cmpeq_epi8(bases, _mm_set1_epi8('Y'));
+            //Matching lanes are -1, so subtracting them counts matches:
+            lanes[0] = _mm_sub_epi8(lanes[0], _mm_cmpeq_epi8(bases, _mm_set1_epi8('A')));
+            lanes[1] = _mm_sub_epi8(lanes[1], _mm_cmpeq_epi8(bases, _mm_set1_epi8('C')));
+            lanes[2] = _mm_sub_epi8(lanes[2], _mm_cmpeq_epi8(bases, _mm_set1_epi8('G')));
+            lanes[3] = _mm_sub_epi8(lanes[3], _mm_cmpeq_epi8(bases, _mm_set1_epi8('T')));
+            lanes[4] = _mm_sub_epi8(lanes[4], _mm_or_si128(_mm_or_si128(is_M, is_R), is_W));
+            lanes[5] = _mm_sub_epi8(lanes[5], _mm_or_si128(_mm_or_si128(is_M, is_S), is_Y));
+            lanes[6] = _mm_sub_epi8(lanes[6], _mm_or_si128(_mm_or_si128(is_K, is_R), is_S));
+            lanes[7] = _mm_sub_epi8(lanes[7], _mm_or_si128(_mm_or_si128(is_K, is_W), is_Y));
+         }
+         uint8_t lane_counts[8*16];
+         for (unsigned int b = 0; b < 8; b++) {
+            _mm_storeu_si128((__m128i *)(lane_counts + b*16), lanes[b]);
+         }
+         addLaneCounts(lane_counts, 16, 16, block_site, counts);
+      }
+   }
+   countBlockAllelesScalar(rows, samples, num_samples, first_site, vector_sites, num_sites, counts);
+}
+
+__attribute__((target("avx2")))
+inline void countBlockAllelesAVX2(const SequenceView *rows, const unsigned long *samples, unsigned long num_samples, unsigned long first_site, unsigned long num_sites, BlockAlleleCounts &counts) {
+   unsigned long vector_sites = num_sites - num_sites % 32;
+   const __m256i case_mask = _mm256_set1_epi8((char)0xDF);
+   for (unsigned long block_site = 0; block_site < vector_sites; block_site += 32) {
+      for (unsigned long batch_start = 0; batch_start < num_samples; batch_start += SIMD_BATCH_SAMPLES) {
+         unsigned long batch_end = num_samples - batch_start > SIMD_BATCH_SAMPLES ? batch_start + SIMD_BATCH_SAMPLES : num_samples;
+         __m256i lanes[8];
+         for (unsigned int b = 0; b < 8; b++) {
+            lanes[b] = _mm256_setzero_si256();
+         }
+         for (unsigned long j = batch_start; j < batch_end; j++) {
+            __m256i bases = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(rows[samples[j]].bases + first_site + block_site)), case_mask);
+            __m256i is_K = _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('K'));
+            __m256i is_M = _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('M'));
+            __m256i is_R = _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('R'));
+            __m256i is_S = _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('S'));
+            __m256i is_W = _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('W'));
+            __m256i is_Y = _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('Y'));
+            lanes[0] = _mm256_sub_epi8(lanes[0], _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('A')));
+            lanes[1] = _mm256_sub_epi8(lanes[1], _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('C')));
+            lanes[2] = _mm256_sub_epi8(lanes[2], _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('G')));
+            lanes[3] = _mm256_sub_epi8(lanes[3], _mm256_cmpeq_epi8(bases, _mm256_set1_epi8('T')));
+            lanes[4] = _mm256_sub_epi8(lanes[4], _mm256_or_si256(_mm256_or_si256(is_M, is_R), is_W));
+            lanes[5] = _mm256_sub_epi8(lanes[5], _mm256_or_si256(_mm256_or_si256(is_M, is_S), is_Y));
+            lanes[6] = _mm256_sub_epi8(lanes[6], _mm256_or_si256(_mm256_or_si256(is_K, is_R), is_S));
+            lanes[7] = _mm256_sub_epi8(lanes[7], _mm256_or_si256(_mm256_or_si256(is_K, is_W), is_Y));
+         }
+         uint8_t lane_counts[8*32];
+         for (unsigned int b = 0; b < 8; b++) {
+            _mm256_storeu_si256((__m256i *)(lane_counts + b*32), lanes[b]);
+         }
+         addLaneCounts(lane_counts, 32, 32, block_site, counts);
+      }
+   }
+   countBlockAllelesScalar(rows, samples, num_samples, first_site, vector_sites, num_sites, counts);
+}
+
+//Mask of the first num_sites (at most 64) lanes:
+inline __mmask64 firstLanesMask(unsigned long num_sites) {
+   return num_sites >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << num_sites) - 1;
+}
+
+//The masked loads don't read past the block, so there's no scalar tail:
+__attribute__((target("avx512bw")))
+inline void countBlockAllelesAVX512(const SequenceView *rows, const unsigned long *samples, unsigned long num_samples, unsigned long first_site, unsigned long num_sites, BlockAlleleCounts &counts) {
+   const __m512i case_mask = _mm512_set1_epi8((char)0xDF);
+   const __m512i one = _mm512_set1_epi8(1);
+   for (unsigned long block_site = 0; block_site < num_sites; block_site += 64) {
+      unsigned long chunk_sites = num_sites - block_site > 64 ? 64 : num_sites - block_site;
+      __mmask64 load_mask = firstLanesMask(chunk_sites);
+      for (unsigned long batch_start = 0; batch_start < num_samples; batch_start += SIMD_BATCH_SAMPLES) {
+         unsigned long batch_end = num_samples - batch_start > SIMD_BATCH_SAMPLES ? batch_start + SIMD_BATCH_SAMPLES : num_samples;
+         __m512i lanes[8];
+         for (unsigned int b = 0; b < 8; b++) {
+            lanes[b] = _mm512_setzero_si512();
+         }
+         for (unsigned long j = batch_start; j < batch_end; j++) {
+            __m512i bases = _mm512_and_si512(_mm512_maskz_loadu_epi8(load_mask, rows[samples[j]].bases + first_site + block_site), case_mask);
+            __mmask64 is_K = _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('K'));
+            __mmask64 is_M = _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('M'));
+            __mmask64 is_R = _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('R'));
+            __mmask64 is_S = _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('S'));
+            __mmask64 is_W = _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('W'));
+            __mmask64 is_Y = _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('Y'));
+            lanes[0] = _mm512_mask_add_epi8(lanes[0], _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('A')), lanes[0], one);
+            lanes[1] = _mm512_mask_add_epi8(lanes[1], _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('C')), lanes[1], one);
+            lanes[2] = _mm512_mask_add_epi8(lanes[2], _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('G')), lanes[2], one);
+            lanes[3] = _mm512_mask_add_epi8(lanes[3], _mm512_cmpeq_epi8_mask(bases, _mm512_set1_epi8('T')), lanes[3], one);
+            lanes[4] = _mm512_mask_add_epi8(lanes[4], is_M | is_R | is_W, lanes[4], one);
+            lanes[5] = _mm512_mask_add_epi8(lanes[5], is_M | is_S | is_Y, lanes[5], one);
+            lanes[6] = _mm512_mask_add_epi8(lanes[6], is_K | is_R | is_S, lanes[6], one);
+            lanes[7] = _mm512_mask_add_epi8(lanes[7], is_K | is_W | is_Y, lanes[7], one);
+         }
+         uint8_t lane_counts[8*64];
+         for (unsigned int b = 0; b < 8; b++) {
+            _mm512_storeu_si512((void *)(lane_counts + b*64), lanes[b]);
+         }
+         addLaneCounts(lane_counts, 64, chunk_sites, block_site, counts);
+      }
+   }
+}
+
+__attribute__((target("sse4.2")))
+inline void classifyPolyDivSitesSSE42(const char *ref, const char *query, unsigned long length, int mode, unsigned char *site_classes) {
+   unsigned long vector_sites = length - length % 16;
+   const __m128i case_mask = _mm_set1_epi8((char)0xDF);
+   for (unsigned long i = 0; i < vector_sites; i += 16) {
+      __m128i refbases = _mm_and_si128(_mm_loadu_si128((const __m128i *)(ref + i)), case_mask);
+      __m128i querybases = _mm_and_si128(_mm_loadu_si128((const __m128i *)(query + i)), case_mask);
+      __m128i ref_hom = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(refbases, _mm_set1_epi8('A')), _mm_cmpeq_epi8(refbases, _mm_set1_epi8('C'))), _mm_or_si128(_mm_cmpeq_epi8(refbases, _mm_set1_epi8('G')), _mm_cmpeq_epi8(refbases, _mm_set1_epi8('T'))));
+      __m128i ref_het = _mm_or_si128(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(refbases, _mm_set1_epi8('K')), _mm_cmpeq_epi8(refbases, _mm_set1_epi8('M'))), _mm_or_si128(_mm_cmpeq_epi8(refbases, _mm_set1_epi8('R')), _mm_cmpeq_epi8(refbases, _mm_set1_epi8('S')))), _mm_or_si128(_mm_cmpeq_epi8(refbases, _mm_set1_epi8('W')), _mm_cmpeq_epi8(refbases, _mm_set1_epi8('Y'))));
+      __m128i query_hom = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(querybases, _mm_set1_epi8('A')), _mm_cmpeq_epi8(querybases, _mm_set1_epi8('C'))), _mm_or_si128(_mm_cmpeq_epi8(querybases, _mm_set1_epi8('G')), _mm_cmpeq_epi8(querybases, _mm_set1_epi8('T'))));
+      __m128i query_het = _mm_or_si128(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(querybases, _mm_set1_epi8('K')), _mm_cmpeq_epi8(querybases, _mm_set1_epi8('M'))), _mm_or_si128(_mm_cmpeq_epi8(querybases, _mm_set1_epi8('R')), _mm_cmpeq_epi8(querybases, _mm_set1_epi8('S')))), _mm_or_si128(_mm_cmpeq_epi8(querybases, _mm_set1_epi8('W')), _mm_cmpeq_epi8(querybases, _mm_set1_epi8('Y'))));
+      __m128i present = _mm_and_si128(_mm_or_si128(ref_hom, ref_het), _mm_or_si128(query_hom, query_het));
+      //Lanes where the bases differ:
+      __m128i variant = _mm_andnot_si128(_mm_cmpeq_epi8(refbases, querybases), _mm_set1_epi8(-1));
+      if (mode == POLYDIV_POLYMORPHISMS) {
+         variant = _mm_and_si128(variant, query_het);
+      } else if (mode == POLYDIV_DIVERGENCES) {
+         variant = _mm_and_si128(variant, query_hom);
+      }
+      __m128i classes = _mm_blendv_epi8(_mm_set1_epi8(SITE_MASKED), _mm_and_si128(variant, _mm_set1_epi8(SITE_VARIANT)), present);
+      _mm_storeu_si128((__m128i *)(site_classes + i), classes);
+   }
+   classifyPolyDivSitesScalar(ref, query, vector_sites, length, mode, site_classes);
+}
+
+__attribute__((target("avx2")))
+inline void classifyPolyDivSitesAVX2(const char *ref, const char *query, unsigned long length, int mode, unsigned char *site_classes) {
+   unsigned long vector_sites = length - length % 32;
+   const __m256i case_mask = _mm256_set1_epi8((char)0xDF);
+   for (unsigned long i = 0; i < vector_sites; i += 32) {
+      __m256i refbases = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(ref + i)), case_mask);
+      __m256i querybases = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(query + i)), case_mask);
+      __m256i ref_hom = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('C'))), _mm256_or_si256(_mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('T'))));
+      __m256i ref_het = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('K')), _mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('M'))), _mm256_or_si256(_mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('R')), _mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('S')))), _mm256_or_si256(_mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('W')), _mm256_cmpeq_epi8(refbases, _mm256_set1_epi8('Y'))));
+      __m256i query_hom = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('C'))), _mm256_or_si256(_mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('T'))));
+      __m256i query_het = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('K')), _mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('M'))), _mm256_or_si256(_mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('R')), _mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('S')))), _mm256_or_si256(_mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('W')), _mm256_cmpeq_epi8(querybases, _mm256_set1_epi8('Y'))));
+      __m256i present = _mm256_and_si256(_mm256_or_si256(ref_hom, ref_het), _mm256_or_si256(query_hom, query_het));
+      __m256i variant = _mm256_andnot_si256(_mm256_cmpeq_epi8(refbases, querybases), _mm256_set1_epi8(-1));
+      if (mode == POLYDIV_POLYMORPHISMS) {
+         variant = _mm256_and_si256(variant, query_het);
+      } else if (mode == POLYDIV_DIVERGENCES) {
+         variant = _mm256_and_si256(variant, query_hom);
+      }
+      __m256i classes = _mm256_blendv_epi8(_mm256_set1_epi8(SITE_MASKED), _mm256_and_si256(variant, _mm256_set1_epi8(SITE_VARIANT)), present);
+      _mm256_storeu_si256((__m256i *)(site_classes + i), classes);
+   }
+   classifyPolyDivSitesScalar(ref, query, vector_sites, length, mode, site_classes);
+}
+
+__attribute__((target("avx512bw")))
+inline void classifyPolyDivSitesAVX512(const char *ref, const char *query, unsigned long length, int mode, unsigned char *site_classes) {
+   const __m512i case_mask = _mm512_set1_epi8((char)0xDF);
+   for (unsigned long i = 0; i < length; i += 64) {
+      __mmask64 load_mask = firstLanesMask(length - i);
+      __m512i refbases = _mm512_and_si512(_mm512_maskz_loadu_epi8(load_mask, ref + i), case_mask);
+      __m512i querybases = _mm512_and_si512(_mm512_maskz_loadu_epi8(load_mask, query + i), case_mask);
+      __mmask64 ref_hom = _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('A')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('C')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('G')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('T'));
+      __mmask64 ref_het = _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('K')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('M')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('R')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('S')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('W')) | _mm512_cmpeq_epi8_mask(refbases, _mm512_set1_epi8('Y'));
+      __mmask64 query_hom = _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('A')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('C')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('G')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('T'));
+      __mmask64 query_het = _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('K')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('M')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('R')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('S')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('W')) | _mm512_cmpeq_epi8_mask(querybases, _mm512_set1_epi8('Y'));
+      __mmask64 present = (ref_hom | ref_het) & (query_hom | query_het);
+      __mmask64 variant = _mm512_cmpneq_epi8_mask(refbases, querybases);
+      if (mode == POLYDIV_POLYMORPHISMS) {
+         variant &= query_het;
+      } else if (mode == POLYDIV_DIVERGENCES) {
+         variant &= query_hom;
+      }
+      __m512i classes = _mm512_mask_blend_epi8(present, _mm512_set1_epi8(SITE_MASKED), _mm512_maskz_mov_epi8(variant, _mm512_set1_epi8(SITE_VARIANT)));
+      _mm512_mask_storeu_epi8(site_classes + i, load_mask, classes);
+   }
+}
+
+//Lanes of bytes from first_letter to first_letter+25 (a-z or A-Z, the only
+// bytes toupper() or tolower() change in the C locale):
+__attribute__((target("sse4.2")))
+inline __m128i inLetterRangeSSE42(__m128i bytes, char first_letter) {
+   __m128i offsets = _mm_sub_epi8(bytes, _mm_set1_epi8(first_letter));
+   return _mm_cmpeq_epi8(_mm_min_epu8(offsets, _mm_set1_epi8(25)), offsets);
+}
+
+__attribute__((target("sse4.2")))
+inline void softmaskRunSSE42(const char *unmasked, const char *hardmasked, unsigned long length, char *softmasked) {
+   unsigned long vector_sites = length - length % 16;
+   const __m128i case_bit = _mm_set1_epi8(0x20);
+   for (unsigned long i = 0; i < vector_sites; i += 16) {
+      __m128i unmaskedbases = _mm_loadu_si128((const __m128i *)(unmasked + i));
+      __m128i hardmaskedbases = _mm_loadu_si128((const __m128i *)(hardmasked + i));
+      unmaskedbases = _mm_sub_epi8(unmaskedbases, _mm_and_si128(inLetterRangeSSE42(unmaskedbases, 'a'), case_bit));
+      hardmaskedbases = _mm_sub_epi8(hardmaskedbases, _mm_and_si128(inLetterRangeSSE42(hardmaskedbases, 'a'), case_bit));
+      __m128i to_mask = _mm_andnot_si128(_mm_cmpeq_epi8(unmaskedbases, _mm_set1_epi8('N')), _mm_cmpeq_epi8(hardmaskedbases, _mm_set1_epi8('N')));
+      to_mask = _mm_and_si128(to_mask, inLetterRangeSSE42(unmaskedbases, 'A'));
+      _mm_storeu_si128((__m128i *)(softmasked + i), _mm_add_epi8(unmaskedbases, _mm_and_si128(to_mask, case_bit)));
+   }
+   softmaskRunScalar(unmasked, hardmasked, vector_sites, length, softmasked);
+}
+
+__attribute__((target("avx2")))
+inline __m256i inLetterRangeAVX2(__m256i bytes, char first_letter) {
+   __m256i offsets = _mm256_sub_epi8(bytes, _mm256_set1_epi8(first_letter));
+   return _mm256_cmpeq_epi8(_mm256_min_epu8(offsets, _mm256_set1_epi8(25)), offsets);
+}
+
+__attribute__((target("avx2")))
+inline void softmaskRunAVX2(const char *unmasked, const char *hardmasked, unsigned long length, char *softmasked) {
+   unsigned long vector_sites = length - length % 32;
+   const __m256i case_bit = _mm256_set1_epi8(0x20);
+   for (unsigned long i = 0; i < vector_sites; i += 32) {
+      __m256i unmaskedbases = _mm256_loadu_si256((const __m256i *)(unmasked + i));
+      __m256i hardmaskedbases = _mm256_loadu_si256((const __m256i *)(hardmasked + i));
+      unmaskedbases = _mm256_sub_epi8(unmaskedbases, _mm256_and_si256(inLetterRangeAVX2(unmaskedbases, 'a'), case_bit));
+      hardmaskedbases = _mm256_sub_epi8(hardmaskedbases, _mm256_and_si256(inLetterRangeAVX2(hardmaskedbases, 'a'), case_bit));
+      __m256i to_mask = _mm256_andnot_si256(_mm256_cmpeq_epi8(unmaskedbases, _mm256_set1_epi8('N')), _mm256_cmpeq_epi8(hardmaskedbases, _mm256_set1_epi8('N')));
+      to_mask = _mm256_and_si256(to_mask, inLetterRangeAVX2(unmaskedbases, 'A'));
+      _mm256_storeu_si256((__m256i *)(softmasked + i), _mm256_add_epi8(unmaskedbases, _mm256_and_si256(to_mask, case_bit)));
+   }
+   softmaskRunScalar(unmasked, hardmasked, vector_sites, length, softmasked);
+}
+
+__attribute__((target("avx512bw")))
+inline void softmaskRunAVX512(const char *unmasked, const char *hardmasked, unsigned long length, char *softmasked) {
+   const __m512i case_bit = _mm512_set1_epi8(0x20);
+   for (unsigned long i = 0; i < length; i += 64) {
+      __mmask64 load_mask = firstLanesMask(length - i);
+      __m512i unmaskedbases = _mm512_maskz_loadu_epi8(load_mask, unmasked + i);
+      __m512i hardmaskedbases = _mm512_maskz_loadu_epi8(load_mask, hardmasked + i);
+      unmaskedbases = _mm512_mask_sub_epi8(unmaskedbases, _mm512_cmple_epu8_mask(_mm512_sub_epi8(unmaskedbases, _mm512_set1_epi8('a')), _mm512_set1_epi8(25)), unmaskedbases, case_bit);
+      hardmaskedbases = _mm512_mask_sub_epi8(hardmaskedbases, _mm512_cmple_epu8_mask(_mm512_sub_epi8(hardmaskedbases, _mm512_set1_epi8('a')), _mm512_set1_epi8(25)), hardmaskedbases, case_bit);
+      __mmask64 to_mask = _mm512_cmpneq_epi8_mask(unmaskedbases, _mm512_set1_epi8('N')) & _mm512_cmpeq_epi8_mask(hardmaskedbases, _mm512_set1_epi8('N')) & _mm512_cmple_epu8_mask(_mm512_sub_epi8(unmaskedbases, _mm512_set1_epi8('A')), _mm512_set1_epi8(25));
+      _mm512_mask_storeu_epi8(softmasked + i, load_mask, _mm512_mask_add_epi8(unmaskedbases, to_mask, unmaskedbases, case_bit));
+   }
+}
+#endif
+
+//Count the alleles of the samples (indices into rows) at num_sites sites
+// (at most TILE_SITES) starting at first_site:
+inline void countBlockAlleles(const std::vector<SequenceView> &rows, const std::vector<unsigned long> &samples, unsigned long first_site, unsigned long num_sites, BlockAlleleCounts &counts) {
+   memset(&counts, 0, sizeof(counts));
+   switch (simdLevel()) {
+#ifdef SIMD_KERNELS_X86
+      case SIMD_AVX512:
+         countBlockAllelesAVX512(rows.data(), samples.data(), samples.size(), first_site, num_sites, counts);
+         break;
+      case SIMD_AVX2:
+         countBlockAllelesAVX2(rows.data(), samples.data(), samples.size(), first_site, num_sites, counts);
+         break;
+      case SIMD_SSE42:
+         countBlockAllelesSSE42(rows.data(), samples.data(), samples.size(), first_site, num_sites, counts);
+         break;
+#endif
+      default:
+         countBlockAllelesScalar(rows.data(), samples.data(), samples.size(), first_site, 0, num_sites, counts);
+         break;
+   }
+}
+
+//Classify each site of a reference and query row as not variant, variant
+// (in terms of mode, one of the POLYDIV_ kinds), or masked:
+inline void classifyPolyDivSites(const char *ref, const char *query, unsigned long length, int mode, unsigned char *site_classes) {
+   switch (simdLevel()) {
+#ifdef SIMD_KERNELS_X86
+      case SIMD_AVX512:
+         classifyPolyDivSitesAVX512(ref, query, length, mode, site_classes);
+         break;
+      case SIMD_AVX2:
+         classifyPolyDivSitesAVX2(ref, query, length, mode, site_classes);
+         break;
+      case SIMD_SSE42:
+         classifyPolyDivSitesSSE42(ref, query, length, mode, site_classes);
+         break;
+#endif
+      default:
+         classifyPolyDivSitesScalar(ref, query, 0, length, mode, site_classes);
+         break;
+   }
+}
+
+//Uppercase a run of an unmasked FASTA, lowercasing the bases that are N
+// in the hard-masked FASTA (but not in the unmasked FASTA):
+inline void softmaskRun(const char *unmasked, const char *hardmasked, unsigned long length, char *softmasked) {
+   switch (simdLevel()) {
+#ifdef SIMD_KERNELS_X86
+      case SIMD_AVX512:
+         softmaskRunAVX512(unmasked, hardmasked, length, softmasked);
+         break;
+      case SIMD_AVX2:
+         softmaskRunAVX2(unmasked, hardmasked, length, softmasked);
+         break;
+      case SIMD_SSE42:
+         softmaskRunSSE42(unmasked, hardmasked, length, softmasked);
+         break;
+#endif
+      default:
+         softmaskRunScalar(unmasked, hardmasked, 0, length, softmasked);
+         break;
+   }
+}
+
+#endif
@@ -0,0 +1,314 @@
+/****************************************************************************
+ * siteKernels.h                                                            *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Shared helpers for the per-site loops of calculateDxy,                   *
+ *  calculatePolymorphism, and sitePatterns.                                *
+ * transposeTile() copies a block of sites from every sample's row into a   *
+ *  site-major tile, so that the per-site loop over samples reads           *
+ *  consecutive bytes, rather than one byte from each of N separate rows.   *
+ * rowsShareBases() detects rows where every sample is a view of the same   *
+ *  bases, as PseudorefReader returns for runs of a cohort store where      *
+ *  every sample matches the reference, so the per-site statistics only     *
+ *  depend on that one base, and only need computing once per base.         *
+ * uniformSites() finds the sites of a block where every sample has the     *
+ *  same byte, comparing rows a word at a time, so that invariant and fully *
+ *  masked sites can share one computation per byte in the same way.        *
+ * EstimateMemo memoizes per-population estimates (e.g. pi) by their A, C,  *
+ *  G, and T allele counts, and pairwise estimates (e.g. D_xy) by the pair  *
+ *  of populations' counts.  Counts are packed into one integer and given a *
+ *  small id the first time they're seen, so a lookup is an integer hash    *
+ *  or a vector index, rather than building and hashing a string per site.  *
+ * baseDecodeTable() decodes every byte a pseudoreference may hold into the *
+ *  alleles it adds, whether it's a het or missing, and its genotype, so    *
+ *  every per-site tool treats bases (and case, and unknown characters as   *
+ *  N) the same way, with a table lookup rather than a switch per sample.   *
+ * AlleleDraws supplies the coin flips that pick an allele of a het for an  *
+ *  inbred line.  By default each flip is a hash of the seed, scaffold,     *
+ *  position, and sample, so it is the same whichever thread, chunk, or     *
+ *  region it is drawn in.  The old flips from rand() in site order are     *
+ *  still available, replayed from flips drawn ahead of time for chunks of  *
+ *  sites run on other threads.                                             *
+ ****************************************************************************/
+
+#ifndef SITE_KERNELS_H
+#define SITE_KERNELS_H
+
+#include <vector>
+#include <unordered_map>
+#include <array>
+#include <cstdint>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <cstring>
+#include "pseudorefReader.h"
+
+//Number of sites transposed into each tile:
+//64 sites by a few hundred samples stays within L1 cache
+#define TILE_SITES 64
+
+//Copy num_sites sites starting at first_site from each row into tile, such
+// that tile[i*rows.size()+j] is site first_site+i of sample j:
+inline void transposeTile(const std::vector<SequenceView> &rows, unsigned long first_site, unsigned long num_sites, std::vector<char> &tile) {
+   unsigned long num_samples = rows.size();
+   tile.resize(num_sites*num_samples);
+   char *tile_data = tile.data();
+   for (unsigned long j = 0; j < num_samples; j++) {
+      const char *row = rows[j].bases + first_site;
+      for (unsigned long i = 0; i < num_sites; i++) {
+         tile_data[i*num_samples+j] = row[i];
+      }
+   }
+}
+
+//Whether every row is a view of the same bases, so every sample has the
+// same base at each site:
+inline bool rowsShareBases(const std::vector<SequenceView> &rows) {
+   for (unsigned long j = 1; j < rows.size(); j++) {
+      if (rows[j].bases != rows[0].bases) {
+         return 0;
+      }
+   }
+   return !rows.empty();
+}
+
+//Mask of the first num_sites bits, for a block of up to 64 sites:
+inline uint64_t blockSiteMask(unsigned long num_sites) {
+   return num_sites >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << num_sites) - 1;
+}
+
+//Find which of a block of up to 64 sites starting at first_site have the
+// same byte in every row (e.g. invariant sites, or sites that are N in
+// every sample), as a mask with bit i set for site first_site+i:
+//Rows are compared with the first row 8 sites at a time as 64-bit words,
+// stopping early once every site has differed
+inline uint64_t uniformSites(const std::vector<SequenceView> &rows, unsigned long first_site, unsigned long num_sites) {
+   unsigned char differences[64] = {0}; //OR of each row's XOR with the first row
+   unsigned long num_words = num_sites/8;
+   const char *first_row = rows[0].bases + first_site;
+   for (unsigned long j = 1; j < rows.size(); j++) {
+      const char *row = rows[j].bases + first_site;
+      for (unsigned long w = 0; w < num_words; w++) {
+         uint64_t first_word, row_word, difference_word;
+         memcpy(&first_word, first_row + 8*w, 8);
+         memcpy(&row_word, row + 8*w, 8);
+         memcpy(&difference_word, differences + 8*w, 8);
+         difference_word |= first_word ^ row_word;
+         memcpy(differences + 8*w, &difference_word, 8);
+      }
+      for (unsigned long i = 8*num_words; i < num_sites; i++) {
+         differences[i] |= first_row[i] ^ row[i];
+      }
+      //Every so often, stop if no site is uniform any more:
+      if (j % 16 == 0) {
+         bool any_uniform = 0;
+         for (unsigned long i = 0; i < num_sites && !any_uniform; i++) {
+            any_uniform = differences[i] == 0;
+         }
+         if (!any_uniform) {
+            return 0;
+         }
+      }
+   }
+   uint64_t uniform = 0;
+   for (unsigned long i = 0; i < num_sites; i++) {
+      uniform |= (uint64_t)(differences[i] == 0) << i;
+   }
+   return uniform;
+}
+
+//Id of allele counts too large to pack, which are never memoized:
+#define ESTIMATE_MEMO_NO_ID UINT32_MAX
+
+class EstimateMemo {
+   public:
+      //Find the memoized estimate of a population's A, C, G, T counts,
+      // returning 0 if there isn't one yet, in which case it can be stored
+      // with storeSingle(id, estimate)
+      //Inserting only allocates for counts never seen before
+      bool findSingle(const unsigned long *base_counts, uint32_t &id, double &estimate) {
+         if (base_counts[0] > UINT16_MAX || base_counts[1] > UINT16_MAX || base_counts[2] > UINT16_MAX || base_counts[3] > UINT16_MAX) {
+            id = ESTIMATE_MEMO_NO_ID;
+            return 0;
+         }
+         uint64_t key = (uint64_t)base_counts[0] | (uint64_t)base_counts[1] << 16 | (uint64_t)base_counts[2] << 32 | (uint64_t)base_counts[3] << 48;
+         auto id_iterator = count_ids.find(key);
+         if (id_iterator != count_ids.end()) {
+            id = id_iterator->second;
+            if (single_known[id]) {
+               estimate = single_estimates[id];
+               return 1;
+            }
+            return 0;
+         }
+         id = single_estimates.size();
+         count_ids.emplace(key, id);
+         single_estimates.push_back(0.0);
+         single_known.push_back(0);
+         return 0;
+      }
+      void storeSingle(uint32_t id, double estimate) {
+         if (id != ESTIMATE_MEMO_NO_ID) {
+            single_estimates[id] = estimate;
+            single_known[id] = 1;
+         }
+      }
+
+      //Find the memoized estimate of a pair of populations, by the ids
+      // findSingle() gave their counts:
+      bool findPair(uint32_t id1, uint32_t id2, double &estimate) const {
+         if (id1 == ESTIMATE_MEMO_NO_ID || id2 == ESTIMATE_MEMO_NO_ID) {
+            return 0;
+         }
+         auto pair_iterator = pair_estimates.find((uint64_t)id1 << 32 | id2);
+         if (pair_iterator == pair_estimates.end()) {
+            return 0;
+         }
+         estimate = pair_iterator->second;
+         return 1;
+      }
+      void storePair(uint32_t id1, uint32_t id2, double estimate) {
+         if (id1 != ESTIMATE_MEMO_NO_ID && id2 != ESTIMATE_MEMO_NO_ID) {
+            pair_estimates.emplace((uint64_t)id1 << 32 | id2, estimate);
+         }
+      }
+
+   private:
+      std::unordered_map<uint64_t, uint32_t> count_ids; //Packed A, C, G, T counts (16 bits each) to id
+      std::vector<double> single_estimates; //By id
+      std::vector<bool> single_known;
+      std::unordered_map<uint64_t, double> pair_estimates; //By pair of ids
+};
+
+//Decoding of one byte of a pseudoreference:
+struct BaseDecode {
+   unsigned char counts[2][6]; //A, C, G, T, N, and non-N alleles it adds for a diploid [0] or an inbred haploid [1]
+   bool het; //Heterozygous IUPAC code, so an inbred haploid adds one of its alleles at random
+   bool missing; //N, -, or anything else that isn't a base or a two-allele IUPAC code
+   unsigned char het_alleles[2]; //The alleles (0-3 for A, C, G, T) of a het code
+   char code; //Uppercase base or IUPAC code, or N if missing
+   char genotype[2]; //Both alleles, e.g. GT for K, or NN if missing
+};
+
+//Fill in the decoding of every byte, where anything not handled is an N:
+inline std::array<BaseDecode, 256> buildBaseDecodeTable() {
+   std::array<BaseDecode, 256> table;
+   BaseDecode missing_decode = { { {0, 0, 0, 0, 2, 0}, {0, 0, 0, 0, 1, 0} }, 0, 1, {0, 0}, 'N', {'N', 'N'} };
+   table.fill(missing_decode);
+   const char bases[] = "ACGT";
+   for (unsigned int b = 0; b < 4; b++) {
+      BaseDecode base_decode = { { {0, 0, 0, 0, 0, 2}, {0, 0, 0, 0, 0, 1} }, 0, 0, {0, 0}, bases[b], {bases[b], bases[b]} };
+      base_decode.counts[0][b] = 2;
+      base_decode.counts[1][b] = 1;
+      table[(unsigned char)bases[b]] = base_decode;
+      table[(unsigned char)tolower(bases[b])] = base_decode;
+   }
+   //Het codes and their alleles, e.g. K is G/T:
+   const char het_codes[] = "KMRSWY";
+   const unsigned char het_alleles[6][2] = { {2, 3}, {0, 1}, {0, 2}, {1, 2}, {0, 3}, {1, 3} };
+   for (unsigned int h = 0; h < 6; h++) {
+      BaseDecode het_decode = { { {0, 0, 0, 0, 0, 2}, {0, 0, 0, 0, 0, 1} }, 1, 0, {het_alleles[h][0], het_alleles[h][1]}, het_codes[h], {bases[het_alleles[h][0]], bases[het_alleles[h][1]]} };
+      het_decode.counts[0][het_alleles[h][0]] = 1;
+      het_decode.counts[0][het_alleles[h][1]] = 1;
+      table[(unsigned char)het_codes[h]] = het_decode;
+      table[(unsigned char)tolower(het_codes[h])] = het_decode;
+   }
+   return table;
+}
+
+//The decoding of every byte, indexed by the byte as an unsigned char:
+inline const BaseDecode *baseDecodeTable() {
+   static const std::array<BaseDecode, 256> table = buildBaseDecodeTable();
+   return table.data();
+}
+
+//Mix the bits of a 64-bit integer (the SplitMix64 finalizer), so that
+// nearby inputs give unrelated outputs:
+inline uint64_t mixBits(uint64_t bits) {
+   bits ^= bits >> 30;
+   bits *= 0xBF58476D1CE4E5B9ULL;
+   bits ^= bits >> 27;
+   bits *= 0x94D049BB133111EBULL;
+   bits ^= bits >> 31;
+   return bits;
+}
+
+//FNV-1a hash of a scaffold name:
+inline uint64_t hashName(const std::string &name) {
+   uint64_t hash = 0xCBF29CE484222325ULL;
+   for (unsigned long k = 0; k < name.length(); k++) {
+      hash ^= (unsigned char)name[k];
+      hash *= 0x100000001B3ULL;
+   }
+   return hash;
+}
+
+//Coin flips that pick which allele (0 or 1) of a het an inbred line has:
+//Counter-based flips are the top bit of a hash of (seed, scaffold name,
+// 0-based position, sample index), so they don't depend on what was drawn
+// before, and every thread, chunk, or region gets the same flips
+//Otherwise each flip calls rand(), in site order as before, or replays
+// flips drawn that way ahead of time from any point, so a chunk of sites
+// processed on another thread gets exactly the alleles a serial run would
+//Counter-based AlleleDraws keep the current scaffold, so each thread
+// needs its own copy
+class AlleleDraws {
+   public:
+      AlleleDraws() : flips(NULL), next_flip(0), counter_based(0), seed_key(0), scaffold_key(0) {}
+      AlleleDraws(const std::vector<bool> *drawn_flips, uint64_t first_flip) : flips(drawn_flips), next_flip(first_flip), counter_based(0), seed_key(0), scaffold_key(0) {}
+
+      static AlleleDraws counterBased(uint64_t seed) {
+         AlleleDraws allele_draws;
+         allele_draws.counter_based = 1;
+         allele_draws.seed_key = mixBits(seed);
+         allele_draws.scaffold_key = allele_draws.seed_key;
+         return allele_draws;
+      }
+      bool isCounterBased() const {
+         return counter_based;
+      }
+
+      //The scaffold the following sites are on:
+      void setScaffold(const std::string &scaffold_name) {
+         if (counter_based) {
+            scaffold_key = mixBits(seed_key ^ hashName(scaffold_name));
+         }
+      }
+
+      //Flip for a sample at a 0-based position of the current scaffold:
+      unsigned int next(uint64_t position, unsigned long sample) {
+         if (counter_based) {
+            return mixBits(mixBits(scaffold_key ^ position) ^ sample) >> 63;
+         }
+         if (flips == NULL) {
+            return rand() <= (RAND_MAX-1)/2 ? 0 : 1;
+         }
+         return (*flips)[next_flip++];
+      }
+
+      //Draw the next num_flips flips from rand(), in order, for replaying:
+      static void drawAhead(uint64_t num_flips, std::vector<bool> &drawn_flips) {
+         drawn_flips.resize(num_flips);
+         for (uint64_t k = 0; k < num_flips; k++) {
+            drawn_flips[k] = rand() > (RAND_MAX-1)/2;
+         }
+      }
+
+   private:
+      const std::vector<bool> *flips;
+      uint64_t next_flip;
+      bool counter_based;
+      uint64_t seed_key;
+      uint64_t scaffold_key;
+};
+
+//Whether a base is a heterozygous IUPAC code, so an allele is drawn at
+// random for it in inbred mode:
+inline bool isHetBase(char base) {
+   return baseDecodeTable()[(unsigned char)base].het;
+}
+
+#endif
@@ -3,6 +3,13 @@
  * Written by Patrick Reilly                                                *
  * Version 1.0 written 2017/01/16                                           *
  * Version 1.1 written 2019/05/30 Softmask fix, FOFN input, and debugging   *
+ * Version 1.2 written 2026/10/17 Option to memory-map input FASTAs         *
+ * Version 1.3 written 2026/10/17 Read gzipped and BGZF-compressed FASTAs   *
+ * Version 1.4 written 2026/10/17 FASTAs may be wrapped at any length       *
+ * Version 1.5 written 2026/10/17 Pipelined reading and pattern counting    *
+ * Version 1.6 written 2026/10/17 Reference-delta cohort store input        *
+ * Version 1.7 written 2026/10/17 Preflight check of input scaffolds        *
+ * Version 1.8 written 2026/10/17 Table-driven base decoding                *
  *                                                                          *
  * Description:                                                             *
  *                                                                          *
@@ -12,10 +19,17 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstdlib>
 #include <getopt.h>
 #include <cctype>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
 #include <map>
+#include "pseudorefReader.h"
+#include "siteKernels.h"
+#include "sitePipeline.h"
 
 //Define constants for getopt:
 #define no_argument 0
@@ -23,114 +37,52 @@
 #define optional_argument 2
 
 //Version:
-#define VERSION "1.1"
+#define VERSION "1.8"
 
 //Define number of bases:
 #define NUM_BASES 4
 
 //Usage/help:
-#define USAGE "sitePatterns\nUsage:\n sitePatterns [list of pseudoreference FASTAs]\n"
+#define USAGE "sitePatterns\nUsage:\n sitePatterns [options] [list of pseudoreference FASTAs]\n Options:\n  --help,-h:\t\tOutput this documentation\n  --version,-v:\t\tOutput the version number\n  --fofn,-f:\t\tPass a file of filenames, rather than listing filenames\n  --mmap,-m:\t\tMemory-map input FASTAs instead of reading them in blocks\n  --decompression_threads,-z:\tThreads for inflating BGZF FASTAs (default: 1)\n  --compute_threads,-c:\tRead and count patterns on separate threads, with\n\t\t\tthis many counting threads (default: 0, no pipeline)\n  --queue_depth,-q:\tBlocks queued between pipeline stages (default: 4)\n  --preflight,-P:\tOnly check that every input has the same scaffolds\n\t\t\tin the same order with the same lengths, using .fai\n\t\t\tfiles where possible, then exit\n  --debug,-d:\t\tOutput extra debugging info\n"
 
 using namespace std;
 
-bool openFASTAs(vector<ifstream*> &input_FASTAs, vector<string> input_FASTA_paths) {
-   for (auto path_iterator = input_FASTA_paths.begin(); path_iterator != input_FASTA_paths.end(); ++path_iterator) {
-      ifstream *input_FASTA = new ifstream(path_iterator->c_str(), ios::in);
-      if (!input_FASTA->is_open()) { //Check to make sure the input file was validly opened
-         cerr << "Error opening input FASTA: " << *path_iterator << "." << endl;
-         return 0;
-      }
-      input_FASTAs.push_back(input_FASTA);
+//Build the pattern of alleles of every sample at one site:
+string sitePattern(const char *site_bases, unsigned long num_sequences) {
+   string site_pattern = "";
+   const BaseDecode *decode = baseDecodeTable();
+   for (unsigned long j = 0; j < num_sequences; j++) {
+      site_pattern.append(decode[(unsigned char)site_bases[j]].genotype, 2);
    }
-   return 1;
+   return site_pattern;
 }
 
-void closeFASTAs(vector<ifstream*> &input_FASTAs) {
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      (*FASTA_iterator)->close();
-      delete *FASTA_iterator;
-   }
-}
-
-bool readFASTAs(vector<ifstream*> &input_FASTAs, vector<string> &FASTA_lines) {
-   unsigned long which_input_FASTA = 0;
-   bool ifstream_notfail;
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      if ((*FASTA_iterator)->fail()) {
-         cerr << "Ifstream " << which_input_FASTA+1 << " failed." << endl;
-         return 0;
-      }
-      string FASTA_line;
-      ifstream_notfail = (bool)getline(**FASTA_iterator, FASTA_line);
-      if (!ifstream_notfail) {
-         return ifstream_notfail;
+void processScaffold(const string &scaffold_name, vector<SequenceView> &FASTA_sequences, unsigned long position_offset, map<string, unsigned long> &pattern_counts) {
+   //Do all the processing for this row of the scaffold:
+   unsigned long num_sequences = FASTA_sequences.size();
+   unsigned long scaffold_length = FASTA_sequences[0].length;
+   //When every sample shares the same bases (e.g. a run of a cohort store
+   // where every sample matches the reference), a site's pattern only
+   // depends on its base, so count the sites of each base instead:
+   if (rowsShareBases(FASTA_sequences)) {
+      map<char, unsigned long> base_counts;
+      for (unsigned long i = 0; i < scaffold_length; i++) {
+         base_counts[FASTA_sequences[0].bases[i]]++;
       }
-      if (FASTA_lines.size() < input_FASTAs.size()) {
-         FASTA_lines.push_back(FASTA_line);
-      } else {
-         FASTA_lines[which_input_FASTA++] = FASTA_line;
+      for (auto base_iterator = base_counts.begin(); base_iterator != base_counts.end(); ++base_iterator) {
+         vector<char> shared_site_bases(num_sequences, base_iterator->first);
+         pattern_counts[sitePattern(shared_site_bases.data(), num_sequences)] += base_iterator->second;
       }
+      return;
    }
-   return ifstream_notfail;
-}
-
-void processScaffold(vector<string> &FASTA_headers, vector<string> &FASTA_sequences, map<string, unsigned long> &pattern_counts) {
-   cerr << "Processing scaffold " << FASTA_headers[0].substr(1) << " of length " << FASTA_sequences[0].length() << endl;
-   //Do all the processing for this scaffold:
-   unsigned long num_sequences = FASTA_sequences.size();
-   unsigned long scaffold_length = FASTA_sequences[0].length();
+   vector<char> site_tile; //Site-major copy of the current tile of sites
    for (unsigned long i = 0; i < scaffold_length; i++) {
-      string site_pattern = "";
-      for (unsigned long j = 0; j < num_sequences; j++) {
-         switch (FASTA_sequences[j][i]) {
-            case 'A':
-            case 'a':
-               site_pattern += "AA";
-               break;
-            case 'C':
-            case 'c':
-               site_pattern += "CC";
-               break;
-            case 'G':
-            case 'g':
-               site_pattern += "GG";
-               break;
-            case 'K': //G/T het site
-            case 'k':
-               site_pattern += "GT";
-               break;
-            case 'M': //A/C het site
-            case 'm':
-               site_pattern += "AC";
-               break;
-            case 'R': //A/G het site
-            case 'r':
-               site_pattern += "AG";
-               break;
-            case 'S': //C/G het site
-            case 's':
-               site_pattern += "CG";
-               break;
-            case 'T':
-            case 't':
-               site_pattern += "TT";
-               break;
-            case 'W': //A/T het site
-            case 'w':
-               site_pattern += "AT";
-               break;
-            case 'Y': //C/T het site
-            case 'y':
-               site_pattern += "CT";
-               break;
-            case 'N':
-            case 'n':
-            case '-':
-            default: //Assume that any case not handled here is an N
-               site_pattern += "NN";
-               break;
-         }
+      //Transpose the next tile of sites whenever we reach its start:
+      if (i % TILE_SITES == 0) {
+         transposeTile(FASTA_sequences, i, min((unsigned long)TILE_SITES, scaffold_length-i), site_tile);
       }
+      const char *site_bases = site_tile.data() + (i % TILE_SITES)*num_sequences;
+      string site_pattern = sitePattern(site_bases, num_sequences);
       if (pattern_counts.count(site_pattern) > 0) {
          pattern_counts[site_pattern]++;
       } else {
@@ -142,12 +94,21 @@ void processScaffold(vector<string> &FASTA_headers, vector<string> &FASTA_sequen
 int main(int argc, char **argv) {
    //Variables for processing the FASTAs:
    vector<string> input_FASTA_paths;
-   vector<ifstream*> input_FASTAs;
    
    //Option for debugging:
    unsigned short int debug = 0;
    //Option for input of FASTA file paths:
    string input_fofn = "";
+   //Option to memory-map the input FASTAs:
+   bool use_mmap = 0;
+   //Number of threads to inflate BGZF-compressed FASTAs with:
+   unsigned int decompression_threads = 1;
+   //Number of counting workers for the reader/compute pipeline (0 for no pipeline):
+   unsigned int compute_threads = 0;
+   //Number of blocks queued between pipeline stages:
+   unsigned long queue_depth = PIPELINE_QUEUE_DEPTH;
+   //Option to only check the inputs against each other:
+   bool preflight = 0;
 
    //Variable for storing pattern counts:
    map<string, unsigned long> pattern_counts;
@@ -159,17 +120,41 @@ int main(int argc, char **argv) {
    //Create the struct used for getopt:
    const struct option longoptions[] {
       {"fofn", required_argument, 0, 'f'},
+      {"mmap", no_argument, 0, 'm'},
+      {"decompression_threads", required_argument, 0, 'z'},
+      {"compute_threads", required_argument, 0, 'c'},
+      {"queue_depth", required_argument, 0, 'q'},
+      {"preflight", no_argument, 0, 'P'},
       {"debug", no_argument, 0, 'd'},
       {"version", no_argument, 0, 'v'},
       {"help", no_argument, 0, 'h'}
    };
    //Read in the options:
-   while ((optchar = getopt_long(argc, argv, "f:dvh", longoptions, &structindex)) > -1) {
+   while ((optchar = getopt_long(argc, argv, "f:mz:c:q:Pdvh", longoptions, &structindex)) > -1) {
       switch(optchar) {
          case 'f':
             cerr << "Taking input from FOFN " << optarg << endl;
             input_fofn = optarg;
             break;
+         case 'm':
+            cerr << "Memory-mapping input FASTAs." << endl;
+            use_mmap = 1;
+            break;
+         case 'z':
+            decompression_threads = atoi(optarg);
+            if (decompression_threads < 1) {
+               decompression_threads = 1;
+            }
+            break;
+         case 'c':
+            compute_threads = atoi(optarg);
+            break;
+         case 'q':
+            queue_depth = strtoul(optarg, NULL, 10);
+            break;
+         case 'P':
+            preflight = 1;
+            break;
          case 'd':
             cerr << "Debugging mode enabled." << endl;
             debug++;
@@ -224,81 +209,85 @@ int main(int argc, char **argv) {
    }
    
    //Open the input FASTAs:
-   bool successfully_opened = openFASTAs(input_FASTAs, input_FASTA_paths);
+   PseudorefReader FASTA_reader;
+   bool successfully_opened = FASTA_reader.open(input_FASTA_paths, use_mmap, decompression_threads);
    if (!successfully_opened) {
-      closeFASTAs(input_FASTAs);
+      FASTA_reader.close();
       return 2;
    }
-   cerr << "Opened " << input_FASTAs.size() << " input FASTA files." << endl;
-   
-   //Set up the vector to contain each line from the n FASTA files:
-   vector<string> FASTA_lines;
+   cerr << "Opened " << FASTA_reader.size() << " input FASTA files." << endl;
+   //Only check that the inputs have the same scaffolds, then stop:
+   if (preflight) {
+      reader_status preflight_status = FASTA_reader.preflight(max(1u, thread::hardware_concurrency()), debug);
+      unsigned long num_inputs = FASTA_reader.size();
+      FASTA_reader.close();
+      if (preflight_status == READER_HEADERS_DIFFER) {
+         cerr << "Preflight failed: FASTAs are not synchronized, headers differ." << endl;
+         return 3;
+      } else if (preflight_status == READER_NOT_SYNCHRONIZED) {
+         cerr << "Preflight failed: FASTAs are not synchronized, scaffolds or lengths differ." << endl;
+         return 4;
+      } else if (preflight_status != READER_SEQUENCE) {
+         cerr << "Preflight failed: unable to read the scaffolds of every input." << endl;
+         return 5;
+      }
+      cerr << "Preflight passed: all " << num_inputs << " inputs have the same scaffolds in the same order with the same lengths." << endl;
+      return 0;
+   }
+
+   //Set up the vector to contain views of each line from the n FASTA files:
+   vector<SequenceView> FASTA_lines;
    FASTA_lines.reserve(input_FASTA_paths.size());
    
-   //Iterate over all of the FASTAs synchronously:
-   vector<string> FASTA_headers;
-   vector<string> FASTA_sequences;
-   while (readFASTAs(input_FASTAs, FASTA_lines)) {
-      //Check if we're on a header line:
-      bool all_header_lines = 1;
-      bool any_header_lines = 0;
-      for (auto line_iterator = FASTA_lines.begin(); line_iterator != FASTA_lines.end(); ++line_iterator) {
-         all_header_lines = all_header_lines && ((*line_iterator)[0] == '>');
-         any_header_lines = any_header_lines || ((*line_iterator)[0] == '>');
-      }
-      if (all_header_lines) {
-         if (debug) {
-            cerr << "Completed reading scaffold " << FASTA_lines[0].substr(1) << endl;
-         }
-         if (!FASTA_sequences.empty()) {
-            processScaffold(FASTA_headers, FASTA_sequences, pattern_counts);
-            FASTA_sequences.clear();
-         }
-         FASTA_headers = FASTA_lines;
-         for (auto header_iterator = FASTA_headers.begin()+1; header_iterator != FASTA_headers.end(); ++header_iterator) {
-            if (*header_iterator != FASTA_headers[0]) {
-               cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
-               cerr << FASTA_headers[0] << endl;
-               cerr << *header_iterator << endl;
-               closeFASTAs(input_FASTAs);
-               return 3;
-            }
+   reader_status row_status;
+   if (compute_threads > 0) {
+      //Read and count blocks of sites on separate threads, then merge the counts:
+      vector<map<string, unsigned long>> worker_pattern_counts(compute_threads);
+      row_status = runSitePipeline(FASTA_reader, FASTA_lines, compute_threads, queue_depth, [&](SiteBlock &block, unsigned int worker_index) {
+         processScaffold(block.scaffold, block.rows, block.position_offset, worker_pattern_counts[worker_index]);
+      }, NULL, [](const string &scaffold_name) {
+         cerr << "Processing scaffold " << scaffold_name << endl;
+      });
+      for (auto worker_iterator = worker_pattern_counts.begin(); worker_iterator != worker_pattern_counts.end(); ++worker_iterator) {
+         for (auto pattern_iterator = worker_iterator->begin(); pattern_iterator != worker_iterator->end(); ++pattern_iterator) {
+            pattern_counts[pattern_iterator->first] += pattern_iterator->second;
          }
-      } else if (any_header_lines) {
-         cerr << "Error: FASTAs are not synchronized, or not wrapped at the same length." << endl;
-         closeFASTAs(input_FASTAs);
-         return 4;
-      } else {
-         if (debug) {
-            cerr << "Loading " << FASTA_lines.size() << " FASTA lines into sequences." << endl;
-         }
-         unsigned long sequence_index = 0;
-         for (auto line_iterator = FASTA_lines.begin(); line_iterator != FASTA_lines.end(); ++line_iterator) {
-            if (FASTA_sequences.size() < FASTA_lines.size()) {
-               FASTA_sequences.push_back(*line_iterator);
-            } else {
-               FASTA_sequences[sequence_index++] += *line_iterator;
-            }
+      }
+   } else {
+      //Iterate over all of the FASTAs synchronously, processing each row as it arrives:
+      string scaffold_name;
+      unsigned long scaffold_position = 0;
+      while ((row_status = FASTA_reader.readRow(FASTA_lines)) == READER_HEADER || row_status == READER_SEQUENCE) {
+         if (row_status == READER_HEADER) {
+            scaffold_name = FASTA_reader.scaffold();
+            scaffold_position = 0;
+            cerr << "Processing scaffold " << scaffold_name << endl;
+         } else {
+            processScaffold(scaffold_name, FASTA_lines, scaffold_position, pattern_counts);
+            scaffold_position += FASTA_lines[0].length;
          }
       }
    }
    
-   //Catch any IO errors that kicked us out of the while loop:
-   unsigned long which_input_FASTA = 0;
-   for (auto FASTA_iterator = input_FASTAs.begin(); FASTA_iterator != input_FASTAs.end(); ++FASTA_iterator) {
-      if ((*FASTA_iterator)->bad()) {
-         cerr << "Error reading input FASTA: " << input_FASTA_paths[which_input_FASTA] << endl;
-         cerr << "Fail bit: " << ((*FASTA_iterator)->rdstate() & ifstream::failbit) << " Bad bit: " << (*FASTA_iterator)->bad() << " EOF bit: " << (*FASTA_iterator)->eof() << endl;
-         closeFASTAs(input_FASTAs);
-         return 5;
-      }
-      which_input_FASTA++;
+   //Catch any synchronization or IO errors that kicked us out of the while loop:
+   if (row_status == READER_HEADERS_DIFFER) {
+      cerr << "Error: FASTAs are not synchronized, headers differ." << endl;
+      cerr << string(FASTA_lines[0].bases, FASTA_lines[0].length) << endl;
+      cerr << string(FASTA_lines[FASTA_reader.failedInput()].bases, FASTA_lines[FASTA_reader.failedInput()].length) << endl;
+      FASTA_reader.close();
+      return 3;
+   } else if (row_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Error: FASTAs are not synchronized, scaffold " << FASTA_reader.scaffold() << " has a different length in " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      FASTA_reader.close();
+      return 4;
+   } else if (row_status == READER_IO_ERROR) {
+      cerr << "Error reading input FASTA: " << FASTA_reader.path(FASTA_reader.failedInput()) << endl;
+      cerr << strerror(errno) << endl;
+      FASTA_reader.close();
+      return 5;
    }
-   //If no errors kicked us out of the while loop, process the last scaffold:
-   processScaffold(FASTA_headers, FASTA_sequences, pattern_counts);
-   
    //Close the input FASTAs:
-   closeFASTAs(input_FASTAs);
+   FASTA_reader.close();
    
    //Output the pattern counts:
    for (auto pattern_iterator = pattern_counts.begin(); pattern_iterator != pattern_counts.end(); ++pattern_iterator) {
@@ -0,0 +1,247 @@
+/****************************************************************************
+ * sitePipeline.h                                                           *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Three-stage pipeline for the per-site tools, so that reading the inputs, *
+ *  computing the per-site statistics, and writing the output overlap:      *
+ *  1) A reader thread copies synchronized rows from a PseudorefReader into *
+ *     blocks of up to PIPELINE_BLOCK_SITES sites of one scaffold.          *
+ *  2) One or more compute workers turn each block into formatted output.   *
+ *  3) A writer thread emits the output of each block in input order.       *
+ * Blocks are recycled through a fixed pool, and the queues between stages  *
+ *  hold at most queue_depth blocks each, so memory use is bounded.         *
+ * Each stage counts how often it had to wait on its neighbours (stalls),   *
+ *  which runSitePipeline() reports on STDERR, e.g. frequent compute stalls *
+ *  mean the reader can't keep up, and frequent reader stalls mean it can.  *
+ ****************************************************************************/
+
+#ifndef SITE_PIPELINE_H
+#define SITE_PIPELINE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+#include "pseudorefReader.h"
+
+//Number of sites per pipeline block:
+#define PIPELINE_BLOCK_SITES 16384
+
+//Default number of blocks queued between stages:
+#define PIPELINE_QUEUE_DEPTH 4
+
+//Fixed-capacity FIFO between two stages, counting waits on either end:
+template <class T>
+class BoundedQueue {
+   public:
+      BoundedQueue(unsigned long queue_capacity) : capacity(queue_capacity), closed(0), push_stalls(0), pop_stalls(0) {}
+
+      void push(T item) {
+         std::unique_lock<std::mutex> queue_lock(queue_mutex);
+         if (items.size() >= capacity) {
+            push_stalls++;
+            not_full.wait(queue_lock, [this]() { return items.size() < capacity; });
+         }
+         items.push_back(item);
+         not_empty.notify_one();
+      }
+
+      //Returns 0 once the queue is closed and empty:
+      bool pop(T &item) {
+         std::unique_lock<std::mutex> queue_lock(queue_mutex);
+         if (items.empty() && !closed) {
+            pop_stalls++;
+            not_empty.wait(queue_lock, [this]() { return !items.empty() || closed; });
+         }
+         if (items.empty()) {
+            return 0;
+         }
+         item = items.front();
+         items.pop_front();
+         not_full.notify_one();
+         return 1;
+      }
+
+      //No more items will be pushed:
+      void close() {
+         std::lock_guard<std::mutex> queue_lock(queue_mutex);
+         closed = 1;
+         not_empty.notify_all();
+      }
+
+      unsigned long pushStalls() const {
+         return push_stalls;
+      }
+      unsigned long popStalls() const {
+         return pop_stalls;
+      }
+
+   private:
+      std::deque<T> items;
+      unsigned long capacity;
+      bool closed;
+      unsigned long push_stalls;
+      unsigned long pop_stalls;
+      std::mutex queue_mutex;
+      std::condition_variable not_full;
+      std::condition_variable not_empty;
+};
+
+//A run of sites of one scaffold, copied out of the reader:
+struct SiteBlock {
+   unsigned long sequence; //Order of the block in the input
+   std::string scaffold;
+   unsigned long position_offset; //Sites of the scaffold before this block
+   unsigned long num_sites;
+   std::vector<char> sites; //Sample j's sites start at j*PIPELINE_BLOCK_SITES
+   std::vector<SequenceView> rows; //Views of each sample's sites, for the compute stage
+   std::string output; //Formatted output from the compute stage
+};
+
+//Run the pipeline over every row of reader, calling compute(block, worker)
+// on num_workers threads, and writing each block's output to output (if
+// not NULL) in input order
+//on_header is called from the reader thread with each scaffold name, taken
+// from the header of input header_input
+//Sites before the first header read here belong to initial_scaffold (e.g.
+// if the caller has already read the first header itself)
+//on_written (if set) is called from the writer thread with each block in
+// input order, after its output is written, e.g. to combine results that
+// span blocks
+//Returns the status that ended reading, as readRow() would, with row left
+// as the last row read, for error messages
+inline reader_status runSitePipeline(PseudorefReader &reader, std::vector<SequenceView> &row, unsigned int num_workers, unsigned long queue_depth, std::function<void(SiteBlock &, unsigned int)> compute, std::ostream *output, std::function<void(const std::string &)> on_header, unsigned long header_input = 0, const std::string &initial_scaffold = "", std::function<void(SiteBlock &)> on_written = nullptr) {
+   if (num_workers < 1) {
+      num_workers = 1;
+   }
+   if (queue_depth < 1) {
+      queue_depth = 1;
+   }
+   unsigned long num_samples = reader.size();
+   //Enough blocks to fill both queues and keep every worker busy:
+   std::vector<SiteBlock> block_pool(2*queue_depth + num_workers + 1);
+   BoundedQueue<SiteBlock *> free_blocks(block_pool.size());
+   BoundedQueue<SiteBlock *> read_blocks(queue_depth);
+   BoundedQueue<SiteBlock *> computed_blocks(queue_depth);
+   for (auto block_iterator = block_pool.begin(); block_iterator != block_pool.end(); ++block_iterator) {
+      block_iterator->sites.resize(num_samples*PIPELINE_BLOCK_SITES);
+      block_iterator->rows.resize(num_samples);
+      free_blocks.push(&(*block_iterator));
+   }
+
+   //Reader stage:
+   reader_status row_status;
+   int reader_errno = 0;
+   std::thread reader_thread([&]() {
+      SiteBlock *block = NULL;
+      unsigned long sequence = 0;
+      std::string scaffold_name = initial_scaffold;
+      unsigned long scaffold_position = 0;
+      while ((row_status = reader.readRow(row)) == READER_HEADER || row_status == READER_SEQUENCE) {
+         if (row_status == READER_HEADER) {
+            if (block != NULL) {
+               read_blocks.push(block);
+               block = NULL;
+            }
+            scaffold_name.assign(row[header_input].bases+1, row[header_input].length-1);
+            scaffold_position = 0;
+            if (on_header) {
+               on_header(scaffold_name);
+            }
+            continue;
+         }
+         unsigned long row_offset = 0;
+         while (row_offset < row[0].length) {
+            if (block == NULL) {
+               free_blocks.pop(block);
+               block->sequence = sequence++;
+               block->scaffold = scaffold_name;
+               block->position_offset = scaffold_position;
+               block->num_sites = 0;
+            }
+            unsigned long copy_length = std::min(row[0].length - row_offset, PIPELINE_BLOCK_SITES - block->num_sites);
+            for (unsigned long j = 0; j < num_samples; j++) {
+               memcpy(&block->sites[j*PIPELINE_BLOCK_SITES + block->num_sites], row[j].bases + row_offset, copy_length);
+            }
+            block->num_sites += copy_length;
+            row_offset += copy_length;
+            scaffold_position += copy_length;
+            if (block->num_sites == PIPELINE_BLOCK_SITES) {
+               read_blocks.push(block);
+               block = NULL;
+            }
+         }
+      }
+      reader_errno = errno; //errno is per-thread, so pass it back for error messages
+      if (block != NULL) {
+         read_blocks.push(block);
+      }
+      read_blocks.close();
+   });
+
+   //Compute stage:
+   std::vector<std::thread> workers;
+   for (unsigned int worker_index = 0; worker_index < num_workers; worker_index++) {
+      workers.push_back(std::thread([&, worker_index]() {
+         SiteBlock *block;
+         while (read_blocks.pop(block)) {
+            for (unsigned long j = 0; j < num_samples; j++) {
+               block->rows[j].bases = &block->sites[j*PIPELINE_BLOCK_SITES];
+               block->rows[j].length = block->num_sites;
+            }
+            block->output.clear();
+            compute(*block, worker_index);
+            computed_blocks.push(block);
+         }
+      }));
+   }
+
+   //Writer stage, holding blocks that finish early until their turn:
+   std::thread writer_thread([&]() {
+      std::map<unsigned long, SiteBlock *> waiting_blocks;
+      unsigned long next_sequence = 0;
+      SiteBlock *block;
+      while (computed_blocks.pop(block)) {
+         waiting_blocks[block->sequence] = block;
+         auto next_iterator = waiting_blocks.begin();
+         while (next_iterator != waiting_blocks.end() && next_iterator->first == next_sequence) {
+            if (output != NULL) {
+               output->write(next_iterator->second->output.data(), next_iterator->second->output.length());
+            }
+            if (on_written) {
+               on_written(*next_iterator->second);
+            }
+            free_blocks.push(next_iterator->second);
+            next_iterator = waiting_blocks.erase(next_iterator);
+            next_sequence++;
+         }
+      }
+      if (output != NULL) {
+         output->flush();
+      }
+   });
+
+   reader_thread.join();
+   for (auto worker_iterator = workers.begin(); worker_iterator != workers.end(); ++worker_iterator) {
+      worker_iterator->join();
+   }
+   computed_blocks.close();
+   writer_thread.join();
+
+   std::cerr << "Pipeline stalls: reader " << free_blocks.popStalls() + read_blocks.pushStalls();
+   std::cerr << ", compute " << read_blocks.popStalls() + computed_blocks.pushStalls();
+   std::cerr << ", writer " << computed_blocks.popStalls() << std::endl;
+   errno = reader_errno;
+   return row_status;
+}
+
+#endif
@@ -2,9 +2,13 @@
  * softmaskFromHardmask.cpp                                                  *
  * Written by Patrick Reilly                                                 *
  * Version 1.0 written 2018/06/25                                            *
+ * Version 1.1 written 2026/10/17 (Inputs may be wrapped at any length)      *
+ * Version 1.2 written 2026/10/17 (Vectorized masking)                       *
  * Description:                                                              *
  *  Given an unmasked FASTA and a hardmasked FASTA, generates a softmasked   *
  *  FASTA equivalent to that produced by the -xsmall option of RepeatMasker. *
+ *  The FASTAs are synchronized by site, so they may be wrapped differently, *
+ *  and the output keeps the line wrapping of the unmasked FASTA.            *
  *                                                                           *
  * Syntax: softmaskFromHardmask [options] <unmasked FASTA> <hardmasked FASTA>*
  *  unmasked FASTA:       Path to unmasked FASTA                             *
@@ -17,6 +21,9 @@
 #include <string>
 #include <getopt.h>
 #include <cctype>
+#include <vector>
+#include "pseudorefReader.h"
+#include "simdKernels.h"
 
 //Define constants for getopt:
 #define no_argument 0
@@ -24,17 +31,16 @@
 #define optional_argument 2
 
 //Version:
-#define version "1.0"
+#define version "1.2"
 
 //Usage/help:
-#define usage "softmaskFromHardmask\nUsage:\n softmaskFromHardmask [options] <unmasked FASTA> <hardmasked FASTA>\n Mandatory arguments:\n  unmasked FASTA\t\tPath to unmasked FASTA\n  hardmasked FASTA\t\t\tPath to hardmasked FASTA\n\n Options:\n  -d,--debug\t\tToggle debugging output\n\n Description:\n  Outputs a soft-masked FASTA given an unmasked and hard-masked FASTA.\n"
+#define usage "softmaskFromHardmask\nUsage:\n softmaskFromHardmask [options] <unmasked FASTA> <hardmasked FASTA>\n Mandatory arguments:\n  unmasked FASTA\t\tPath to unmasked FASTA\n  hardmasked FASTA\t\t\tPath to hardmasked FASTA\n\n Options:\n  -d,--debug\t\tToggle debugging output\n\n Description:\n  Outputs a soft-masked FASTA given an unmasked and hard-masked FASTA.\n  The FASTAs may be wrapped at different lengths, and the output keeps\n  the line wrapping of the unmasked FASTA.\n"
 
 using namespace std;
 
 int main(int argc, char **argv) {
    //Variables for processing the FASTAs:
    string unmasked_FASTA = "", hardmasked_FASTA = "";
-   string unmasked_line = "", hardmasked_line = "";
    bool debug = 0;
 
    //Variables for getopt_long:
@@ -80,87 +86,60 @@ int main(int argc, char **argv) {
       cerr << "Ignoring extra positional arguments starting at " << argv[optind++] << endl;
    }
    
-   //Do some error checking on the arguments:
-   ifstream unmasked, hardmasked;
-   unmasked.open(unmasked_FASTA);
-   if (!unmasked) {
-      cerr << "Error opening unmasked FASTA file." << endl;
+   //Open both FASTAs once, so process substitutions work too:
+   vector<string> input_paths;
+   input_paths.push_back(unmasked_FASTA);
+   input_paths.push_back(hardmasked_FASTA);
+   PseudorefReader FASTA_reader;
+   FASTA_reader.checkHeaders(0); //Headers are taken from the unmasked FASTA
+   if (!FASTA_reader.open(input_paths)) {
       return 2;
    }
-   getline(unmasked, unmasked_line);
-   if (!unmasked) {
-      cerr << "Error reading unmasked FASTA file." << endl;
-      unmasked.close();
-      return 3;
-   }
-   if (unmasked_line[0] != '>') {
-      cerr << "Unmasked FASTA is not properly formatted FASTA: Does not start with >." << endl;
-      unmasked.close();
-      return 4;
-   }
-   unmasked_line = "";
-   unmasked.close();
-   hardmasked.open(hardmasked_FASTA);
-   if (!hardmasked) {
-      cerr << "Error opening hard-masked FASTA file." << endl;
-      return 2;
-   }
-   getline(hardmasked, hardmasked_line);
-   if (!hardmasked) {
-      cerr << "Error reading hard-masked FASTA file." << endl;
-      hardmasked.close();
+   
+   //Do some error checking on the first line of each FASTA:
+   vector<SequenceView> FASTA_lines;
+   reader_status row_status = FASTA_reader.readRow(FASTA_lines);
+   if (row_status == READER_IO_ERROR || row_status == READER_EOF) {
+      cerr << "Error reading " << (FASTA_reader.failedInput() == 0 ? "unmasked" : "hard-masked") << " FASTA file." << endl;
       return 3;
    }
-   if (hardmasked_line[0] != '>') {
-      cerr << "Hard-masked FASTA is not properly formatted FASTA: Does not start with >." << endl;
-      hardmasked.close();
+   if (row_status != READER_HEADER) {
+      if (FASTA_lines[0].bases[0] != '>') {
+         cerr << "Unmasked FASTA is not properly formatted FASTA: Does not start with >." << endl;
+      } else {
+         cerr << "Hard-masked FASTA is not properly formatted FASTA: Does not start with >." << endl;
+      }
       return 4;
    }
-
-   hardmasked_line = "";
-   hardmasked.close();
    
-   //Now perform the main processing:
-   unmasked.open(unmasked_FASTA);
-   hardmasked.open(hardmasked_FASTA);
-   getline(unmasked, unmasked_line);
-   getline(hardmasked, hardmasked_line);
-   while (unmasked && hardmasked) {
-      if (unmasked_line.length() == 0 || hardmasked_line.length() == 0) {
-         break;
-      }
-      if (unmasked_line[0] != '>' && hardmasked_line[0] != '>') {
-         if (unmasked_line.length() != hardmasked_line.length()) {
-            cerr << "Unmasked and hard-masked FASTAs do not wrap at same line length." << endl;
-            if (debug) {
-               cerr << unmasked_line << endl;
-               cerr << hardmasked_line << endl;
-            }
-            unmasked.close();
-            hardmasked.close();
-            return 5;
-         }
-         unsigned long int unmaskedlength = unmasked_line.length();
-         string softmasked_line = unmasked_line;
-         for (unsigned long int i = 0; i < unmaskedlength; i++) {
-            //Force to uppercase for comparison:
-            int unmaskedbase = toupper(unmasked_line[i]);
-            int hardmaskedbase = toupper(hardmasked_line[i]);
-            if (unmaskedbase != 'N' && hardmaskedbase == 'N') {
-               softmasked_line[i] = tolower(unmaskedbase);
-            } else {
-               softmasked_line[i] = unmaskedbase;
-            }
+   //Now perform the main processing, keeping the line wrapping of the unmasked FASTA:
+   string softmasked_run;
+   while (row_status == READER_HEADER || row_status == READER_SEQUENCE) {
+      if (row_status == READER_SEQUENCE) {
+         unsigned long int run_length = FASTA_lines[0].length;
+         softmasked_run.resize(run_length);
+         softmaskRun(FASTA_lines[0].bases, FASTA_lines[1].bases, run_length, &softmasked_run[0]);
+         cout << softmasked_run;
+         if (FASTA_reader.lineEnded(0)) {
+            cout << endl;
          }
-         cout << softmasked_line << endl;
       } else {
-         cout << unmasked_line << endl;
+         cout << string(FASTA_lines[0].bases, FASTA_lines[0].length) << endl;
       }
-      getline(unmasked, unmasked_line);
-      getline(hardmasked, hardmasked_line);
+      row_status = FASTA_reader.readRow(FASTA_lines);
+   }
+   if (row_status == READER_NOT_SYNCHRONIZED) {
+      cerr << "Unmasked and hard-masked FASTAs have different lengths for a scaffold." << endl;
+      if (debug) {
+         cerr << string(FASTA_lines[0].bases, FASTA_lines[0].length) << endl;
+         cerr << string(FASTA_lines[1].bases, FASTA_lines[1].length) << endl;
+      }
+      return 5;
+   } else if (row_status == READER_IO_ERROR) {
+      cerr << "Error reading " << (FASTA_reader.failedInput() == 0 ? "unmasked" : "hard-masked") << " FASTA file." << endl;
+      return 3;
    }
-   unmasked.close();
-   hardmasked.close();
+   FASTA_reader.close();
    
    return 0;
 }
@@ -0,0 +1,441 @@
+/****************************************************************************
+ * vcfInput.h                                                               *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Reads a multi-sample VCF (plain, gzipped, or bgzipped) together with the *
+ *  reference FASTA it was called against, and hands back each sample's     *
+ *  sites as they would appear in its pseudoreference, so PseudorefReader   *
+ *  can treat every sample of the VCF as an input without ever writing the  *
+ *  pseudoreferences out.                                                   *
+ * Sites are decoded VCF_ROW_SITES at a time for every sample at once:      *
+ *  sites with a record get the IUPAC code of each sample's genotype, and   *
+ *  every other site is uncalled, so is N.  Records that fail a filter,     *
+ *  missing genotypes, and alleles other than single bases (e.g. indels or  *
+ *  *) are also N.  Homozygous reference calls keep the case of the         *
+ *  reference, so samples that only have reference calls in a run of sites  *
+ *  all share one copy of it.                                               *
+ * The reference needs a .fai (e.g. from samtools faidx), and records must  *
+ *  be sorted in the order of the scaffolds in the .fai.                    *
+ ****************************************************************************/
+
+#ifndef VCF_INPUT_H
+#define VCF_INPUT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fastaIndex.h"
+#include "compressedInput.h"
+
+//Number of sites decoded at a time when reading a VCF sequentially:
+#define VCF_ROW_SITES 65536
+
+//Size of the blocks read from a VCF:
+#define VCF_BLOCK_SIZE 1048576
+
+//Whether a path names a VCF rather than a FASTA:
+inline bool isVCFPath(const std::string &path) {
+   const char *extensions[] = {".vcf", ".vcf.gz", ".vcf.bgz"};
+   for (unsigned int e = 0; e < 3; e++) {
+      std::string extension = extensions[e];
+      if (path.length() > extension.length() && path.compare(path.length()-extension.length(), extension.length(), extension) == 0) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+//IUPAC code of an unordered pair of uppercase bases, N if either isn't ACGT:
+inline char IUPACPair(char first_base, char second_base) {
+   if (first_base == second_base) {
+      return first_base;
+   }
+   switch (first_base | (second_base << 8)) {
+      case 'A' | ('C' << 8): case 'C' | ('A' << 8):
+         return 'M';
+      case 'A' | ('G' << 8): case 'G' | ('A' << 8):
+         return 'R';
+      case 'A' | ('T' << 8): case 'T' | ('A' << 8):
+         return 'W';
+      case 'C' | ('G' << 8): case 'G' | ('C' << 8):
+         return 'S';
+      case 'C' | ('T' << 8): case 'T' | ('C' << 8):
+         return 'Y';
+      case 'G' | ('T' << 8): case 'T' | ('G' << 8):
+         return 'K';
+      default:
+         return 'N';
+   }
+}
+
+class VCFInput {
+   public:
+      VCFInput() : fd(-1), reference_fd(-1), compressed(NULL), begin(0), eof(0), record_pending(0), record_scaffold(0), record_site(0), chunk_loaded(0), chunk_scaffold(0), chunk_start(0), chunk_length(0) {}
+      ~VCFInput() {
+         if (fd >= 0) {
+            ::close(fd);
+         }
+         if (reference_fd >= 0) {
+            ::close(reference_fd);
+         }
+         delete compressed;
+      }
+
+      //Open a VCF and its reference, reading the sample names from the
+      // #CHROM line and the scaffolds from the reference .fai, returning 0
+      // (after explaining why on STDERR) on failure:
+      bool open(const std::string &VCF_path, const std::string &reference_path, unsigned int decompression_threads = 1) {
+         path = VCF_path;
+         fd = ::open(VCF_path.c_str(), O_RDONLY);
+         if (fd < 0) {
+            std::cerr << "Error opening input VCF: " << VCF_path << "." << std::endl;
+            return 0;
+         }
+         //Check for gzip, keeping any bytes we had to consume from a pipe:
+         unsigned char magic[2];
+         unsigned long magic_length = 0;
+         ssize_t magic_read = pread(fd, magic, 2, 0);
+         bool consumed_magic = magic_read < 0 && errno == ESPIPE;
+         if (consumed_magic) {
+            while (magic_length < 2 && (magic_read = ::read(fd, magic+magic_length, 2-magic_length)) > 0) {
+               magic_length += magic_read;
+            }
+         } else if (magic_read > 0) {
+            magic_length = magic_read;
+         }
+         if (isGzipMagic(magic, magic_length)) {
+            compressed = new CompressedInput(fd, decompression_threads, magic, consumed_magic ? magic_length : 0);
+         } else if (consumed_magic) {
+            buffer.assign((const char *)magic, magic_length);
+         }
+         //Skip the meta-information lines up to the #CHROM line:
+         std::string line;
+         int line_status;
+         while ((line_status = readLine(line)) > 0 && line.compare(0, 6, "#CHROM") != 0) {
+            if (line.empty() || line[0] != '#') {
+               line_status = 0;
+               break;
+            }
+         }
+         if (line_status <= 0) {
+            std::cerr << "Error reading header of input VCF " << VCF_path << ", is the #CHROM line missing?" << std::endl;
+            return 0;
+         }
+         splitFields(line, '\t', fields);
+         for (unsigned long field = 9; field < fields.size(); field++) {
+            sample_names.push_back(fields[field]);
+         }
+
+         if (reference_path.empty()) {
+            std::cerr << "Input VCF " << VCF_path << " needs the reference FASTA it was called against." << std::endl;
+            return 0;
+         }
+         reference_fd = ::open(reference_path.c_str(), O_RDONLY);
+         if (reference_fd < 0) {
+            std::cerr << "Error opening reference FASTA: " << reference_path << "." << std::endl;
+            return 0;
+         }
+         if (!readFastaIndex(reference_path, reference_index)) {
+            std::cerr << "Error reading index " << reference_path << ".fai, please index the reference with samtools faidx." << std::endl;
+            return 0;
+         }
+         headers.resize(reference_index.size());
+         for (unsigned long k = 0; k < reference_index.size(); k++) {
+            if (!readFastaHeaderBefore(reference_fd, reference_index[k].offset, headers[k])) {
+               std::cerr << "Error finding header of scaffold " << reference_index[k].name << " in " << reference_path << ", is the .fai out of date?" << std::endl;
+               return 0;
+            }
+            scaffold_numbers.insert(std::make_pair(reference_index[k].name, k));
+         }
+         shared_sites.reserve(VCF_ROW_SITES);
+         sample_sites.resize(sample_names.size());
+         return nextRecord();
+      }
+
+      const std::string &VCFPath() const {
+         return path;
+      }
+      unsigned long numSamples() const {
+         return sample_names.size();
+      }
+      const std::string &sampleName(unsigned long sample) const {
+         return sample_names[sample];
+      }
+
+      //Scaffolds of the reference, in order, and their full headers:
+      unsigned long numScaffolds() const {
+         return reference_index.size();
+      }
+      const std::string &scaffoldHeader(unsigned long scaffold_number) const {
+         return headers[scaffold_number];
+      }
+      uint64_t scaffoldLength(unsigned long scaffold_number) const {
+         return reference_index[scaffold_number].length;
+      }
+
+      //Decode num_sites sites starting at first_site of a scaffold for
+      // every sample, consuming the records in that range
+      //Ranges must be requested in order, and are only decoded once, so
+      // every sample can ask for the same range in turn
+      //Returns 0 (after explaining why on STDERR) on failure
+      bool loadChunk(unsigned long scaffold_number, uint64_t first_site, unsigned long num_sites) {
+         if (chunk_loaded && chunk_scaffold == scaffold_number && chunk_start == first_site && chunk_length == num_sites) {
+            return 1;
+         }
+         chunk_loaded = 0;
+         if (!readFastaSites(reference_fd, reference_index[scaffold_number], first_site, num_sites, reference_sites)) {
+            std::cerr << "Error reading reference sites of scaffold " << reference_index[scaffold_number].name << " for input VCF " << path << "." << std::endl;
+            return 0;
+         }
+         shared_sites.assign(num_sites, 'N');
+         sample_diverged.assign(sample_names.size(), 0);
+         //Records before the range belong to ranges that were never asked
+         // for, so are skipped:
+         while (record_pending && (record_scaffold < scaffold_number || (record_scaffold == scaffold_number && record_site < first_site + num_sites))) {
+            if (record_scaffold == scaffold_number && record_site >= first_site && !applyRecord(record_site - first_site)) {
+               return 0;
+            }
+            if (!nextRecord()) {
+               return 0;
+            }
+         }
+         chunk_loaded = 1;
+         chunk_scaffold = scaffold_number;
+         chunk_start = first_site;
+         chunk_length = num_sites;
+         return 1;
+      }
+
+      //Sites of a sample in the range last decoded by loadChunk():
+      const char *sampleSites(unsigned long sample) const {
+         return sample_diverged[sample] ? sample_sites[sample].data() : shared_sites.data();
+      }
+
+   private:
+      std::string path;
+      int fd;
+      int reference_fd;
+      CompressedInput *compressed;
+      std::string buffer;
+      unsigned long begin; //Start of unconsumed data in buffer
+      bool eof;
+      std::vector<std::string> sample_names;
+      std::vector<FastaIndexEntry> reference_index;
+      std::vector<std::string> headers;
+      std::unordered_map<std::string, unsigned long> scaffold_numbers;
+      //Next record, not yet applied:
+      bool record_pending;
+      std::string record;
+      unsigned long record_scaffold;
+      uint64_t record_site;
+      std::vector<std::string> fields;
+      std::vector<std::string> subfields;
+      std::vector<char> allele_bases;
+      //Decoded range: sites are shared_sites unless the sample diverged
+      // from it, in which case they are its own copy in sample_sites
+      bool chunk_loaded;
+      unsigned long chunk_scaffold;
+      uint64_t chunk_start;
+      unsigned long chunk_length;
+      std::string reference_sites;
+      std::string shared_sites;
+      std::vector<char> sample_diverged;
+      std::vector<std::string> sample_sites;
+
+      static void splitFields(const std::string &line, char delimiter, std::vector<std::string> &split_fields) {
+         split_fields.clear();
+         size_t field_start = 0;
+         while (true) {
+            size_t field_end = line.find(delimiter, field_start);
+            split_fields.push_back(line.substr(field_start, field_end == std::string::npos ? std::string::npos : field_end-field_start));
+            if (field_end == std::string::npos) {
+               return;
+            }
+            field_start = field_end + 1;
+         }
+      }
+
+      //Read the next line of the VCF, without its line terminator
+      //Returns 1 on success, 0 at end of file, and -1 on a read error
+      int readLine(std::string &line) {
+         size_t search_start = begin;
+         while (true) {
+            size_t newline = buffer.find('\n', search_start);
+            if (newline != std::string::npos) {
+               line.assign(buffer, begin, newline-begin);
+               begin = newline + 1;
+               break;
+            }
+            if (eof) { //Last line may lack a newline
+               if (begin == buffer.length()) {
+                  return 0;
+               }
+               line.assign(buffer, begin, std::string::npos);
+               begin = buffer.length();
+               break;
+            }
+            buffer.erase(0, begin);
+            begin = 0;
+            search_start = buffer.length();
+            unsigned long buffer_end = buffer.length();
+            buffer.resize(buffer_end + VCF_BLOCK_SIZE);
+            ssize_t bytes_read;
+            if (compressed != NULL) {
+               bytes_read = compressed->read(&buffer[buffer_end], VCF_BLOCK_SIZE);
+            } else {
+               bytes_read = ::read(fd, &buffer[buffer_end], VCF_BLOCK_SIZE);
+            }
+            buffer.resize(buffer_end + std::max(bytes_read, (ssize_t)0));
+            if (bytes_read < 0) {
+               if (errno == EINTR) {
+                  continue;
+               }
+               return -1;
+            } else if (bytes_read == 0) {
+               eof = 1;
+            }
+         }
+         if (!line.empty() && line[line.length()-1] == '\r') {
+            line.erase(line.length()-1);
+         }
+         return 1;
+      }
+
+      //Read the next record and find its scaffold and site, checking that
+      // records are sorted, returning 0 (after explaining why) on failure:
+      bool nextRecord() {
+         int line_status;
+         while ((line_status = readLine(record)) > 0 && record.empty()) {}
+         if (line_status < 0) {
+            std::cerr << "Error reading input VCF: " << path << "." << std::endl;
+            return 0;
+         }
+         if (line_status == 0) {
+            record_pending = 0;
+            return 1;
+         }
+         size_t chrom_end = record.find('\t');
+         size_t pos_end = chrom_end == std::string::npos ? std::string::npos : record.find('\t', chrom_end+1);
+         if (pos_end == std::string::npos) {
+            std::cerr << "Malformed record in input VCF " << path << ": " << record << std::endl;
+            errno = EINVAL;
+            return 0;
+         }
+         auto scaffold_iterator = scaffold_numbers.find(record.substr(0, chrom_end));
+         if (scaffold_iterator == scaffold_numbers.end()) {
+            std::cerr << "Scaffold " << record.substr(0, chrom_end) << " of input VCF " << path << " is not in the reference." << std::endl;
+            errno = EINVAL;
+            return 0;
+         }
+         uint64_t site = strtoull(record.c_str()+chrom_end+1, NULL, 10);
+         if (site == 0 || site > reference_index[scaffold_iterator->second].length) {
+            std::cerr << "Position " << record.substr(chrom_end+1, pos_end-chrom_end-1) << " of input VCF " << path << " is outside scaffold " << record.substr(0, chrom_end) << " of the reference." << std::endl;
+            errno = EINVAL;
+            return 0;
+         }
+         site--;
+         if (record_pending && (scaffold_iterator->second < record_scaffold || (scaffold_iterator->second == record_scaffold && site < record_site))) {
+            std::cerr << "Input VCF " << path << " is not sorted in the order of the reference, at " << record.substr(0, pos_end) << std::endl;
+            errno = EINVAL;
+            return 0;
+         }
+         record_pending = 1;
+         record_scaffold = scaffold_iterator->second;
+         record_site = site;
+         return 1;
+      }
+
+      //IUPAC code of a sample's genotype, given the GT subfield onwards:
+      char genotypeBase(const char *genotype, char reference_base) const {
+         char bases[2];
+         unsigned int num_bases = 0;
+         bool reference_only = 1;
+         while (true) {
+            if (*genotype == '.') {
+               return 'N';
+            }
+            char *allele_end;
+            unsigned long allele = strtoul(genotype, &allele_end, 10);
+            if (allele_end == genotype || allele >= allele_bases.size() || allele_bases[allele] == 0) {
+               return 'N';
+            }
+            reference_only = reference_only && allele == 0;
+            char base = allele_bases[allele];
+            if (num_bases == 0 || (base != bases[0] && num_bases == 1)) {
+               bases[num_bases++] = base;
+            } else if (base != bases[0] && base != bases[1]) {
+               return 'N'; //More than two bases can't be one IUPAC code
+            }
+            genotype = allele_end;
+            if (*genotype != '/' && *genotype != '|') {
+               break;
+            }
+            genotype++;
+         }
+         if (reference_only) {
+            return reference_base;
+         }
+         return num_bases == 1 ? bases[0] : IUPACPair(bases[0], bases[1]);
+      }
+
+      //Set the sites of every sample at offset site_offset of the range
+      // from the pending record:
+      bool applyRecord(unsigned long site_offset) {
+         splitFields(record, '\t', fields);
+         if (fields.size() < 9 + sample_names.size()) {
+            std::cerr << "Record in input VCF " << path << " has too few columns: " << record.substr(0, record.find('\t', record.find('\t')+1)) << std::endl;
+            errno = EINVAL;
+            return 0;
+         }
+         char reference_base = reference_sites[site_offset];
+         //Allele 0 is the reference base, and alleles that aren't a single
+         // base are unusable:
+         allele_bases.assign(1, toupper(reference_base));
+         if (fields[4] != ".") {
+            splitFields(fields[4], ',', subfields);
+            for (auto allele_iterator = subfields.begin(); allele_iterator != subfields.end(); ++allele_iterator) {
+               char base = allele_iterator->length() == 1 ? toupper((*allele_iterator)[0]) : 0;
+               allele_bases.push_back(base == 'A' || base == 'C' || base == 'G' || base == 'T' ? base : 0);
+            }
+         }
+         bool filtered = fields[6] != "PASS" && fields[6] != ".";
+         splitFields(fields[8], ':', subfields);
+         unsigned long GT_index = std::find(subfields.begin(), subfields.end(), "GT") - subfields.begin();
+         bool called = !filtered && GT_index < subfields.size();
+         shared_sites[site_offset] = called ? reference_base : 'N';
+         for (unsigned long j = 0; j < sample_names.size(); j++) {
+            char base = 'N';
+            if (called) {
+               const char *genotype = fields[9+j].c_str();
+               for (unsigned long subfield = 0; subfield < GT_index && genotype != NULL; subfield++) {
+                  genotype = strchr(genotype, ':');
+                  if (genotype != NULL) {
+                     genotype++;
+                  }
+               }
+               base = genotype == NULL ? 'N' : genotypeBase(genotype, reference_base);
+            }
+            if (!sample_diverged[j]) {
+               if (base == shared_sites[site_offset]) {
+                  continue;
+               }
+               sample_sites[j] = shared_sites;
+               sample_diverged[j] = 1;
+            }
+            sample_sites[j][site_offset] = base;
+         }
+         return 1;
+      }
+};
+
+#endif
@@ -0,0 +1,374 @@
+/****************************************************************************
+ * windowSums.h                                                             *
+ * Written by Patrick Reilly                                                *
+ * Version 1.0 written 2026/10/17                                           *
+ *                                                                          *
+ * Description:                                                             *
+ * Window sums shared by nonOverlappingWindows and the windowed output of   *
+ *  calculateDxy.                                                           *
+ * ExactSum keeps a sum of doubles exactly, as a fixed-point number, so the *
+ *  sum doesn't depend on the order its terms were added in, and partial    *
+ *  sums of a window from different shards or threads add up to exactly     *
+ *  what a single pass would have summed.                                   *
+ * WindowFilter applies nonOverlappingWindows' -n, -f, and -a to a site,    *
+ *  giving the weight of its statistics and what it adds to the window's    *
+ *  denominator.                                                            *
+ * StatisticWindows sums every statistic column of per-site output over     *
+ *  non-overlapping windows at once, all sharing the one filter column, and *
+ *  outputs the mean of each column per window, as running                  *
+ *  nonOverlappingWindows once per column would.                            *
+ ****************************************************************************/
+
+#ifndef WINDOW_SUMS_H
+#define WINDOW_SUMS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+//Number of 32-bit digits in an exact sum, enough for the whole range of
+// doubles, with room to spare for carries:
+#define EXACT_SUM_DIGITS 72
+//The lowest digit is in units of 2^EXACT_SUM_LOW_EXPONENT, which is below
+// the smallest subnormal double (2^-1074):
+#define EXACT_SUM_LOW_EXPONENT -1088
+//Digits can take this many additions before they need carrying:
+#define EXACT_SUM_CARRY_INTERVAL 536870912
+//A term's 53-bit mantissa can be multiplied by up to this much at once:
+#define EXACT_SUM_MAX_MULTIPLE 1024
+
+//Exact sum of doubles, kept as a fixed-point number in 32-bit digits, so
+// the sum doesn't depend on the order its terms were added in, and the
+// partial sums of a window from different shards add up to exactly what a
+// single run would have summed:
+class ExactSum {
+   public:
+      ExactSum() {
+         clear();
+      }
+
+      void clear() {
+         digits.fill(0);
+         magnitude_digits.fill(0);
+         additions = 0;
+         special = 0.0;
+      }
+
+      //Add term count times (e.g. once for each of a run of sites with the
+      // same value), exactly as adding it that many times would:
+      void add(double term, uint64_t count = 1) {
+         if (term == 0.0 || count == 0) {
+            return;
+         }
+         if (!std::isfinite(term)) { //Infinities and NaNs can't be fixed-point
+            special += term * (double)count;
+            return;
+         }
+         int exponent;
+         int64_t mantissa = (int64_t)ldexp(frexp(term, &exponent), 53); //Exact, as doubles have 53-bit mantissas
+         int shift = exponent - 53 - EXACT_SUM_LOW_EXPONENT;
+         if (shift < 0) { //Subnormals only have zeroes below the lowest digit
+            mantissa /= (int64_t)1 << -shift;
+            shift = 0;
+         }
+         bool negative = mantissa < 0;
+         uint64_t magnitude = negative ? -mantissa : mantissa;
+         unsigned long first_digit = shift / 32;
+         while (count > 0) {
+            //Multiply by as much of the count as keeps the product in 63 bits:
+            uint64_t multiple = count < EXACT_SUM_MAX_MULTIPLE ? count : EXACT_SUM_MAX_MULTIPLE;
+            count -= multiple;
+            uint64_t product = magnitude * multiple;
+            //Split the product so each shifted half fits in 64 bits:
+            uint64_t low_bits = (product & 0xFFFFFFFF) << (shift % 32);
+            uint64_t high_bits = (product >> 32) << (shift % 32);
+            int64_t parts[3] = {(int64_t)(low_bits & 0xFFFFFFFF), (int64_t)((low_bits >> 32) + (high_bits & 0xFFFFFFFF)), (int64_t)(high_bits >> 32)};
+            for (unsigned int d = 0; d < 3; d++) {
+               digits[first_digit+d] += negative ? -parts[d] : parts[d];
+            }
+            if (++additions == EXACT_SUM_CARRY_INTERVAL) {
+               carry();
+            }
+         }
+      }
+
+      //The sum as a double:
+      //Carrying leaves one representation of each sum, so equal sums
+      // always give the same double
+      double value() {
+         double sign = magnitude();
+         double total = 0.0;
+         for (unsigned long d = 0; d < EXACT_SUM_DIGITS; d++) {
+            if (magnitude_digits[d] != 0) {
+               total += ldexp((double)magnitude_digits[d], 32*d + EXACT_SUM_LOW_EXPONENT);
+            }
+         }
+         return sign*total + special;
+      }
+
+      //The sum as comma-separated hexadecimal doubles that add up to it
+      // exactly, e.g. for partial windows:
+      std::string terms() {
+         double sign = magnitude();
+         std::string sum_terms = "";
+         char term_string[64];
+         for (unsigned long d = 0; d < EXACT_SUM_DIGITS; d++) {
+            if (magnitude_digits[d] != 0) {
+               snprintf(term_string, sizeof(term_string), "%a", sign*ldexp((double)magnitude_digits[d], 32*d + EXACT_SUM_LOW_EXPONENT));
+               sum_terms += (sum_terms.empty() ? "" : ",") + std::string(term_string);
+            }
+         }
+         if (special != 0.0 || std::isnan(special)) {
+            snprintf(term_string, sizeof(term_string), "%a", special);
+            sum_terms += (sum_terms.empty() ? "" : ",") + std::string(term_string);
+         }
+         return sum_terms.empty() ? "0" : sum_terms;
+      }
+
+      //Add a sum given by terms(), returning 0 if it's malformed:
+      bool addTerms(const std::string &sum_terms) {
+         const char *term_start = sum_terms.c_str();
+         while (true) {
+            char *term_end;
+            double term = strtod(term_start, &term_end);
+            if (term_end == term_start || (*term_end != ',' && *term_end != '\0')) {
+               return 0;
+            }
+            add(term);
+            if (*term_end == '\0') {
+               return 1;
+            }
+            term_start = term_end + 1;
+         }
+      }
+
+      //Add another sum, e.g. the part of a window summed on another thread:
+      void add(ExactSum other) {
+         other.carry();
+         carry();
+         for (unsigned long d = 0; d < EXACT_SUM_DIGITS; d++) {
+            digits[d] += other.digits[d];
+         }
+         special += other.special;
+         additions++;
+      }
+
+   private:
+      std::array<int64_t, EXACT_SUM_DIGITS> digits;
+      std::array<int64_t, EXACT_SUM_DIGITS> magnitude_digits;
+      unsigned long additions;
+      double special;
+
+      //Move everything above 32 bits of each digit into the next digit, so
+      // every digit but the top one is in [0, 2^32):
+      void carry() {
+         for (unsigned long d = 0; d+1 < EXACT_SUM_DIGITS; d++) {
+            int64_t carry_value = digits[d] >> 32; //Arithmetic shift, so negative digits borrow
+            digits[d] -= carry_value * ((int64_t)1 << 32);
+            digits[d+1] += carry_value;
+         }
+         additions = 0;
+      }
+
+      //Fill magnitude_digits with the absolute value of the sum, each digit
+      // in [0, 2^32), and return the sum's sign:
+      //A negative sum borrows from its top digit, which would make the
+      // digits below it huge, so negate it first
+      double magnitude() {
+         carry();
+         magnitude_digits = digits;
+         if (digits[EXACT_SUM_DIGITS-1] >= 0) {
+            return 1.0;
+         }
+         for (unsigned long d = 0; d < EXACT_SUM_DIGITS; d++) {
+            magnitude_digits[d] = -magnitude_digits[d];
+         }
+         for (unsigned long d = 0; d+1 < EXACT_SUM_DIGITS; d++) {
+            int64_t carry_value = magnitude_digits[d] >> 32;
+            magnitude_digits[d] -= carry_value * ((int64_t)1 << 32);
+            magnitude_digits[d+1] += carry_value;
+         }
+         return -1.0;
+      }
+};
+
+//How sites are filtered or weighted by the filter column (column 4) of
+// per-site output, as with nonOverlappingWindows -n, -f, and -a:
+struct WindowFilter {
+   bool omit_Ns; //Omit sites whose filter column is nonzero
+   unsigned char nonN_weight; //1 to only include sites whose non-N fraction is above infimum_nonN, 2 to weight sites by it
+   double infimum_nonN;
+
+   WindowFilter() : omit_Ns(0), nonN_weight(0), infimum_nonN(0.0) {}
+
+   //Whether windows have a denominator other than their length:
+   bool filtered() const {
+      return omit_Ns || nonN_weight;
+   }
+
+   //Whether a site's statistics are added to its window's sums, and if so
+   // the weight they're multiplied by, along with what the site adds to the
+   // window's denominator, given its filter column:
+   bool siteWeight(double filter_value, double &weight, double &denominator_term) const {
+      weight = 1.0;
+      denominator_term = 0.0;
+      if (!filtered()) {
+         return 1;
+      }
+      if (nonN_weight == 0) { //Increment the denominator if omit was 0
+         denominator_term = 1.0 - filter_value;
+         return filter_value == 0.0;
+      }
+      if (nonN_weight == 1) { //Only include the site if the fraction of non-N bases is high enough
+         if (filter_value > infimum_nonN) {
+            denominator_term = 1.0;
+            return 1;
+         }
+         return 0;
+      }
+      //Weight the statistic by the fraction of non-N bases for that site:
+      weight = filter_value;
+      denominator_term = filter_value;
+      return 1;
+   }
+};
+
+//Sums of every statistic column over one window, or the part of it seen so
+// far:
+struct ColumnWindow {
+   std::string scaffold;
+   unsigned long start; //Position of the first site of the window
+   unsigned long sites; //Number of sites in the window so far
+   std::vector<ExactSum> sums; //By column (the filter column's stays empty)
+   ExactSum denominator;
+};
+
+//Windowed means of every statistic column of per-site output, where
+// column filter_column is the filter column, e.g. the columns of
+// calculateDxy after the position:
+//Windows are kept until output, so the windows of consecutive runs of sites
+// (e.g. blocks computed on different threads) can be appended in order,
+// adding up the sums of a window split between them
+class StatisticWindows {
+   public:
+      StatisticWindows() : window_size(1), num_columns(0), filter_column(0) {}
+      StatisticWindows(unsigned long size, const WindowFilter &site_filter, unsigned long columns, unsigned long filter_column_index) : window_size(size), filter(site_filter), num_columns(columns), filter_column(filter_column_index) {}
+
+      //Add the value of each column at a site (at a 1-based position) to
+      // its window:
+      void addSite(const std::string &scaffold, unsigned long position, const std::vector<double> &values) {
+         addSites(scaffold, position, 1, values);
+      }
+
+      //Add a run of num_sites sites starting at a 1-based position, which
+      // all have the same values, e.g. invariant sites:
+      void addSites(const std::string &scaffold, unsigned long position, unsigned long num_sites, const std::vector<double> &values) {
+         double weight, denominator_term;
+         bool include_site = filter.siteWeight(values[filter_column], weight, denominator_term);
+         while (num_sites > 0) {
+            unsigned long window_start = ((position-1)/window_size)*window_size+1;
+            if (windows.empty() || windows.back().start != window_start || windows.back().scaffold != scaffold) {
+               openWindow(scaffold, window_start);
+            }
+            //The part of the run in this window:
+            unsigned long window_sites = std::min(num_sites, window_start + window_size - position);
+            ColumnWindow &window = windows.back();
+            window.sites += window_sites;
+            if (filter.filtered()) {
+               window.denominator.add(denominator_term, window_sites);
+            }
+            if (include_site) {
+               for (unsigned long c = 0; c < num_columns; c++) {
+                  if (c != filter_column) {
+                     window.sums[c].add(values[c] * weight, window_sites);
+                  }
+               }
+            }
+            position += window_sites;
+            num_sites -= window_sites;
+         }
+      }
+
+      //Append the windows of the sites following these, merging the first
+      // of them into the last of these if they're the same window:
+      void append(StatisticWindows &next_windows) {
+         for (auto window_iterator = next_windows.windows.begin(); window_iterator != next_windows.windows.end(); ++window_iterator) {
+            if (!windows.empty() && windows.back().start == window_iterator->start && windows.back().scaffold == window_iterator->scaffold) {
+               ColumnWindow &window = windows.back();
+               window.sites += window_iterator->sites;
+               for (unsigned long c = 0; c < num_columns; c++) {
+                  window.sums[c].add(window_iterator->sums[c]);
+               }
+               window.denominator.add(window_iterator->denominator);
+            } else {
+               windows.push_back(std::move(*window_iterator));
+            }
+         }
+         next_windows.windows.clear();
+      }
+
+      //Output every window but the last, which more sites may be added to:
+      void outputFinished(std::ostream &output) {
+         while (windows.size() > 1) {
+            outputWindow(output, windows.front(), windows[1].scaffold != windows.front().scaffold);
+            windows.pop_front();
+         }
+      }
+
+      //Output every window, the last one as the end of its scaffold:
+      void outputAll(std::ostream &output) {
+         outputFinished(output);
+         if (!windows.empty()) {
+            outputWindow(output, windows.front(), 1);
+            windows.pop_front();
+         }
+      }
+
+   private:
+      unsigned long window_size;
+      WindowFilter filter;
+      unsigned long num_columns;
+      unsigned long filter_column;
+      std::deque<ColumnWindow> windows;
+
+      void openWindow(const std::string &scaffold, unsigned long window_start) {
+         windows.push_back(ColumnWindow());
+         ColumnWindow &window = windows.back();
+         window.scaffold = scaffold;
+         window.start = window_start;
+         window.sites = 0;
+         window.sums.resize(num_columns);
+      }
+
+      //Output the scaffold and start of a window, then the mean of each
+      // column, with the fraction of usable sites in place of the filter
+      // column:
+      //If the scaffold does not contain an integral number of windows, its
+      // last window's length is the number of sites in it
+      void outputWindow(std::ostream &output, ColumnWindow &window, bool last_window) {
+         double window_length = last_window ? (double)window.sites : (double)window_size;
+         //No adjustments to denominator if not filtering:
+         double denominator = filter.filtered() ? window.denominator.value() : window_length;
+         output << window.scaffold << '\t' << window.start;
+         for (unsigned long c = 0; c < num_columns; c++) {
+            output << '\t';
+            if (c == filter_column) {
+               output << std::to_string(denominator/window_length);
+            } else if (denominator > 0.0) { //Avoid dividing by zero
+               output << std::to_string(window.sums[c].value()/denominator);
+            } else {
+               output << "NA";
+            }
+         }
+         output << '\n';
+      }
+};
+
+#endif